@@ -0,0 +1,98 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include "async.h"
+#include "future.h"
+#include "logging.h"
+
+#define N_AWAITS 100000
+
+// Counts every allocation made by the library by interposing glibc's malloc
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+
+static size_t n_allocations = 0;
+
+void *malloc(size_t size) {
+    n_allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    n_allocations++;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    n_allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+struct bench_args {
+    future_t **futures;
+    double allocations_per_await;
+    double allocations_per_yield;
+};
+
+void *resolver(void *_futures) {
+    future_t **futures = (future_t**) _futures;
+    for (size_t i = 0; i < N_AWAITS; i++) {
+        async_yield();
+        future_resolve(futures[i], NULL, NULL);
+    }
+    return NULL;
+}
+
+void *entry(void *_args) {
+    struct bench_args *args = (struct bench_args*) _args;
+
+    future_t *resolving = future_create_from_function(resolver, args->futures, FUT_OPT_EAGER);
+
+    // Every await parks, gets notified by the resolver and is requeued
+    size_t before = n_allocations;
+    for (size_t i = 0; i < N_AWAITS; i++) {
+        async_await_future(args->futures[i]);
+    }
+    args->allocations_per_await = (double) (n_allocations - before) / N_AWAITS;
+    async_await_future(resolving);
+    future_destroy(resolving);
+
+    before = n_allocations;
+    for (size_t i = 0; i < N_AWAITS; i++) {
+        async_yield();
+    }
+    args->allocations_per_yield = (double) (n_allocations - before) / N_AWAITS;
+    return NULL;
+}
+
+int main() {
+    future_t **futures = malloc(sizeof(future_t*) * N_AWAITS);
+    for (size_t i = 0; i < N_AWAITS; i++) {
+        futures[i] = future_create(0);
+        future_set_state(futures[i], FUTURE_PENDING);
+    }
+
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+
+    struct bench_args args = {.futures = futures};
+    if (async_context_run(ctx, entry, &args) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    async_context_destroy(ctx);
+
+    for (size_t i = 0; i < N_AWAITS; i++) {
+        future_destroy(futures[i]);
+    }
+    free(futures);
+
+    printf("allocations: heap allocations on the await and yield paths\n");
+    printf("  %6.2f allocations/await\n", args.allocations_per_await);
+    printf("  %6.2f allocations/yield\n", args.allocations_per_yield);
+    return 0;
+}
@@ -0,0 +1,113 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "async.h"
+#include "channel.h"
+#include "future.h"
+#include "logging.h"
+
+#define N_MESSAGES 4000000
+#define N_FUTURE_MESSAGES 400000
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+struct bench_args {
+    size_t capacity;
+    int from_thread;
+    double ns_per_message;
+};
+
+void *produce(void *arg) {
+    async_chan_t *c = (async_chan_t*) arg;
+    for (uint64_t i = 0; i < N_MESSAGES; i++) {
+        async_chan_send(c, &i);
+    }
+    async_chan_close(c);
+    return NULL;
+}
+
+void produce_from_thread(future_t *f, void *arg) {
+    produce(arg);
+    future_resolve(f, NULL, NULL);
+}
+
+void *entry(void *_args) {
+    struct bench_args *args = (struct bench_args*) _args;
+    async_chan_t *c = async_chan_create(args->capacity, sizeof(uint64_t));
+    if (c == NULL) {
+        errorf("failed to create channel\n");
+        return NULL;
+    }
+    double start = now_ns();
+    future_t *producer = args->from_thread
+        ? async_dispatch(produce_from_thread, c)
+        : future_create_from_function(produce, c, FUT_OPT_EAGER);
+    uint64_t value, sum = 0;
+    while (async_chan_recv(c, &value) == 0) {
+        sum += value;
+    }
+    async_await_future(producer);
+    args->ns_per_message = (now_ns() - start) / N_MESSAGES;
+    if (sum != (uint64_t) N_MESSAGES * (N_MESSAGES - 1) / 2) {
+        errorf("lost messages\n");
+    }
+    future_destroy(producer);
+    async_chan_destroy(c);
+    return NULL;
+}
+
+// What passing a stream looked like before channels: a future per message
+void *produce_one(void *arg) {
+    return arg;
+}
+
+void *entry_futures(void *_args) {
+    struct bench_args *args = (struct bench_args*) _args;
+    uint64_t sum = 0;
+    double start = now_ns();
+    for (uintptr_t i = 0; i < N_FUTURE_MESSAGES; i++) {
+        future_t *f = future_create_from_function(produce_one, (void*) i, FUT_OPT_SMALL_STACK);
+        sum += (uintptr_t) async_await_future(f);
+        future_destroy(f);
+    }
+    args->ns_per_message = (now_ns() - start) / N_FUTURE_MESSAGES;
+    if (sum != (uint64_t) N_FUTURE_MESSAGES * (N_FUTURE_MESSAGES - 1) / 2) {
+        errorf("lost messages\n");
+    }
+    return NULL;
+}
+
+static int run(const char *name, coroutine_function_t func, size_t capacity, int from_thread) {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+    struct bench_args args = {.capacity = capacity, .from_thread = from_thread};
+    if (async_context_run(ctx, func, &args) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    async_context_destroy(ctx);
+    printf("  %-28s capacity %-5zu %8.1f ns/message\n", name, capacity, args.ns_per_message);
+    return 0;
+}
+
+int main() {
+    printf("channel: one producer, one consumer\n");
+    if (run("future per message", entry_futures, 0, 0) != 0) return 1;
+    size_t capacities[] = {2, 64, 1024};
+    for (size_t i = 0; i < sizeof(capacities) / sizeof(capacities[0]); i++) {
+        if (run("coroutine -> coroutine", entry, capacities[i], 0) != 0) return 1;
+    }
+    for (size_t i = 0; i < sizeof(capacities) / sizeof(capacities[0]); i++) {
+        if (run("dispatch thread -> coroutine", entry, capacities[i], 1) != 0) return 1;
+    }
+    return 0;
+}
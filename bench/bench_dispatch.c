@@ -0,0 +1,106 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <time.h>
+#include "async.h"
+#include "future.h"
+#include "logging.h"
+
+#define N_LATENCY 10000
+#define N_THROUGHPUT 100000
+
+struct bench_args {
+    future_t *(*dispatch)(dispatch_function_t, void *arg);
+    double latency_ns;
+    double jobs_per_sec;
+};
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void noop(future_t *f, void *arg) {
+    (void) arg;
+    future_resolve(f, NULL, NULL);
+}
+
+// What async_dispatch() used to do: one detached thread per call
+struct per_call_arg {
+    dispatch_function_t func;
+    void *arg;
+    future_t *future;
+};
+
+static int _per_call_thread(void *_arg) {
+    struct per_call_arg *arg = (struct per_call_arg*) _arg;
+    arg->func(arg->future, arg->arg);
+    free(arg);
+    return 0;
+}
+
+future_t *dispatch_per_call_thread(dispatch_function_t f, void *arg) {
+    struct per_call_arg *call = malloc(sizeof(struct per_call_arg));
+    future_t *result = future_create(FUT_OPT_THREADED);
+    future_set_state(result, FUTURE_PENDING);
+    *call = (struct per_call_arg){.func = f, .arg = arg, .future = result};
+    thrd_t thread;
+    if (thrd_create(&thread, _per_call_thread, call) != thrd_success) {
+        errorf("failed to spawn thread\n");
+        abort();
+    }
+    thrd_detach(thread);
+    return result;
+}
+
+void *entry(void *_args) {
+    struct bench_args *args = (struct bench_args*) _args;
+
+    // Round trip of a single dispatch awaited right away
+    double start = now_ns();
+    for (size_t i = 0; i < N_LATENCY; i++) {
+        future_t *f = args->dispatch(noop, NULL);
+        async_await_future(f);
+        future_destroy(f);
+    }
+    args->latency_ns = (now_ns() - start) / N_LATENCY;
+
+    // Many dispatches in flight at once
+    future_t **futures = malloc(sizeof(future_t*) * N_THROUGHPUT);
+    start = now_ns();
+    for (size_t i = 0; i < N_THROUGHPUT; i++) {
+        futures[i] = args->dispatch(noop, NULL);
+    }
+    for (size_t i = 0; i < N_THROUGHPUT; i++) {
+        async_await_future(futures[i]);
+        future_destroy(futures[i]);
+    }
+    args->jobs_per_sec = N_THROUGHPUT / ((now_ns() - start) / 1e9);
+    free(futures);
+    return NULL;
+}
+
+static int run(const char *name, future_t *(*dispatch)(dispatch_function_t, void *arg)) {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+    struct bench_args args = {.dispatch = dispatch};
+    if (async_context_run(ctx, entry, &args) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    async_context_destroy(ctx);
+    printf("  %-16s %8.1f us/round trip %10.0f jobs/s\n", name, args.latency_ns / 1000, args.jobs_per_sec);
+    return 0;
+}
+
+int main() {
+    printf("dispatch: thread pool against a thread per call\n");
+    if (run("thread per call", dispatch_per_call_thread) != 0) return 1;
+    if (run("thread pool", async_dispatch) != 0) return 1;
+    return 0;
+}
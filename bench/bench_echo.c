@@ -0,0 +1,134 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include "async.h"
+#include "coroutine.h"
+#include "future.h"
+#include "net.h"
+#include "logging.h"
+
+#define N_CONNECTIONS 2000
+#define N_REQUESTS 100
+#define MESSAGE_SIZE 64
+
+struct client_args {
+    uint16_t port;
+    uint64_t *latencies;
+};
+
+void *serve(void *arg) {
+    int fd = (int) (intptr_t) arg;
+    char buffer[MESSAGE_SIZE];
+    ssize_t n;
+    while ((n = async_recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        if (async_send(fd, buffer, n, 0) != n) break;
+    }
+    async_close(fd);
+    return NULL;
+}
+
+void *accept_loop(void *arg) {
+    int listener = *(int*) arg;
+    async_context_t *ctx = async_context_get_current();
+    for (size_t i = 0; i < N_CONNECTIONS; i++) {
+        int fd = async_tcp_accept(listener, NULL, NULL);
+        if (fd < 0) {
+            errorf("failed to accept connection\n");
+            break;
+        }
+        async_schedule_coroutine(ctx, coro_create(serve, (void*) (intptr_t) fd, 0));
+    }
+    return NULL;
+}
+
+void *client(void *_args) {
+    struct client_args *args = (struct client_args*) _args;
+    int fd = async_tcp_connect("127.0.0.1", args->port);
+    if (fd < 0) {
+        errorf("failed to connect\n");
+        return NULL;
+    }
+    char request[MESSAGE_SIZE], response[MESSAGE_SIZE];
+    memset(request, 'x', sizeof(request));
+    for (size_t i = 0; i < N_REQUESTS; i++) {
+        uint64_t start = async_now();
+        if (async_send(fd, request, sizeof(request), 0) != sizeof(request)) break;
+        size_t received = 0;
+        while (received < sizeof(response)) {
+            ssize_t n = async_recv(fd, response + received, sizeof(response) - received, 0);
+            if (n <= 0) break;
+            received += n;
+        }
+        args->latencies[i] = async_now() - start;
+    }
+    async_close(fd);
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    int listener = async_tcp_listen("127.0.0.1", 0, 4096);
+    if (listener < 0) {
+        errorf("failed to listen\n");
+        return NULL;
+    }
+    struct sockaddr_in addr;
+    getsockname(listener, (struct sockaddr*) &addr, &(socklen_t){sizeof(addr)});
+
+    uint64_t *latencies = calloc(N_CONNECTIONS * N_REQUESTS, sizeof(uint64_t));
+    struct client_args *args = malloc(N_CONNECTIONS * sizeof(struct client_args));
+    future_t **clients = malloc(N_CONNECTIONS * sizeof(future_t*));
+    if (latencies == NULL || args == NULL || clients == NULL) {
+        errorf("failed to allocate memory for the benchmark\n");
+        return NULL;
+    }
+
+    future_t *acceptor = future_create_from_function(accept_loop, &listener, FUT_OPT_EAGER);
+    uint64_t start = async_now();
+    for (size_t i = 0; i < N_CONNECTIONS; i++) {
+        args[i] = (struct client_args){ .port = ntohs(addr.sin_port), .latencies = latencies + i * N_REQUESTS };
+        clients[i] = future_create_from_function(client, &args[i], FUT_OPT_EAGER);
+    }
+    for (size_t i = 0; i < N_CONNECTIONS; i++) {
+        async_await_future(clients[i]);
+        future_destroy(clients[i]);
+    }
+    double seconds = (async_now() - start) / 1e9;
+    async_await_future(acceptor);
+    future_destroy(acceptor);
+    async_close(listener);
+
+    size_t n = N_CONNECTIONS * N_REQUESTS;
+    qsort(latencies, n, sizeof(uint64_t), compare_u64);
+    printf("  %d connections x %d requests of %d bytes\n", N_CONNECTIONS, N_REQUESTS, MESSAGE_SIZE);
+    printf("  %10.0f requests/s\n", n / seconds);
+    printf("  p50 %7.1f us   p99 %7.1f us   max %7.1f us\n",
+        latencies[n / 2] / 1e3, latencies[n * 99 / 100] / 1e3, latencies[n - 1] / 1e3);
+    free(latencies);
+    free(args);
+    free(clients);
+    return NULL;
+}
+
+int main() {
+    printf("echo: loopback clients and server on one loop\n");
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+    if (async_context_run(ctx, entry, NULL) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    async_context_destroy(ctx);
+    return 0;
+}
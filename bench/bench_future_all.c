@@ -0,0 +1,91 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "async.h"
+#include "future.h"
+#include "logging.h"
+
+#define N_ROUNDS 2000
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Stands in for a request to one backend, which completes on a later turn of
+// the loop or after a fixed latency
+void *backend(void *arg) {
+    uint64_t latency_ns = *(uint64_t*) arg;
+    if (latency_ns == 0) {
+        async_yield();
+    } else {
+        async_sleep(latency_ns);
+    }
+    return arg;
+}
+
+struct bench_args {
+    size_t fan_out;
+    size_t n_rounds;
+    uint64_t latency_ns;
+    double us_per_round;
+};
+
+void *entry(void *_args) {
+    struct bench_args *args = (struct bench_args*) _args;
+    future_t **members = malloc(args->fan_out * sizeof(future_t*));
+    if (members == NULL) {
+        errorf("failed to allocate memory for the benchmark\n");
+        return NULL;
+    }
+
+    double start = now_ns();
+    for (size_t i = 0; i < args->n_rounds; i++) {
+        for (size_t j = 0; j < args->fan_out; j++) {
+            members[j] = future_create_from_function(backend, &args->latency_ns, FUT_OPT_SMALL_STACK);
+        }
+        future_t *all = future_all(members, args->fan_out, 1);
+        if (async_await_future(all) == NULL) {
+            errorf("future_all() did not resolve\n");
+        }
+        future_destroy(all);
+    }
+    args->us_per_round = (now_ns() - start) / args->n_rounds / 1e3;
+    free(members);
+    return NULL;
+}
+
+static int run(size_t fan_out, size_t n_rounds, uint64_t latency_ns) {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+
+    struct bench_args args = {.fan_out = fan_out, .n_rounds = n_rounds, .latency_ns = latency_ns};
+    if (async_context_run(ctx, entry, &args) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    async_context_destroy(ctx);
+
+    printf("  fan-out %-5zu latency %4lu us %10.2f us/round %8.1f ns/member\n",
+        fan_out, latency_ns / 1000, args.us_per_round, args.us_per_round * 1e3 / fan_out);
+    return 0;
+}
+
+int main() {
+    printf("future_all: fan out to tasks and join them\n");
+    size_t fan_outs[] = {4, 64, 256, 1024};
+    for (size_t i = 0; i < sizeof(fan_outs) / sizeof(fan_outs[0]); i++) {
+        if (run(fan_outs[i], N_ROUNDS, 0) != 0) return 1;
+    }
+    // Members that actually wait on something show whether they overlap
+    for (size_t i = 0; i < 3; i++) {
+        if (run(fan_outs[i], 20, 100 * 1000) != 0) return 1;
+    }
+    return 0;
+}
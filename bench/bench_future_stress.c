@@ -0,0 +1,136 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include "async.h"
+#include "future.h"
+#include "logging.h"
+
+#define N_FUTURES 2000000
+#define BATCH 4096
+#define N_RESOLVERS 4
+#define N_FAST_PATH 10000000
+
+struct resolve_range {
+    future_t **futures;
+    size_t begin, end;
+};
+
+// Write syscalls made by the whole process so far, which is how the loop gets
+// signalled
+static unsigned long long write_syscalls() {
+    FILE *io = fopen("/proc/self/io", "r");
+    if (io == NULL) return 0;
+    char line[128];
+    unsigned long long n = 0;
+    while (fgets(line, sizeof(line), io) != NULL) {
+        if (sscanf(line, "syscw: %llu", &n) == 1) break;
+    }
+    fclose(io);
+    return n;
+}
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void resolve_all(future_t *done, void *_range) {
+    struct resolve_range *range = (struct resolve_range*) _range;
+    for (size_t i = range->begin; i < range->end; i++) {
+        future_resolve(range->futures[i], (void*) (uintptr_t) i, NULL);
+    }
+    future_resolve(done, NULL, NULL);
+}
+
+void *waiter(void *f) {
+    return async_await_future(f);
+}
+
+struct bench_args {
+    double ns_per_future;
+    double writes_per_future;
+    double ns_per_fast_path;
+};
+
+void *entry(void *_args) {
+    struct bench_args *args = (struct bench_args*) _args;
+    future_t **futures = malloc(sizeof(future_t*) * BATCH);
+    future_t **waiters = malloc(sizeof(future_t*) * BATCH);
+    future_t *resolvers[N_RESOLVERS];
+    struct resolve_range ranges[N_RESOLVERS];
+
+    unsigned long long writes = write_syscalls();
+    double start = now_ns();
+    for (size_t round = 0; round < N_FUTURES / BATCH; round++) {
+        for (size_t i = 0; i < BATCH; i++) {
+            futures[i] = future_create(FUT_OPT_THREADED);
+            future_set_state(futures[i], FUTURE_PENDING);
+        }
+        for (size_t i = 0; i < BATCH; i++) {
+            waiters[i] = future_create_from_function(waiter, futures[i], FUT_OPT_EAGER | FUT_OPT_SMALL_STACK);
+        }
+        // Let the waiters park before resolving from the pool, so the
+        // resolutions race with coroutines that are still being scheduled
+        async_yield();
+        for (size_t r = 0; r < N_RESOLVERS; r++) {
+            ranges[r] = (struct resolve_range){
+                .futures = futures,
+                .begin = r * BATCH / N_RESOLVERS,
+                .end = (r + 1) * BATCH / N_RESOLVERS
+            };
+            resolvers[r] = async_dispatch(resolve_all, &ranges[r]);
+        }
+        for (size_t i = 0; i < BATCH; i++) {
+            async_await_future(waiters[i]);
+            future_destroy(waiters[i]);
+        }
+        for (size_t r = 0; r < N_RESOLVERS; r++) {
+            async_await_future(resolvers[r]);
+            future_destroy(resolvers[r]);
+        }
+        for (size_t i = 0; i < BATCH; i++) {
+            future_destroy(futures[i]);
+        }
+    }
+    args->ns_per_future = (now_ns() - start) / (N_FUTURES / BATCH * BATCH);
+    args->writes_per_future = (double) (write_syscalls() - writes) / (N_FUTURES / BATCH * BATCH);
+    free(futures);
+    free(waiters);
+
+    // Nobody waiting: resolving and awaiting an already settled future should
+    // cost a handful of atomic operations
+    future_t *f = future_create(FUT_OPT_THREADED);
+    start = now_ns();
+    for (size_t i = 0; i < N_FAST_PATH; i++) {
+        future_set_state(f, FUTURE_PENDING);
+        future_resolve(f, (void*) (uintptr_t) i, NULL);
+        async_await_future(f);
+    }
+    args->ns_per_fast_path = (now_ns() - start) / N_FAST_PATH;
+    future_destroy(f);
+    return NULL;
+}
+
+int main() {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+
+    struct bench_args args = {};
+    if (async_context_run(ctx, entry, &args) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    async_context_destroy(ctx);
+
+    printf("future stress: futures resolved by %d pool threads while coroutines await them\n", N_RESOLVERS);
+    printf("  %8.1f ns/future %10.0f futures/s\n", args.ns_per_future, 1e9 / args.ns_per_future);
+    printf("  %8.4f wakeup writes/future\n", args.writes_per_future);
+    printf("  %8.1f ns/resolve and await without waiters\n", args.ns_per_fast_path);
+    return 0;
+}
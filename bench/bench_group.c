@@ -0,0 +1,82 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "async.h"
+#include "future.h"
+#include "group.h"
+#include "logging.h"
+
+#define N_ROUNDS 2000
+
+// Completes on a later turn of the loop, like a request to a backend
+void *backend(void *arg) {
+    (void) arg;
+    async_yield();
+    return NULL;
+}
+
+int group_backend(void *arg) {
+    (void) arg;
+    async_yield();
+    return 0;
+}
+
+struct bench_args {
+    size_t fan_out;
+    double ns_all;
+    double ns_group;
+};
+
+void *entry(void *_args) {
+    struct bench_args *args = (struct bench_args*) _args;
+    future_t **members = malloc(args->fan_out * sizeof(future_t*));
+    if (members == NULL) {
+        errorf("failed to allocate memory for the benchmark\n");
+        return NULL;
+    }
+
+    uint64_t start = async_now();
+    for (size_t i = 0; i < N_ROUNDS; i++) {
+        for (size_t j = 0; j < args->fan_out; j++) {
+            members[j] = future_create_from_function(backend, NULL, 0);
+        }
+        future_t *all = future_all(members, args->fan_out, 1);
+        async_await_future(all);
+        future_destroy(all);
+    }
+    args->ns_all = (double) (async_now() - start) / N_ROUNDS / args->fan_out;
+
+    start = async_now();
+    for (size_t i = 0; i < N_ROUNDS; i++) {
+        async_group_t *g = async_group_create();
+        for (size_t j = 0; j < args->fan_out; j++) {
+            async_group_spawn(g, group_backend, NULL);
+        }
+        async_group_join(g);
+        async_group_destroy(g);
+    }
+    args->ns_group = (double) (async_now() - start) / N_ROUNDS / args->fan_out;
+    free(members);
+    return NULL;
+}
+
+int main() {
+    printf("group: fan out and join, %d rounds\n", N_ROUNDS);
+    size_t fan_outs[] = { 4, 64, 1024 };
+    for (size_t i = 0; i < sizeof(fan_outs) / sizeof(fan_outs[0]); i++) {
+        async_context_t *ctx = async_context_create();
+        if (ctx == NULL) {
+            errorf("failed to create async context\n");
+            return 1;
+        }
+        struct bench_args args = { .fan_out = fan_outs[i] };
+        if (async_context_run(ctx, entry, &args) != 0) {
+            errorf("error in async context\n");
+            return 1;
+        }
+        async_context_destroy(ctx);
+        printf("  fan-out %-5zu future_all %8.1f ns/child   group %8.1f ns/child\n",
+            args.fan_out, args.ns_all, args.ns_group);
+    }
+    return 0;
+}
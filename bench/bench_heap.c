@@ -0,0 +1,94 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "heap.h"
+#include "logging.h"
+
+#define N_OPS 2000000
+
+// Shaped like the timers kept by an async context
+struct timer {
+    uint64_t deadline;
+    void *future;
+};
+
+static uint64_t timer_priority(void *element) {
+    return ((struct timer*) element)->deadline;
+}
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// Fills a heap with n timers, then pops them all
+static int fill_and_drain(size_t n) {
+    heap h = heap_create(64, sizeof(struct timer), timer_priority);
+    if (h == NULL) {
+        errorf("failed to create heap\n");
+        return 1;
+    }
+    uint64_t rng = 88172645463325252ull;
+    double start = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        heap_insert(h, &(struct timer){ .deadline = next_random(&rng) });
+    }
+    uint64_t last = 0;
+    while (!heap_empty(h)) {
+        uint64_t deadline = ((struct timer*) heap_min(h))->deadline;
+        if (deadline < last) {
+            errorf("heap popped out of order\n");
+            return 1;
+        }
+        last = deadline;
+        heap_pop(h);
+    }
+    printf("  fill %-8zu and drain %8.1f ns/timer\n", n, (now_ns() - start) / n);
+    heap_destroy(h);
+    return 0;
+}
+
+// Keeps n timers pending, each pop is followed by an insert a little later,
+// like a loop rearming timeouts
+static int steady_state(size_t n) {
+    heap h = heap_create(64, sizeof(struct timer), timer_priority);
+    if (h == NULL) {
+        errorf("failed to create heap\n");
+        return 1;
+    }
+    uint64_t rng = 88172645463325252ull;
+    for (size_t i = 0; i < n; i++) {
+        heap_insert(h, &(struct timer){ .deadline = next_random(&rng) % (n * 16) });
+    }
+    double start = now_ns();
+    for (size_t i = 0; i < N_OPS; i++) {
+        uint64_t deadline = ((struct timer*) heap_min(h))->deadline;
+        heap_pop(h);
+        heap_insert(h, &(struct timer){ .deadline = deadline + next_random(&rng) % (n * 16) });
+    }
+    printf("  %-8zu pending        %8.1f ns/pop+insert\n", n, (now_ns() - start) / N_OPS);
+    heap_destroy(h);
+    return 0;
+}
+
+int main() {
+    printf("heap: timer insert and pop\n");
+    size_t sizes[] = {1000, 100000, 1000000};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        if (fill_and_drain(sizes[i]) != 0) return 1;
+    }
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        if (steady_state(sizes[i]) != 0) return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include "async.h"
+#include "future.h"
+#include "logging.h"
+
+#define N_SPECULATIVE 10000
+#define N_ROUNDS 20
+// One in this many speculative futures turns out to be needed
+#define AWAITED_EVERY 100
+
+void *work(void *arg) {
+    return arg;
+}
+
+static long _max_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    future_t **futures = malloc(N_SPECULATIVE * sizeof(future_t*));
+    if (futures == NULL) {
+        errorf("failed to allocate memory for the benchmark\n");
+        return NULL;
+    }
+    long rss_before = _max_rss_kb();
+    uint64_t create_ns = 0, drop_ns = 0;
+    for (size_t round = 0; round < N_ROUNDS; round++) {
+        uint64_t start = async_now();
+        for (size_t i = 0; i < N_SPECULATIVE; i++) {
+            futures[i] = future_create_from_function(work, (void*) (uintptr_t) i, 0);
+        }
+        uint64_t created = async_now();
+        for (size_t i = 0; i < N_SPECULATIVE; i += AWAITED_EVERY) {
+            async_await_future(futures[i]);
+        }
+        for (size_t i = 0; i < N_SPECULATIVE; i++) {
+            future_destroy(futures[i]);
+        }
+        // Lets cancelled futures finish, if they have anything to finish
+        async_yield();
+        create_ns += created - start;
+        drop_ns += async_now() - created;
+    }
+    printf("lazy: %d speculative futures at once, 1 in %d awaited, %d rounds\n",
+        N_SPECULATIVE, AWAITED_EVERY, N_ROUNDS);
+    printf("  create  %8.1f ns/future\n", (double) create_ns / N_ROUNDS / N_SPECULATIVE);
+    printf("  drop    %8.1f ns/future\n", (double) drop_ns / N_ROUNDS / N_SPECULATIVE);
+    printf("  max rss +%ld KiB\n", _max_rss_kb() - rss_before);
+    free(futures);
+    return NULL;
+}
+
+int main() {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+    if (async_context_run(ctx, entry, NULL) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    async_context_destroy(ctx);
+    return 0;
+}
@@ -0,0 +1,91 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "async.h"
+#include "funcs.h"
+#include "future.h"
+#include "logging.h"
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Reads a "Field:   value kB" line from /proc/self/status
+static long proc_status(const char *field) {
+    FILE *f = fopen("/proc/self/status", "r");
+    if (f == NULL) return -1;
+    char line[256];
+    long value = -1;
+    size_t len = strlen(field);
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, field, len) == 0 && line[len] == ':') {
+            value = strtol(line + len + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+    return value;
+}
+
+struct bench_args {
+    size_t n_children;
+    const char *command;
+    double ms;
+    long threads;
+};
+
+void *entry(void *_args) {
+    struct bench_args *args = (struct bench_args*) _args;
+    future_t **children = malloc(args->n_children * sizeof(future_t*));
+    if (children == NULL) {
+        errorf("failed to allocate memory for the benchmark\n");
+        return NULL;
+    }
+
+    double start = now_ns();
+    for (size_t i = 0; i < args->n_children; i++) {
+        children[i] = async_spawn(args->command);
+    }
+    for (size_t i = 0; i < args->n_children; i++) {
+        if (async_await_future(children[i]) == NULL) {
+            errorf("child %zu failed\n", i);
+        }
+        future_destroy(children[i]);
+    }
+    args->ms = (now_ns() - start) / 1e6;
+    args->threads = proc_status("Threads");
+    free(children);
+    return NULL;
+}
+
+static int run(size_t n_children, const char *command) {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+
+    struct bench_args args = {.n_children = n_children, .command = command};
+    if (async_context_run(ctx, entry, &args) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    async_context_destroy(ctx);
+
+    printf("  %4zu x %-12s %9.1f ms %9.1f us/child %4ld threads\n",
+        n_children, command, args.ms, args.ms * 1e3 / n_children, args.threads);
+    return 0;
+}
+
+int main() {
+    printf("process: spawn children concurrently and collect their output\n");
+    if (run(256, "true") != 0) return 1;
+    if (run(256, "sleep 0.1") != 0) return 1;
+    if (run(512, "sleep 0.1") != 0) return 1;
+    printf("  peak RSS %ld kB\n", proc_status("VmHWM"));
+    return 0;
+}
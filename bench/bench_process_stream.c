@@ -0,0 +1,87 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "async.h"
+#include "funcs.h"
+#include "future.h"
+#include "logging.h"
+
+#define N_BYTES (256 * 1024 * 1024)
+#define CHUNK (64 * 1024)
+#define COMMAND "head -c 268435456 /dev/zero"
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Peak resident set size so far, in kB
+static long peak_rss() {
+    FILE *f = fopen("/proc/self/status", "r");
+    if (f == NULL) return -1;
+    char line[256];
+    long value = -1;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "VmHWM:", 6) == 0) {
+            value = strtol(line + 6, NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+    return value;
+}
+
+static void report(const char *name, size_t bytes, double start) {
+    double s = (now_ns() - start) / 1e9;
+    printf("  %-10s %6.0f MiB/s   peak RSS %7ld kB\n", name, bytes / s / (1024 * 1024), peak_rss());
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    // Streaming first, so its peak isn't hidden by the buffered run
+    double start = now_ns();
+    async_process_t *p = async_process_start(COMMAND, ASYNC_PROC_OPT_STDOUT);
+    if (p == NULL) {
+        errorf("failed to start child\n");
+        return NULL;
+    }
+    char *chunk = malloc(CHUNK);
+    size_t total = 0;
+    ssize_t n;
+    while ((n = async_process_read_stdout(p, chunk, CHUNK)) > 0) {
+        total += n;
+    }
+    async_process_destroy(p);
+    free(chunk);
+    if (total != N_BYTES) errorf("streamed %zu bytes\n", total);
+    report("streaming", total, start);
+
+    start = now_ns();
+    future_t *f = async_spawn(COMMAND);
+    async_spawn_result_t *result = async_await_future(f);
+    if (result == NULL) {
+        errorf("async_spawn() failed\n");
+        return NULL;
+    }
+    report("buffered", N_BYTES, start);
+    future_destroy(f);
+    return NULL;
+}
+
+int main() {
+    printf("process stream: read 256 MiB of child output\n");
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+    if (async_context_run(ctx, entry, NULL) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    async_context_destroy(ctx);
+    return 0;
+}
@@ -0,0 +1,78 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "async.h"
+#include "future.h"
+#include "logging.h"
+
+#define N_SWITCHES 1000000
+
+struct bench_args {
+    size_t n_parked;
+    double ns_per_switch;
+};
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void *parked(void *gate) {
+    return async_await_future(gate);
+}
+
+void *entry(void *_args) {
+    struct bench_args *args = (struct bench_args*) _args;
+
+    future_t *gate = future_create(0);
+    future_t **parked_futures = malloc(sizeof(future_t*) * args->n_parked);
+    for (size_t i = 0; i < args->n_parked; i++) {
+        parked_futures[i] = future_create_from_function(parked, gate, FUT_OPT_EAGER);
+    }
+
+    // Let every other coroutine run once and park on the gate
+    async_yield();
+
+    double start = now_ns();
+    for (size_t i = 0; i < N_SWITCHES; i++) {
+        async_yield();
+    }
+    args->ns_per_switch = (now_ns() - start) / N_SWITCHES;
+
+    future_set_state(gate, FUTURE_PENDING);
+    future_resolve(gate, NULL, NULL);
+    async_yield();
+
+    for (size_t i = 0; i < args->n_parked; i++) {
+        future_destroy(parked_futures[i]);
+    }
+    free(parked_futures);
+    future_destroy(gate);
+    return NULL;
+}
+
+int main() {
+    const size_t sizes[] = {10, 100, 1000, 10000, 100000};
+
+    printf("ready queue: cost of a yield with N parked coroutines\n");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        async_context_t *ctx = async_context_create();
+        if (ctx == NULL) {
+            errorf("failed to create async context\n");
+            return 1;
+        }
+
+        struct bench_args args = {.n_parked = sizes[i]};
+        if (async_context_run(ctx, entry, &args) != 0) {
+            errorf("error in async context\n");
+            return 1;
+        }
+        async_context_destroy(ctx);
+
+        printf("  parked=%-7zu %8.1f ns/switch\n", args.n_parked, args.ns_per_switch);
+    }
+
+    return 0;
+}
@@ -0,0 +1,74 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "async.h"
+#include "future.h"
+#include "runtime.h"
+#include "logging.h"
+
+#define N_TASKS 20000
+#define N_ROUNDS 4
+#define WORK_PER_ROUND 20000
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void *cpu_task(void *arg) {
+    volatile uint64_t x = (uintptr_t) arg;
+    for (size_t round = 0; round < N_ROUNDS; round++) {
+        for (size_t i = 0; i < WORK_PER_ROUND; i++) {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        }
+        async_yield();
+    }
+    return (void*) (uintptr_t) x;
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    future_t **tasks = malloc(sizeof(future_t*) * N_TASKS);
+    for (uintptr_t i = 0; i < N_TASKS; i++) {
+        tasks[i] = future_create_from_function(cpu_task, (void*) i, FUT_OPT_EAGER);
+    }
+    for (size_t i = 0; i < N_TASKS; i++) {
+        async_await_future(tasks[i]);
+        future_destroy(tasks[i]);
+    }
+    free(tasks);
+    return NULL;
+}
+
+int main() {
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_workers = n_cpus > 4 ? (size_t) n_cpus : 4;
+
+    printf("runtime: %d CPU-bound tasks on N workers (%ld CPUs online)\n", N_TASKS, n_cpus);
+    double baseline = 0;
+    for (size_t n_workers = 1; n_workers <= max_workers; n_workers *= 2) {
+        async_runtime_t *runtime = async_runtime_create(n_workers, 0);
+        if (runtime == NULL) {
+            errorf("failed to create runtime\n");
+            return 1;
+        }
+
+        double start = now_ns();
+        if (async_runtime_run(runtime, entry, NULL) != 0) {
+            errorf("error in runtime\n");
+            return 1;
+        }
+        double elapsed = now_ns() - start;
+        async_runtime_destroy(runtime);
+
+        double tasks_per_sec = N_TASKS / (elapsed / 1e9);
+        if (baseline == 0) baseline = tasks_per_sec;
+        printf("  workers=%-3zu %10.0f tasks/s  (%.2fx)\n", n_workers, tasks_per_sec, tasks_per_sec / baseline);
+    }
+
+    return 0;
+}
@@ -0,0 +1,68 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "async.h"
+#include "future.h"
+#include "logging.h"
+
+#define N_TASKS 1000000
+#define BATCH 64
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void *small_task(void *arg) {
+    return arg;
+}
+
+struct bench_args {
+    int options;
+    double ns_per_task;
+};
+
+void *entry(void *_args) {
+    struct bench_args *args = (struct bench_args*) _args;
+    future_t *batch[BATCH];
+
+    double start = now_ns();
+    for (size_t i = 0; i < N_TASKS / BATCH; i++) {
+        for (size_t j = 0; j < BATCH; j++) {
+            batch[j] = future_create_from_function(small_task, NULL, FUT_OPT_EAGER | args->options);
+        }
+        for (size_t j = 0; j < BATCH; j++) {
+            async_await_future(batch[j]);
+            future_destroy(batch[j]);
+        }
+    }
+    args->ns_per_task = (now_ns() - start) / (N_TASKS / BATCH * BATCH);
+    return NULL;
+}
+
+static int run(const char *name, int options) {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+
+    struct bench_args args = {.options = options};
+    if (async_context_run(ctx, entry, &args) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    async_context_destroy(ctx);
+
+    printf("  %-14s %8.1f ns/task\n", name, args.ns_per_task);
+    return 0;
+}
+
+int main() {
+    printf("spawn: create, run and destroy a short-lived task\n");
+    if (run("default stack", 0) != 0) return 1;
+    if (run("small stack", FUT_OPT_SMALL_STACK) != 0) return 1;
+    return 0;
+}
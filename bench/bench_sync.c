@@ -0,0 +1,104 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "async.h"
+#include "future.h"
+#include "sync.h"
+#include "logging.h"
+
+#define N_CALLS 4000
+#define MAX_CALLS 16
+#define CALL_LATENCY_NS (200 * 1000)
+#define N_LOCKS 10000000
+
+static double now_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static async_sem_t sem;
+static int n_calling = 0;
+static int use_sem = 0;
+
+// Capping concurrent backend calls
+void *call(void *arg) {
+    (void) arg;
+    if (use_sem) {
+        async_sem_acquire(&sem);
+    } else {
+        // What coroutines had to do before: keep polling until there is room
+        while (n_calling >= MAX_CALLS) async_yield();
+    }
+    n_calling++;
+    async_sleep(CALL_LATENCY_NS);
+    n_calling--;
+    if (use_sem) async_sem_release(&sem);
+    return NULL;
+}
+
+void *entry_calls(void *arg) {
+    (void) arg;
+    future_t **calls = malloc(N_CALLS * sizeof(future_t*));
+    if (calls == NULL) {
+        errorf("failed to allocate memory for the benchmark\n");
+        return NULL;
+    }
+    async_sem_init(&sem, MAX_CALLS);
+    for (size_t i = 0; i < N_CALLS; i++) {
+        calls[i] = future_create_from_function(call, NULL, FUT_OPT_EAGER | FUT_OPT_SMALL_STACK);
+    }
+    for (size_t i = 0; i < N_CALLS; i++) {
+        async_await_future(calls[i]);
+        future_destroy(calls[i]);
+    }
+    free(calls);
+    return NULL;
+}
+
+static double lock_ns;
+
+void *entry_locks(void *arg) {
+    (void) arg;
+    async_mutex_t m;
+    async_mutex_init(&m);
+    volatile int counter = 0;
+    double start = now_ns(CLOCK_MONOTONIC);
+    for (size_t i = 0; i < N_LOCKS; i++) {
+        async_mutex_lock(&m);
+        counter++;
+        async_mutex_unlock(&m);
+    }
+    lock_ns = (now_ns(CLOCK_MONOTONIC) - start) / N_LOCKS;
+    return NULL;
+}
+
+static int run(coroutine_function_t func) {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+    if (async_context_run(ctx, func, NULL) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    async_context_destroy(ctx);
+    return 0;
+}
+
+int main() {
+    printf("sync: %d calls of %d us, at most %d at once\n", N_CALLS, CALL_LATENCY_NS / 1000, MAX_CALLS);
+    for (use_sem = 0; use_sem <= 1; use_sem++) {
+        double wall = now_ns(CLOCK_MONOTONIC), cpu = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+        if (run(entry_calls) != 0) return 1;
+        wall = (now_ns(CLOCK_MONOTONIC) - wall) / 1e6;
+        cpu = (now_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu) / 1e6;
+        printf("  %-16s %8.1f ms wall %8.1f ms cpu\n", use_sem ? "async_sem_t" : "yield loop", wall, cpu);
+    }
+    if (run(entry_locks) != 0) return 1;
+    printf("  uncontended async_mutex_t lock + unlock %.1f ns\n", lock_ns);
+    return 0;
+}
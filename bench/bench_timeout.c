@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include "async.h"
+#include "future.h"
+#include "logging.h"
+
+#define N_AWAITS 1000000
+#define TIMEOUT_NS (30 * 1000 * 1000 * 1000ull)
+
+enum mode { PLAIN, TIMEOUT, RACE };
+
+static future_t *current = NULL;
+static int is_done = 0;
+
+// Settles whatever is being awaited right after the awaiter has parked, like
+// a reply that arrives long before its deadline
+void *resolver(void *arg) {
+    (void) arg;
+    while (!is_done) {
+        async_yield();
+        if (current != NULL) {
+            future_t *f = current;
+            current = NULL;
+            future_resolve(f, NULL, NULL);
+        }
+    }
+    return NULL;
+}
+
+static long _max_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static void _run(enum mode mode, const char *name) {
+    long rss_before = _max_rss_kb();
+    uint64_t start = async_now();
+    for (size_t i = 0; i < N_AWAITS; i++) {
+        future_t *f = future_create(0);
+        future_set_state(f, FUTURE_PENDING);
+        current = f;
+        if (mode == PLAIN) {
+            async_await_future(f);
+        } else if (mode == TIMEOUT) {
+            async_await_future_timeout(f, TIMEOUT_NS);
+        } else {
+            // The timer stays armed until its deadline after losing the race
+            future_t *timer = async_timer(TIMEOUT_NS);
+            future_t *race = future_race((future_t*[]){ f, timer }, 2);
+            async_await_future(race);
+            future_destroy(race);
+            future_destroy(timer);
+        }
+        future_destroy(f);
+    }
+    uint64_t elapsed = async_now() - start;
+    printf("  %-26s %8.1f ns/await   max rss +%ld KiB\n", name,
+        (double) elapsed / N_AWAITS, _max_rss_kb() - rss_before);
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    future_t *resolving = future_create_from_function(resolver, NULL, FUT_OPT_EAGER);
+    printf("timeout: %d awaits settled long before a %llu s deadline\n", N_AWAITS, TIMEOUT_NS / 1000000000);
+    _run(PLAIN, "await");
+    _run(TIMEOUT, "await with timeout");
+    _run(RACE, "race against a timer");
+    is_done = 1;
+    async_await_future(resolving);
+    future_destroy(resolving);
+    return NULL;
+}
+
+int main() {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+    if (async_context_run(ctx, entry, NULL) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    async_context_destroy(ctx);
+    return 0;
+}
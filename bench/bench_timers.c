@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "async.h"
+#include "coroutine.h"
+#include "future.h"
+#include "logging.h"
+
+#define MAX_DELAY_NS 1000000000ULL
+// Deadlines start after a window long enough for every sleeper to arm its
+// timer, so lateness measures how precisely timers fire
+#define ARM_WINDOW_NS_PER_SLEEPER 10000ULL
+
+struct bench_stats {
+    size_t n_sleepers;
+    size_t n_woken;
+    uint64_t total_lateness;
+    uint64_t max_lateness;
+    uint64_t epoch;
+    uint64_t armed;
+    size_t n_armed;
+    uint64_t finished;
+    future_t *start, *done;
+};
+
+static struct bench_stats stats;
+
+void *sleeper(void *arg) {
+    // Wait until every sleeper exists, so that creating them isn't measured
+    // as timer lateness
+    async_await_future(stats.start);
+    uint64_t deadline = stats.epoch + stats.n_sleepers * ARM_WINDOW_NS_PER_SLEEPER + (uintptr_t) arg;
+    future_t *timer = async_timer_at(deadline);
+    if (++stats.n_armed == stats.n_sleepers) {
+        stats.armed = async_now();
+    }
+    async_await_future(timer);
+    future_destroy(timer);
+
+    uint64_t lateness = async_now() - deadline;
+    stats.total_lateness += lateness;
+    if (lateness > stats.max_lateness) {
+        stats.max_lateness = lateness;
+    }
+    if (++stats.n_woken == stats.n_sleepers) {
+        stats.finished = async_now();
+        future_resolve(stats.done, NULL, NULL);
+    }
+    return NULL;
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    async_context_t *ctx = async_context_get_current();
+    stats.start = future_create(0);
+    stats.done = future_create(0);
+    future_set_state(stats.start, FUTURE_PENDING);
+    future_set_state(stats.done, FUTURE_PENDING);
+
+    uint64_t start = async_now(), seed = 88172645463325252ULL;
+    for (size_t i = 0; i < stats.n_sleepers; i++) {
+        // xorshift, so every run sleeps the same deadlines
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        uint64_t delay = seed % MAX_DELAY_NS;
+        async_schedule_coroutine(ctx, coro_create(sleeper, (void*) (uintptr_t) delay, 0));
+    }
+    uint64_t spawned = async_now();
+
+    async_yield();
+    stats.epoch = async_now();
+    future_resolve(stats.start, NULL, NULL);
+
+    async_await_future(stats.done);
+    future_destroy(stats.start);
+    future_destroy(stats.done);
+
+    printf("timers: %zu concurrent sleeping coroutines\n", stats.n_sleepers);
+    printf("  spawn:          %8.1f ns/coroutine\n", (double) (spawned - start) / stats.n_sleepers);
+    printf("  arm:            %8.1f ns/timer\n", (double) (stats.armed - stats.epoch) / stats.n_sleepers);
+    printf("  mean lateness:  %8.1f us\n", (double) stats.total_lateness / stats.n_woken / 1000);
+    printf("  max lateness:   %8.1f us\n", (double) stats.max_lateness / 1000);
+    uint64_t first_deadline = stats.epoch + stats.n_sleepers * ARM_WINDOW_NS_PER_SLEEPER;
+    printf("  wakeups:        %8.0f /s\n", stats.n_sleepers / ((double) (stats.finished - first_deadline) / 1e9));
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    stats.n_sleepers = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+
+    if (async_context_run(ctx, entry, NULL) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    async_context_destroy(ctx);
+
+    return 0;
+}
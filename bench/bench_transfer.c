@@ -0,0 +1,87 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "async.h"
+#include "coroutine.h"
+#include "future.h"
+#include "logging.h"
+
+#define N_CALLS 200000
+#define CHAIN_DEPTH 8
+
+static int is_done = 0;
+
+void *leaf(void *arg) {
+    return arg;
+}
+
+// Each level awaits the next one, like a chain of async calls
+void *level(void *arg) {
+    uintptr_t depth = (uintptr_t) arg;
+    if (depth == 0) return NULL;
+    future_t *f = future_create_from_function(level, (void*) (depth - 1), 0);
+    async_await_future(f);
+    future_destroy(f);
+    return NULL;
+}
+
+// Keeps the ready queue busy, so anything that goes through it waits
+void *background(void *arg) {
+    (void) arg;
+    while (!is_done) {
+        async_yield();
+    }
+    return NULL;
+}
+
+static double _run(coroutine_function_t func, void *arg) {
+    uint64_t start = async_now();
+    for (size_t i = 0; i < N_CALLS; i++) {
+        future_t *f = future_create_from_function(func, arg, 0);
+        async_await_future(f);
+        future_destroy(f);
+    }
+    return (double) (async_now() - start) / N_CALLS;
+}
+
+void *entry(void *_n_background) {
+    size_t n_background = (size_t) (uintptr_t) _n_background;
+    future_t **busy = malloc(n_background * sizeof(future_t*));
+    if (busy == NULL && n_background > 0) {
+        errorf("failed to allocate memory for the benchmark\n");
+        return NULL;
+    }
+    is_done = 0;
+    for (size_t i = 0; i < n_background; i++) {
+        busy[i] = future_create_from_function(background, NULL, FUT_OPT_EAGER | FUT_OPT_SMALL_STACK);
+    }
+    double ns_call = _run(leaf, NULL);
+    double ns_chain = _run(level, (void*) CHAIN_DEPTH) / CHAIN_DEPTH;
+    is_done = 1;
+    for (size_t i = 0; i < n_background; i++) {
+        async_await_future(busy[i]);
+        future_destroy(busy[i]);
+    }
+    free(busy);
+    printf("  %4zu busy coroutines   call %8.1f ns   chain of %d %8.1f ns/level\n",
+        n_background, ns_call, CHAIN_DEPTH, ns_chain);
+    return NULL;
+}
+
+int main() {
+    printf("transfer: awaiting a new future, %d calls\n", N_CALLS);
+    size_t n_backgrounds[] = { 0, 10, 100 };
+    for (size_t i = 0; i < sizeof(n_backgrounds) / sizeof(n_backgrounds[0]); i++) {
+        async_context_t *ctx = async_context_create();
+        if (ctx == NULL) {
+            errorf("failed to create async context\n");
+            return 1;
+        }
+        if (async_context_run(ctx, entry, (void*) (uintptr_t) n_backgrounds[i]) != 0) {
+            errorf("error in async context\n");
+            return 1;
+        }
+        async_context_destroy(ctx);
+    }
+    return 0;
+}
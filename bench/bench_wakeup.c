@@ -0,0 +1,137 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <time.h>
+#include "async.h"
+#include "future.h"
+#include "logging.h"
+
+#define N_ROUND_TRIPS 100000
+#define N_BUSY_SIGNALS 1000000
+
+struct ping_pong {
+    mtx_t lock;
+    cnd_t cond;
+    future_t *ping;
+    int turn;
+    int done;
+};
+
+struct bench_args {
+    async_context_t *ctx;
+    double ns_per_round_trip;
+    double writes_per_busy_signal;
+    atomic_int signaller_done;
+};
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Write syscalls made by the whole process so far
+static unsigned long long write_syscalls() {
+    FILE *io = fopen("/proc/self/io", "r");
+    if (io == NULL) return 0;
+    char line[128];
+    unsigned long long n = 0;
+    while (fgets(line, sizeof(line), io) != NULL) {
+        if (sscanf(line, "syscw: %llu", &n) == 1) break;
+    }
+    fclose(io);
+    return n;
+}
+
+// The worker resolves each ping from its own thread, which has to wake the
+// loop up, then waits for the loop to hand it the next one
+static int ponger(void *_pp) {
+    struct ping_pong *pp = (struct ping_pong*) _pp;
+    mtx_lock(&pp->lock);
+    while (1) {
+        while (pp->turn != 1 && !pp->done) {
+            cnd_wait(&pp->cond, &pp->lock);
+        }
+        if (pp->done) break;
+        pp->turn = 0;
+        future_t *ping = pp->ping;
+        mtx_unlock(&pp->lock);
+        future_resolve(ping, NULL, NULL);
+        mtx_lock(&pp->lock);
+    }
+    mtx_unlock(&pp->lock);
+    return 0;
+}
+
+static int busy_signaller(void *_args) {
+    struct bench_args *args = (struct bench_args*) _args;
+    for (size_t i = 0; i < N_BUSY_SIGNALS; i++) {
+        async_signal_scheduler(args->ctx);
+    }
+    atomic_store(&args->signaller_done, 1);
+    return 0;
+}
+
+void *entry(void *_args) {
+    struct bench_args *args = (struct bench_args*) _args;
+
+    struct ping_pong pp = {.turn = 0, .done = 0};
+    mtx_init(&pp.lock, mtx_plain);
+    cnd_init(&pp.cond);
+    thrd_t thread;
+    thrd_create(&thread, ponger, &pp);
+
+    double start = now_ns();
+    for (size_t i = 0; i < N_ROUND_TRIPS; i++) {
+        future_t *ping = future_create(0);
+        future_set_state(ping, FUTURE_PENDING);
+        mtx_lock(&pp.lock);
+        pp.ping = ping;
+        pp.turn = 1;
+        cnd_signal(&pp.cond);
+        mtx_unlock(&pp.lock);
+        async_await_future(ping);
+        future_destroy(ping);
+    }
+    args->ns_per_round_trip = (now_ns() - start) / N_ROUND_TRIPS;
+
+    mtx_lock(&pp.lock);
+    pp.done = 1;
+    cnd_signal(&pp.cond);
+    mtx_unlock(&pp.lock);
+    thrd_join(thread, NULL);
+    cnd_destroy(&pp.cond);
+    mtx_destroy(&pp.lock);
+
+    // Signals sent while the loop never goes to sleep
+    unsigned long long writes = write_syscalls();
+    thrd_create(&thread, busy_signaller, args);
+    while (!atomic_load(&args->signaller_done)) {
+        async_yield();
+    }
+    thrd_join(thread, NULL);
+    args->writes_per_busy_signal = (double) (write_syscalls() - writes) / N_BUSY_SIGNALS;
+    return NULL;
+}
+
+int main() {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+
+    struct bench_args args = {.ctx = ctx};
+    if (async_context_run(ctx, entry, &args) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    async_context_destroy(ctx);
+
+    printf("wakeup: ping-pong between a worker thread and the loop\n");
+    printf("  %8.1f us/round trip\n", args.ns_per_round_trip / 1000);
+    printf("  %8.4f write syscalls/signal on a busy loop\n", args.writes_per_busy_signal);
+    return 0;
+}
@@ -2,19 +2,61 @@
 #define _H_ASYNC_
 
 #include <stdint.h>
+#include <poll.h>
 #include "async_types.h"
 #include "coroutine.h"
+#include "stack_pool.h"
+
+typedef enum async_context_option {
+    ASYNC_CTX_OPT_IO_URING = 1
+} async_context_option_e;
 
 async_context_t* async_context_create();
+async_context_t* async_context_create_with_options(int options);
+int async_context_set_dispatch_limits(async_context_t *, size_t max_threads, size_t max_queued);
+void async_context_attach_runtime(async_context_t *, async_runtime_t *, size_t worker_id);
+async_runtime_t *async_context_get_runtime(async_context_t *);
+stack_pool_t *async_context_get_stack_pool(async_context_t *);
 context_t* async_context_get_stack_context(async_context_t *);
 async_context_t* async_context_get_current();
 coroutine_t* async_context_get_current_coroutine(async_context_t *);
+struct io_uring_sqe *async_context_get_sqe(async_context_t *);
 int async_context_run(async_context_t *, coroutine_function_t entrypoint, void *arg);
+int async_context_run_with_stack_size(async_context_t *, coroutine_function_t entrypoint, void *arg, size_t stack_size);
+int async_context_run_loop(async_context_t *);
+size_t async_context_steal(async_context_t *victim, async_context_t *thief);
 int async_schedule_coroutine(async_context_t *, coroutine_t *);
+void async_unpark_coroutine(async_context_t *, coroutine_t *);
+// Marks the coroutine to be switched to directly once the current one
+// finishes, provided it is ready to run by then
+void async_context_set_handoff(async_context_t *, coroutine_t *);
+// Ends the current coroutine, which has finished, and never returns
+void async_context_finish_coroutine(async_context_t *, coroutine_t *);
+// Safe from any thread, and signals the context when it needs to
+int async_post_wakeup(async_context_t *, coroutine_t *, awaitable_t);
+// Has the context interrupt the coroutine bound to the token, which it
+// releases afterwards
+int async_post_cancel(async_context_t *, async_cancel_token_t *);
+// Asks the kernel to stop the io_uring operation that settles the future,
+// which then completes all the same, usually with -ECANCELED. Safe from any
+// thread
+int async_context_cancel_io(async_context_t *, future_t *);
 void async_yield();
 void async_signal_scheduler(async_context_t *);
 future_t *async_dispatch(dispatch_function_t, void *arg);
 void* async_await_future(future_t *f);
+// Gives up after ns and returns NULL, with the future left pending, unless
+// it has a stop function (see future_set_stop_function())
+void *async_await_future_timeout(future_t *f, uint64_t ns);
+// Returns the events that woke it up, or -1 with errno set, ECANCELED once
+// the coroutine is cancelled and EBADF if the fd is forgotten meanwhile
+int async_await_fd(int fd, short events);
+void async_forget_fd(int fd);
+uint64_t async_now();
+future_t *async_timer(uint64_t ns);
+future_t *async_timer_at(uint64_t deadline);
+void async_sleep(uint64_t ns);
+void async_sleep_until(uint64_t deadline);
 void* async_await_function(coroutine_function_t, void *arg);
 void async_context_destroy(async_context_t *);
 
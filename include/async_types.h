@@ -4,6 +4,9 @@
 typedef struct coroutine coroutine_t;
 typedef struct future future_t;
 typedef struct async_context async_context_t;
+typedef struct async_runtime async_runtime_t;
+typedef struct wait_queue wait_queue_t;
+typedef struct async_cancel_token async_cancel_token_t;
 
 typedef void (*dispatch_function_t)(future_t*, void *arg);
 typedef void*(*coroutine_function_t)(void*);
@@ -4,14 +4,24 @@
 #include "async_types.h"
 
 #define AWAITABLE_FUTURE(f) ((awaitable_t){.type=AWAITABLE_TYPE_FUTURE,.future=f})
-#define AWAITABLE_FD(fd) ((awaitable_t){.type=AWAITABLE_TYPE_FD,.fd=fd})
+#define AWAITABLE_FD(_fd) ((awaitable_t){.type=AWAITABLE_TYPE_FD,.fd=_fd})
+#define AWAITABLE_WAIT_QUEUE(q) ((awaitable_t){.type=AWAITABLE_TYPE_WAIT_QUEUE,.wait_queue=q})
+#define AWAITABLE_TIMEOUT(t) ((awaitable_t){.type=AWAITABLE_TYPE_TIMEOUT,.timeout=t})
+#define AWAITABLE_CANCEL(t) ((awaitable_t){.type=AWAITABLE_TYPE_CANCEL,.cancel_token=t})
+#define AWAITABLE_IO_CANCEL(f) ((awaitable_t){.type=AWAITABLE_TYPE_IO_CANCEL,.future=f})
 
 typedef struct async_context async_context_t;
 typedef void (*dispatch_function_t)(future_t*, void *arg);
 
 typedef enum awaitable_type {
     AWAITABLE_TYPE_FUTURE,
-    AWAITABLE_TYPE_FD
+    AWAITABLE_TYPE_FD,
+    AWAITABLE_TYPE_WAIT_QUEUE,
+    AWAITABLE_TYPE_TIMEOUT,
+    // Never waited on, only posted to interrupt a coroutine on another thread
+    AWAITABLE_TYPE_CANCEL,
+    // Likewise, posted to stop an io_uring operation on the ring's own thread
+    AWAITABLE_TYPE_IO_CANCEL
 } awaitable_type_e;
 
 typedef struct awaitable {
@@ -19,6 +29,9 @@ typedef struct awaitable {
     union {
         future_t *future;
         int fd;
+        wait_queue_t *wait_queue;
+        struct async_timeout *timeout;
+        async_cancel_token_t *cancel_token;
     };
 } awaitable_t;
 
@@ -0,0 +1,44 @@
+#ifndef _H_CANCEL_
+#define _H_CANCEL_
+
+#include "async_types.h"
+
+// Cooperative cancellation. Every future that runs code of its own, that is
+// coroutine futures, async_dispatch() and async_spawn(), carries a token
+// whose parent is the token of the coroutine that created it, so cancelling
+// a future cancels everything it started too.
+//
+// A cancelled coroutine keeps running until it returns. If it is parked in
+// async_await_future(), async_await_fd(), async_sleep() or a wait queue,
+// which channels and the primitives in sync.h wait in, it is woken up
+// straight away, and from then on those return at once: NULL, -1 with errno
+// set to ECANCELED, and without sleeping. Work that never awaits anything,
+// like a dispatched function, can poll its token
+typedef struct async_cancel_token async_cancel_token_t;
+
+// Cancelled from the start if the parent already is
+async_cancel_token_t *async_cancel_token_create(async_cancel_token_t *parent);
+void async_cancel_token_retain(async_cancel_token_t *);
+void async_cancel_token_release(async_cancel_token_t *);
+// Cancels the token and every token below it. Safe from any thread
+void async_cancel_token_cancel(async_cancel_token_t *);
+int async_cancel_token_is_cancelled(async_cancel_token_t *);
+// The token of the running coroutine, NULL when it has none
+async_cancel_token_t *async_get_cancel_token();
+int async_is_cancelled();
+// Keeps cancellation away from the running coroutine until the matching
+// async_cancel_unshield(), for cleanup that has to await something even once
+// cancelled. Returns the coroutine's token, to be handed back
+async_cancel_token_t *async_cancel_shield();
+void async_cancel_unshield(async_cancel_token_t *);
+
+// Makes cancelling the token interrupt a coroutine that hasn't started yet.
+// The coroutine keeps a reference until it is destroyed
+void async_cancel_token_bind(async_cancel_token_t *, coroutine_t *);
+// Called by the context that starts the bound coroutine
+void async_cancel_token_set_context(async_cancel_token_t *, async_context_t *);
+// Interrupts the bound coroutine, on the thread of its context
+void async_cancel_token_interrupt(async_cancel_token_t *);
+void async_cancel_token_unbind(async_cancel_token_t *);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef _H_CHANNEL_
+#define _H_CHANNEL_
+
+#include <stddef.h>
+
+// Bounded queue of fixed-size elements, which are copied in and out. Any
+// number of coroutines and threads may send and receive at once: the buffer
+// is a lock-free ring, and only callers that have to wait touch anything
+// else. A coroutine waiting on a full or empty channel is parked, a thread
+// outside any coroutine, like an async_dispatch() one, sleeps instead
+typedef struct async_chan async_chan_t;
+
+// The capacity is rounded up to a power of two, and to at least 2
+async_chan_t *async_chan_create(size_t capacity, size_t element_size);
+// Waits while the channel is full. Returns -1 once it is closed, or with
+// errno set to ECANCELED if the coroutine is cancelled while it would wait
+int async_chan_send(async_chan_t *, const void *element);
+// Waits while the channel is empty. Returns -1 once it is closed and
+// everything sent before that has been received, or when cancelled like
+// async_chan_send()
+int async_chan_recv(async_chan_t *, void *element);
+// Return 1 instead of waiting
+int async_chan_try_send(async_chan_t *, const void *element);
+int async_chan_try_recv(async_chan_t *, void *element);
+// Fails every send from now on and wakes everyone waiting
+void async_chan_close(async_chan_t *);
+size_t async_chan_get_capacity(async_chan_t *);
+// Nobody may be using the channel any more
+void async_chan_destroy(async_chan_t *);
+
+#endif
@@ -4,11 +4,14 @@
 #include <stddef.h>
 #include "async_types.h"
 #include "awaitable.h"
+#include "ilist.h"
+#include "mpsc.h"
 
 typedef enum coroutine_state {
     CO_NEW,
     CO_RUNNING,
     CO_SUSPENDED,
+    CO_WAITING,
     CO_FINISHED,
     CO_FAILED
 } coroutine_state_e;
@@ -23,12 +26,29 @@ typedef struct context {
     void *r15;
 } context_t;
 
+// A wakeup handed to the context a coroutine lives on by another thread.
+// Every coroutine embeds one, more are only allocated while it is in use
+typedef struct coro_wakeup {
+    mpsc_node_t link;
+    coroutine_t *co;
+    awaitable_t awaitable;
+    int is_allocated;
+} coro_wakeup_t;
+
 typedef enum coroutine_option {
-    CORO_OPT_OWNED = 1
+    CORO_OPT_OWNED = 1,
+    // Uses CORO_SMALL_STACK_SIZE, for leaf tasks that don't call deep. Any
+    // stdio on an unbuffered stream, logging included, needs more than that
+    CORO_OPT_SMALL_STACK = 2
 } coroutine_option_e;
 
+#define CORO_DEFAULT_STACK_SIZE (64 * 1024)
+#define CORO_SMALL_STACK_SIZE (8 * 1024)
+
 extern void _context_switch(context_t *from, context_t *to);
 coroutine_t* coro_create(coroutine_function_t f, void *arg, int options);
+// A stack_size of 0 picks the size from the options
+coroutine_t* coro_create_with_stack_size(coroutine_function_t f, void *arg, int options, size_t stack_size);
 void coro_run(coroutine_t *, context_t *from);
 int coro_add_waiting(coroutine_t *, awaitable_t);
 void coro_remove_waiting(coroutine_t *, awaitable_t);
@@ -36,8 +56,28 @@ int coro_is_ready(coroutine_t *);
 coroutine_state_e coro_get_state(coroutine_t *);
 void coro_set_state(coroutine_t *, coroutine_state_e);
 context_t *coro_get_stack_context(coroutine_t *);
+async_context_t *coro_get_context(coroutine_t *);
+void coro_set_context(coroutine_t *, async_context_t *);
 void *coro_get_return_value(coroutine_t *);
 int coro_is_owned(coroutine_t *);
+// Links for the run queue a coroutine sits in and the waiter list of the
+// future it is awaiting, so neither needs to allocate
+ilist_node_t *coro_get_run_link(coroutine_t *);
+coroutine_t *coro_from_run_link(ilist_node_t *);
+ilist_node_t *coro_get_wait_link(coroutine_t *);
+coroutine_t *coro_from_wait_link(ilist_node_t *);
+coro_wakeup_t *coro_acquire_wakeup(coroutine_t *, awaitable_t);
+void coro_release_wakeup(coro_wakeup_t *);
+void coro_set_cancel_token(coroutine_t *, async_cancel_token_t *);
+async_cancel_token_t *coro_get_cancel_token(coroutine_t *);
+// Set by a cancellation point before parking, and cleared once woken. The
+// function runs on the coroutine's own context and has to make it stop
+// waiting on whatever it is parked on
+void coro_set_interrupt(coroutine_t *, void (*interrupt)(coroutine_t *, void *arg), void *arg);
+void coro_interrupt(coroutine_t *);
+size_t coro_get_stack_size(coroutine_t *);
+// Deepest stack use so far, only measured in debug builds and 0 otherwise
+size_t coro_get_stack_usage(coroutine_t *);
 void coro_destroy(coroutine_t*);
 
 #endif
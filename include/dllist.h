@@ -16,6 +16,7 @@ typedef iteration_result_e (*dllist_iterator_with_args_callback_t)(dllist_elemen
 
 dllist_t *dllist_create(free_function_t free_value);
 int dllist_push_back(dllist_t *, void *value);
+void *dllist_pop_front(dllist_t *);
 void dllist_iterate_with_args(dllist_t *, dllist_iterator_with_args_callback_t cb, void *args);
 dllist_element_t *dllist_find_by_value(dllist_t *, void *value);
 dllist_element_t *dllist_find_by_predicate(dllist_t *, dllist_find_predicate_t predicate, void *args);
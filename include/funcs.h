@@ -3,12 +3,53 @@
 
 #include "async.h"
 #include "future.h"
+#include <sys/types.h>
 
 typedef struct async_spawn_result {
     char *stdout;
     int status;
 } async_spawn_result_t;
 
+// Cancelling the future kills the shell running the command, and everything
+// it started too when asked for with ASYNC_PROC_OPT_PROCESS_GROUP, the only
+// option that applies here
 future_t *async_spawn(const char *command);
+future_t *async_spawn_with_options(const char *command, int options);
+
+// A child process whose streams are used while it runs. Output is only ever
+// held in the caller's buffers, and writes to stdin wait while the child
+// isn't reading, so memory use doesn't grow with the amount of data
+typedef struct async_process async_process_t;
+
+typedef enum async_process_option {
+    // Each stream asked for is connected to a pipe, the others are inherited
+    ASYNC_PROC_OPT_STDIN = 1,
+    ASYNC_PROC_OPT_STDOUT = 2,
+    ASYNC_PROC_OPT_STDERR = 4,
+    // The child gets a process group of its own, so killing it kills
+    // whatever the shell started along with it. It then leaves the
+    // terminal's foreground group, and no longer gets the signals of ^C or
+    // ^Z nor can it read from the terminal
+    ASYNC_PROC_OPT_PROCESS_GROUP = 8
+} async_process_option_e;
+
+async_process_t *async_process_start(const char *command, int options);
+// Suspends until the child has written something, returns 0 once it closed
+// the stream and -1 on error. Each stream can be read by one coroutine at a
+// time, stdout and stderr from two different ones
+ssize_t async_process_read_stdout(async_process_t *, void *buffer, size_t size);
+ssize_t async_process_read_stderr(async_process_t *, void *buffer, size_t size);
+// Suspends until all of buffer is written, or returns -1 with errno EPIPE
+// once the child stopped reading. The first child started makes the process
+// ignore SIGPIPE for that, unless it has a handler of its own
+ssize_t async_process_write_stdin(async_process_t *, const void *buffer, size_t size);
+void async_process_close_stdin(async_process_t *);
+// Returns the wait status of the child once it has exited. A cancelled
+// coroutine kills the child, or its process group, instead of waiting for it
+// to exit on its own
+int async_process_wait(async_process_t *);
+// Closes the streams and waits for the child if that hasn't happened yet.
+// Outside of a coroutine that blocks the thread until the child exits
+void async_process_destroy(async_process_t *);
 
 #endif
@@ -19,13 +19,29 @@ typedef struct future_sized_array {
 
 typedef enum future_option {
     FUT_OPT_EAGER = 1,
-    FUT_OPT_THREADED = 2
+    // Every future can be awaited and settled from any thread, this is only
+    // kept so existing callers still build
+    FUT_OPT_THREADED = 2,
+    // Runs the function on a CORO_SMALL_STACK_SIZE stack
+    FUT_OPT_SMALL_STACK = 4
 } future_option_e;
 
 future_t *future_create(int options);
+// Unless the future is eager, its coroutine and stack are only created once
+// it is started or awaited
 future_t *future_create_from_function(coroutine_function_t func, void *arg, int options);
+future_t *future_create_from_function_with_stack_size(coroutine_function_t func, void *arg, int options, size_t stack_size);
+// Returns -1 if its coroutine can't be created, the future is rejected then
 int future_start(future_t *);
+// Moves the future out of FUTURE_NEW like future_start(), but hands its
+// coroutine to the caller to run instead of scheduling it. NULL if there is
+// nothing to start, or if the coroutine can't be created and the future has
+// been rejected
+coroutine_t *future_claim(future_t *);
 int future_add_waiting(future_t *, coroutine_t *waiting);
+// Undoes future_add_waiting() for a coroutine that gives up waiting. Returns
+// 0 if the future has settled and the coroutine is being woken up anyway
+int future_remove_waiting(future_t *, coroutine_t *waiting);
 void *future_borrow_return_value(future_t *);
 void *future_take_return_value(future_t *);
 free_function_t future_get_free_result_func(future_t *);
@@ -33,7 +49,53 @@ void future_resolve(future_t *, void *result, free_function_t free_result);
 void future_reject(future_t *);
 void future_set_state(future_t *, future_state_e);
 future_state_e future_get_state(future_t *f);
+// Rejects the future unless it has settled already, in which case it returns
+// 1, and cancels whatever runs on its behalf. Anyone awaiting it is woken up
+// right away, a coroutine that hasn't started never runs
+int future_cancel(future_t *);
+// Whether the future was rejected by future_cancel()
+int future_is_cancelled(future_t *);
+// For futures settled by an operation that can't just be abandoned, like I/O
+// the kernel does into the caller's buffer. future_cancel() calls stop instead
+// of rejecting the future, and the operation settles it once it has stopped.
+// Awaiting such a future is never cut short by cancellation or a timeout
+// before the operation has been stopped that way and has settled
+void future_set_stop_function(future_t *, void (*stop)(future_t *, void *arg), void *arg);
+int future_has_stop_function(future_t *);
+// Whoever keeps a future to settle it later holds a reference, dropped with
+// future_destroy(), so that its creator can give up on it in the meantime
+void future_retain(future_t *);
+// Takes over the reference to the token
+void future_set_cancel_token(future_t *, async_cancel_token_t *);
+async_cancel_token_t *future_get_cancel_token(future_t *);
+// The combinators start their inputs right away and settle without a
+// coroutine of their own, from whichever thread settles the deciding input.
+// Inputs must outlive the combinator's result unless take_futures is set
+//
+// Resolves with a future_sized_array_t once the last input completes, whether
+// the inputs resolved or rejected
 future_t *future_all(future_t **future_array, size_t n_members, int take_futures);
+// Like future_all(), but rejects as soon as one of the inputs rejects
+future_t *future_all_fail_fast(future_t **future_array, size_t n_members, int take_futures);
+// Resolves with the first input to resolve, or rejects once all have rejected
+future_t *future_any(future_t **future_array, size_t n_members);
+// Settles like the first input to settle, resolving with that input
+future_t *future_race(future_t **future_array, size_t n_members);
+// Continuations run without a coroutine or stack of their own: the function
+// is called by whoever settles the input, on their stack and thread, or
+// straight away if it has settled already. They take over the caller's
+// reference to the input, start it if it is new, and return a future for
+// their own outcome, which can be continued in turn. Cancelling that future
+// cancels whatever runs for the input
+//
+// Has to settle result, with the input's value only borrowed
+typedef void (*future_then_function_t)(future_t *result, future_state_e state, void *value, void *arg);
+future_t *future_then(future_t *, future_then_function_t func, void *arg);
+// Resolves with what func returns for the input's value, to be freed with
+// free_result. A rejection is passed on without calling func
+typedef void *(*future_map_function_t)(void *value, void *arg);
+future_t *future_map(future_t *, future_map_function_t func, void *arg, free_function_t free_result);
+// Cancels the future first if it hasn't settled yet
 void future_destroy(future_t *);
 
 #endif
@@ -0,0 +1,32 @@
+#ifndef _H_GROUP_
+#define _H_GROUP_
+
+#include "async_types.h"
+
+// A task group owns the coroutines spawned into it, so nothing started for a
+// piece of work outlives it: async_group_join() waits for all of them through
+// one counter, and the first child to fail cancels its siblings. Children
+// have no futures, and their bookkeeping comes from an arena that is freed in
+// one go along with the group. Results go through the child's argument
+//
+// The group's cancellation token is a child of the creating coroutine's one,
+// and every child gets a token below it, so cancelling the creator cancels
+// the whole group
+typedef struct async_group async_group_t;
+
+// Returns 0 on success and -1 to fail the group
+typedef int (*async_group_function_t)(void *arg);
+
+async_group_t *async_group_create();
+// Starts func(arg) on the current context. Only the coroutine that created
+// the group spawns into it. Fails once the group has been cancelled
+int async_group_spawn(async_group_t *, async_group_function_t func, void *arg);
+// Waits until every child has returned, even once the caller is cancelled.
+// Returns -1 if any of them failed or the group was cancelled
+int async_group_join(async_group_t *);
+// Cancels every child, the group takes no new ones afterwards
+void async_group_cancel(async_group_t *);
+// Cancels and joins whatever still runs
+void async_group_destroy(async_group_t *);
+
+#endif
@@ -1,18 +1,29 @@
 #ifndef _H_ASYNC_TIMER_HEAP_
 #define _H_ASYNC_TIMER_HEAP_
 
+#include <stddef.h>
+#include <stdint.h>
+
 typedef struct heap_s* heap;
 
-#include "heap.h"
-#include <string.h>
-#include <stdint.h>
+// Identifies an element for as long as it is in the heap, and may be reused
+// once it has been popped or removed
+typedef size_t heap_handle_t;
 
+// The priority function is only called when an element is inserted or
+// updated, its result is kept next to the element
 heap heap_create(size_t initial_size, size_t element_size, uint64_t (*priority) (void*));
 int heap_empty(heap);
+size_t heap_size(heap);
 void *heap_min(heap);
 int heap_insert(heap, void* element);
+int heap_insert_with_handle(heap, void* element, heap_handle_t *handle);
+void *heap_get(heap, heap_handle_t);
+// Restores the order after the element behind the handle changed priority
+void heap_update(heap, heap_handle_t);
+void heap_remove(heap, heap_handle_t);
 int heap_pop(heap);
 void heap_destroy(heap);
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,80 @@
+#ifndef _H_ILIST_
+#define _H_ILIST_
+
+#include <stddef.h>
+
+// Intrusive doubly linked list: the links live inside the listed objects, so
+// linking and unlinking never allocate. A node is in at most one list at a
+// time, and an unlinked node points to nothing
+
+typedef struct ilist_node {
+    struct ilist_node *prev, *next;
+} ilist_node_t;
+
+// Circular, with the list itself as the sentinel node
+typedef struct ilist {
+    ilist_node_t head;
+} ilist_t;
+
+#define ilist_entry(node, type, member) \
+    ((type*) ((char*) (node) - offsetof(type, member)))
+
+static inline void ilist_init(ilist_t *list) {
+    list->head.prev = list->head.next = &list->head;
+}
+
+static inline void ilist_node_init(ilist_node_t *node) {
+    node->prev = node->next = NULL;
+}
+
+static inline int ilist_is_empty(ilist_t *list) {
+    return list->head.next == &list->head;
+}
+
+static inline int ilist_is_singular(ilist_t *list) {
+    return !ilist_is_empty(list) && list->head.next == list->head.prev;
+}
+
+static inline int ilist_node_is_linked(ilist_node_t *node) {
+    return node->next != NULL;
+}
+
+static inline void ilist_push_back(ilist_t *list, ilist_node_t *node) {
+    node->prev = list->head.prev;
+    node->next = &list->head;
+    list->head.prev->next = node;
+    list->head.prev = node;
+}
+
+static inline void ilist_remove(ilist_node_t *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = NULL;
+}
+
+static inline ilist_node_t *ilist_pop_front(ilist_t *list) {
+    if (ilist_is_empty(list)) return NULL;
+    ilist_node_t *node = list->head.next;
+    ilist_remove(node);
+    return node;
+}
+
+// Moves every node of src over to dst, leaving src empty. Anything dst held
+// before is dropped
+static inline void ilist_move(ilist_t *dst, ilist_t *src) {
+    if (ilist_is_empty(src)) {
+        ilist_init(dst);
+        return;
+    }
+    dst->head = src->head;
+    dst->head.next->prev = &dst->head;
+    dst->head.prev->next = &dst->head;
+    ilist_init(src);
+}
+
+#define ilist_for_each_safe(list, node, next_node) \
+    for ((node) = (list)->head.next, (next_node) = (node)->next; \
+         (node) != &(list)->head; \
+         (node) = (next_node), (next_node) = (node)->next)
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef _H_IO_
+#define _H_IO_
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "async.h"
+#include "future.h"
+
+// These futures always resolve, with the result of the operation cast to
+// intptr_t: a byte count or file descriptor, or -errno on failure. An offset
+// of -1 uses (and advances) the current file position.
+//
+// The buffers, and addr and addrlen, must stay valid until the future has
+// settled, since the kernel may use them until then. Cancelling the future,
+// or the coroutine awaiting it, or a timeout while awaiting it stops the
+// operation and waits for it, which then resolves with -ECANCELED unless it
+// finished first. A future given up on in any other way, like losing a
+// future_race(), has to be cancelled and awaited before the buffers go.
+//
+// Without io_uring the operation waits for readiness through epoll instead,
+// and the fd is switched to O_NONBLOCK for that. Accepted sockets are always
+// created with SOCK_NONBLOCK and SOCK_CLOEXEC.
+future_t *async_read(int fd, void *buffer, size_t size, off_t offset);
+future_t *async_write(int fd, const void *buffer, size_t size, off_t offset);
+future_t *async_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef _H_MPSC_
+#define _H_MPSC_
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Intrusive multi-producer single-consumer queue (Vyukov). Any thread may
+// push, only the owning thread pops. Pushing is one atomic exchange and
+// never blocks or allocates
+
+typedef struct mpsc_node {
+    _Atomic(struct mpsc_node*) next;
+} mpsc_node_t;
+
+typedef struct mpsc_queue {
+    // Producers append at head, the consumer takes from tail
+    _Atomic(mpsc_node_t*) head;
+    mpsc_node_t *tail;
+    mpsc_node_t stub;
+} mpsc_queue_t;
+
+#define mpsc_entry(node, type, member) \
+    ((type*) ((char*) (node) - offsetof(type, member)))
+
+static inline void mpsc_init(mpsc_queue_t *q) {
+    atomic_init(&q->stub.next, NULL);
+    atomic_init(&q->head, &q->stub);
+    q->tail = &q->stub;
+}
+
+static inline void mpsc_push(mpsc_queue_t *q, mpsc_node_t *node) {
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    mpsc_node_t *prev = atomic_exchange_explicit(&q->head, node, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+// Returns NULL when empty, and also while a producer is between its exchange
+// and linking its node; that producer's push becomes visible right after
+static inline mpsc_node_t *mpsc_pop(mpsc_queue_t *q) {
+    mpsc_node_t *tail = q->tail;
+    mpsc_node_t *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (tail == &q->stub) {
+        if (next == NULL) return NULL;
+        q->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+    if (next != NULL) {
+        q->tail = next;
+        return tail;
+    }
+    if (tail != atomic_load_explicit(&q->head, memory_order_acquire)) {
+        return NULL;
+    }
+    // tail is the last node, put the stub behind it so it can be handed out
+    mpsc_push(q, &q->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next != NULL) {
+        q->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef _H_NET_
+#define _H_NET_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "async.h"
+
+// These behave like their POSIX counterparts, returning -1 and setting errno
+// on failure, except that instead of blocking they suspend the calling
+// coroutine until the socket is ready. Sockets they create or accept are
+// already non-blocking, others have to be made so by the caller. Once the
+// coroutine is cancelled they fail with ECANCELED
+
+// Listens on a numeric IPv4 or IPv6 address, or on every address for NULL.
+// Port 0 picks a free port, see getsockname()
+int async_tcp_listen(const char *host, uint16_t port, int backlog);
+// Connects to a numeric address and returns the new socket
+int async_tcp_connect(const char *host, uint16_t port);
+int async_tcp_accept(int listener, struct sockaddr *addr, socklen_t *addrlen);
+int async_connect(int fd, const struct sockaddr *addr, socklen_t addrlen);
+ssize_t async_recv(int fd, void *buffer, size_t size, int flags);
+// Never raises SIGPIPE, a closed peer fails with EPIPE instead
+ssize_t async_send(int fd, const void *buffer, size_t size, int flags);
+ssize_t async_readv(int fd, const struct iovec *iov, int iovcnt);
+// Like async_send(), but still raises SIGPIPE if fd is not a socket
+ssize_t async_writev(int fd, const struct iovec *iov, int iovcnt);
+// Raises SIGPIPE on a closed peer, like sendfile() itself
+ssize_t async_sendfile(int out_fd, int in_fd, off_t *offset, size_t count);
+// Forgets the socket on the current context and closes it
+int async_close(int fd);
+
+#endif
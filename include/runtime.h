@@ -0,0 +1,18 @@
+#ifndef _H_RUNTIME_
+#define _H_RUNTIME_
+
+#include <stddef.h>
+#include "async_types.h"
+
+async_runtime_t *async_runtime_create(size_t n_workers, int context_options);
+size_t async_runtime_get_worker_count(async_runtime_t *);
+async_context_t *async_runtime_get_worker(async_runtime_t *, size_t worker_id);
+int async_runtime_run(async_runtime_t *, coroutine_function_t entrypoint, void *arg);
+void async_runtime_coroutine_spawned(async_runtime_t *, async_context_t *from);
+void async_runtime_coroutine_finished(async_runtime_t *);
+int async_runtime_is_finished(async_runtime_t *);
+void async_runtime_set_idle(async_runtime_t *, size_t worker_id, int idle);
+size_t async_runtime_steal(async_runtime_t *, size_t thief_id);
+void async_runtime_destroy(async_runtime_t *);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef _H_STACK_POOL_
+#define _H_STACK_POOL_
+
+#include <stddef.h>
+
+typedef struct stack_pool stack_pool_t;
+
+stack_pool_t *stack_pool_create();
+// Returns the lowest usable address of a stack of at least `size` bytes,
+// sitting right above a PROT_NONE guard page. The pool may be NULL, the
+// stack is then mapped directly
+void *stack_pool_acquire(stack_pool_t *, size_t size);
+// `size` must be the one the stack was acquired with
+void stack_pool_release(stack_pool_t *, void *stack, size_t size);
+// The size class a stack of `size` bytes comes from, 0 if it has none
+size_t stack_pool_round_size(size_t size);
+void stack_pool_destroy(stack_pool_t *);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef _H_SYNC_
+#define _H_SYNC_
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include "wait_queue.h"
+
+// Coroutine-aware synchronisation primitives. A coroutine that has to wait is
+// parked in a FIFO wait queue rather than spinning on async_yield(), and a
+// plain thread sleeps on a futex. Uncontended operations are a single atomic
+// instruction, and nothing takes an OS mutex. They may be embedded in other
+// structures, but not moved while in use
+//
+// Waiting is a cancellation point: a cancelled coroutine stops waiting, or
+// doesn't start, and the call returns -1 with errno set to ECANCELED without
+// having taken anything. Otherwise they return 0
+
+// Whoever unlocks the mutex passes it straight to the coroutine that has
+// waited longest, if any
+typedef struct {
+    atomic_uint is_locked;
+    wait_queue_t waiters;
+} async_mutex_t;
+
+void async_mutex_init(async_mutex_t *);
+int async_mutex_lock(async_mutex_t *);
+// Returns 0 if the mutex was taken, 1 if it is held by someone else
+int async_mutex_try_lock(async_mutex_t *);
+void async_mutex_unlock(async_mutex_t *);
+
+typedef struct {
+    atomic_size_t count;
+    wait_queue_t waiters;
+} async_sem_t;
+
+void async_sem_init(async_sem_t *, size_t count);
+int async_sem_acquire(async_sem_t *);
+// Returns 0 if a unit was taken, 1 if there was none
+int async_sem_try_acquire(async_sem_t *);
+void async_sem_release(async_sem_t *);
+size_t async_sem_get_count(async_sem_t *);
+
+typedef struct {
+    wait_queue_t waiters;
+} async_cond_t;
+
+void async_cond_init(async_cond_t *);
+// Unlocks the mutex while waiting and locks it again before returning, even
+// when cancelled. As usual, the condition has to be checked again afterwards
+int async_cond_wait(async_cond_t *, async_mutex_t *);
+void async_cond_signal(async_cond_t *);
+void async_cond_broadcast(async_cond_t *);
+
+// Counts outstanding tasks, waiting returns once the count drops to zero
+typedef struct {
+    atomic_size_t count;
+    wait_queue_t waiters;
+} async_waitgroup_t;
+
+void async_waitgroup_init(async_waitgroup_t *);
+void async_waitgroup_add(async_waitgroup_t *, size_t n);
+void async_waitgroup_done(async_waitgroup_t *);
+int async_waitgroup_wait(async_waitgroup_t *);
+
+#endif
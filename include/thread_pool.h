@@ -0,0 +1,20 @@
+#ifndef _H_THREAD_POOL_
+#define _H_THREAD_POOL_
+
+#include <stddef.h>
+
+typedef struct thread_pool thread_pool_t;
+typedef void (*thread_pool_job_t)(void *arg);
+
+// Threads are started lazily, up to max_threads. A max_queued of 0 leaves the
+// queue unbounded
+thread_pool_t *thread_pool_create(size_t max_threads, size_t max_queued);
+// Blocks the calling thread while the queue is full
+int thread_pool_submit(thread_pool_t *, thread_pool_job_t, void *arg);
+// Returns 1 instead of blocking when the queue is full
+int thread_pool_try_submit(thread_pool_t *, thread_pool_job_t, void *arg);
+size_t thread_pool_get_thread_count(thread_pool_t *);
+// Runs every job that was already queued, then joins all threads
+void thread_pool_destroy(thread_pool_t *);
+
+#endif
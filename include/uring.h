@@ -0,0 +1,17 @@
+#ifndef _H_URING_
+#define _H_URING_
+
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+typedef struct uring uring_t;
+typedef void (*uring_completion_handler_t)(uint64_t user_data, int32_t res, void *arg);
+
+uring_t *uring_create(unsigned entries);
+int uring_get_fd(uring_t *);
+struct io_uring_sqe *uring_get_sqe(uring_t *);
+int uring_submit_and_wait(uring_t *, int64_t timeout_ns);
+unsigned uring_reap(uring_t *, uring_completion_handler_t handler, void *arg);
+void uring_destroy(uring_t *);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef _H_WAIT_QUEUE_
+#define _H_WAIT_QUEUE_
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include "async_types.h"
+#include "ilist.h"
+
+// FIFO of coroutines, or plain threads, waiting for a condition that some
+// other code makes true. Waiting coroutines are parked and woken up on their
+// own context, threads sleep on a futex. The lock is a single atomic word
+// only ever held for a few instructions, so nothing here needs an OS mutex
+//
+// Waiting goes:
+//     wait_queue_prepare(q);
+//     if (condition holds) { wait_queue_cancel(q); ... } else wait_queue_wait(q);
+// and whoever makes the condition true calls wait_queue_wake() afterwards.
+// Counting the waiter before checking the condition is what lets wakers skip
+// the lock entirely while nobody waits
+struct wait_queue {
+    atomic_uint lock;
+    atomic_size_t n_waiting;
+    ilist_t waiters;
+};
+
+void wait_queue_init(wait_queue_t *);
+// Takes the lock and counts the caller as a waiter
+void wait_queue_prepare(wait_queue_t *);
+// Undoes wait_queue_prepare() when there turned out to be no need to wait
+void wait_queue_cancel(wait_queue_t *);
+// Releases the lock and waits until woken. Returns without the lock, and 0
+// unless the coroutine was cancelled first, which returns -1 with errno set
+// to ECANCELED. A waiter that was woken returns 0 even if cancelled, so
+// whatever the waker handed over is never lost
+int wait_queue_wait(wait_queue_t *);
+// Wakes up to n waiters in the order they started waiting, SIZE_MAX for all.
+// Returns how many were woken
+size_t wait_queue_wake(wait_queue_t *, size_t n);
+// Like wait_queue_wake(), but calls claim() with the lock held before taking
+// each waiter and stops when it returns 0. Lets a waker hand something over
+// to exactly the waiters it takes, and keep it when there are none. Always
+// takes the lock
+size_t wait_queue_wake_if(wait_queue_t *, size_t n, int (*claim)(void *arg), void *arg);
+int wait_queue_has_waiters(wait_queue_t *);
+
+#endif
@@ -18,8 +18,8 @@ void *f(void *arg) {
 
     future_t *all = future_all(
         (future_t*[]){
-            future_create_from_function(y, "Francisco", FUT_OPT_EAGER),
-            future_create_from_function(y, "Armindo", FUT_OPT_EAGER),
+            future_create_from_function_with_stack_size(y, "Francisco", FUT_OPT_EAGER, 16 * 1024),
+            future_create_from_function_with_stack_size(y, "Armindo", FUT_OPT_EAGER, 16 * 1024),
             async_spawn("curl www.example.com")
         },
         3,
@@ -1,156 +1,272 @@
+#define _GNU_SOURCE
 #include "async.h"
+#include "cancel.h"
 #include "future.h"
 #include "logging.h"
+#include "uring.h"
+#include "heap.h"
+#include "runtime.h"
+#include "thread_pool.h"
+#include "stack_pool.h"
 #include <assert.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
-#include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 #include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <threads.h>
+#include <time.h>
 
 static _Thread_local async_context_t *_async_ctx_current = NULL;
 
-typedef struct pollfd_array {
-    struct pollfd *elements;
-    size_t size;
+#define EPOLL_BATCH_SIZE 128
+#define URING_ENTRIES 256
+// user_data values that can never be a future pointer
+#define URING_TAG_NONE 0
+#define URING_TAG_EPOLL 1
+#define FD_READ_EVENTS (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)
+#define FD_WRITE_EVENTS (EPOLLOUT | EPOLLERR | EPOLLHUP)
+#define DISPATCH_DEFAULT_MAX_THREADS 16
+
+// Lives on the stack of a coroutine parked in async_await_fd(), which gets
+// its result here rather than from the watch, since that may be cleared or
+// taken over by a reused fd before the coroutine runs again
+struct fd_wait {
+    async_context_t *ctx;
+    coroutine_t *co;
+    int fd;
+    uint32_t events;
+    int error;
+    int is_interrupted;
+};
+
+struct fd_watch {
+    int registered;
+    // Edge-triggered readiness that arrived while nobody was waiting for it;
+    // the next matching async_await_fd() consumes it instead of parking
+    uint32_t ready;
+    struct fd_wait *reader, *writer;
+};
+
+// Indexed directly by file descriptor, so registration and lookup are O(1)
+typedef struct fd_watch_array {
+    struct fd_watch *elements;
     size_t capacity;
-} pollfd_array_t;
+} fd_watch_array_t;
 
-struct wakeup_fds {
-    int read;
-    int write;
+// Whether the loop may be blocked in the kernel. Signals only need the
+// eventfd while it is, otherwise the loop is told through this state alone
+enum loop_state {
+    LOOP_AWAKE,
+    LOOP_SLEEPING,
+    LOOP_NOTIFIED
 };
 
 struct async_context {
-    dllist_t *scheduled_coroutines;
+    // Coroutines that can run right now, in FIFO order
+    ilist_t ready_coroutines;
+    size_t n_ready;
+    // When this context is a worker of a runtime, coroutines that haven't
+    // started yet are queued here instead, where other workers can steal them
+    async_runtime_t *runtime;
+    size_t worker_id;
+    ilist_t spawned_coroutines;
+    atomic_size_t n_spawned;
+    mtx_t spawned_lock;
+    // Coroutines suspended on at least one awaitable; they are not kept in any
+    // queue and only come back through async_unpark_coroutine()
+    size_t n_parked;
     coroutine_t *current;
+    // Set when a finishing coroutine's future wakes up a single coroutine on
+    // this context, which then runs straight after it
+    coroutine_t *handoff;
+    // A coroutine that finished by switching straight to another one can't
+    // free its own stack, whoever runs next on this context does
+    coroutine_t *finished;
 
-    pollfd_array_t watched_file_descriptors;
-    struct wakeup_fds wakeup_fds;
+    // Wakeups posted by other threads, applied by the main loop in one batch
+    // per iteration. Only the first post after a drain signals the loop
+    mpsc_queue_t remote_wakeups;
+    atomic_int remote_wakeups_signalled;
+
+    // Descriptors are registered edge-triggered with epoll the first time
+    // they are awaited, re-armed whenever a coroutine parks on them, and stay
+    // registered until async_forget_fd() or until they are closed
+    int epoll_fd;
+    fd_watch_array_t watched_file_descriptors;
+    size_t n_fd_waiting;
+    int wakeup_fd;
+    atomic_int loop_state;
+
+    // Completion backend, NULL when the context only uses epoll. The epoll
+    // instance is then itself polled through the ring
+    uring_t *uring;
+    int uring_epoll_armed;
+    size_t n_io_inflight;
+
+    // Pending timer futures and timeouts, ordered by deadline
+    heap timers;
+
+    // Recycles the stacks of coroutines created and destroyed on this thread
+    stack_pool_t *stack_pool;
+
+    // Runs functions passed to async_dispatch(), created on first use
+    thread_pool_t *dispatch_pool;
+    size_t dispatch_max_threads, dispatch_max_queued;
 
     context_t scheduler_ctx;
 };
 
-struct next_coroutine_result {
+// Lives on the stack of a coroutine that sleeps or waits with a deadline,
+// which takes it out of the heap again if it wakes up before that
+struct async_timeout {
     coroutine_t *co;
+    heap_handle_t handle;
+    int has_fired;
 };
 
-struct async_next_coroutine_iterator_helper_args {
-    dllist_element_t *element;
-    coroutine_t *coroutine;
+// Either resolves a future or interrupts a coroutine when due
+struct timer_entry {
+    uint64_t deadline;
+    future_t *future;
+    struct async_timeout *timeout;
 };
 
-int _pollfd_array_init(pollfd_array_t *array) {
-    array->capacity = 16;
-    array->size = 0;
-    array->elements = malloc(sizeof(struct pollfd) * array->capacity);
+uint64_t _timer_entry_priority(void *entry) {
+    return ((struct timer_entry*) entry)->deadline;
+}
+
+int _fd_watch_array_init(fd_watch_array_t *array) {
+    array->capacity = 64;
+    array->elements = calloc(array->capacity, sizeof(struct fd_watch));
     if (array->elements == NULL) {
         return -1;
     }
     return 0;
 }
 
-int _pollfd_array_ensure_capacity(pollfd_array_t *array, size_t capacity) {
-    if (capacity <= array->capacity) {
-        return 0;
+struct fd_watch *_fd_watch_array_get(fd_watch_array_t *array, int fd) {
+    if ((size_t) fd < array->capacity) {
+        return &array->elements[fd];
     }
-    array->capacity *= 2;
-    array->elements = realloc(array->elements, sizeof(struct pollfd) * array->capacity);
-    return array->elements == NULL ? -1 : 0;
-}
-
-int _pollfd_array_push(pollfd_array_t *array, int fd, short int events) {
-    if (_pollfd_array_ensure_capacity(array, array->size + 1) != 0) {
-        return -1;
+    size_t new_capacity = array->capacity;
+    while (new_capacity <= (size_t) fd) {
+        new_capacity *= 2;
     }
-    array->elements[array->size++] = (struct pollfd){
-        .fd = fd,
-        .events = events,
-        .revents = 0
-    };
-    return 0;
+    struct fd_watch *new_elements = realloc(array->elements, sizeof(struct fd_watch) * new_capacity);
+    if (new_elements == NULL) {
+        return NULL;
+    }
+    memset(new_elements + array->capacity, 0, sizeof(struct fd_watch) * (new_capacity - array->capacity));
+    array->elements = new_elements;
+    array->capacity = new_capacity;
+    return &array->elements[fd];
 }
 
-void _pollfd_array_free(pollfd_array_t *array) {
+void _fd_watch_array_free(fd_watch_array_t *array) {
     array->capacity = 0;
-    array->size = 0;
     free(array->elements);
     array->elements = NULL;
 }
 
-int _wakeup_fds_init(struct wakeup_fds *w) {
-    int fds[2];
-
-    if (pipe(fds) < 0)
-        return -1;
-
-    w->read  = fds[0];
-    w->write = fds[1];
-
-    if (fcntl(w->read, F_SETFL, O_NONBLOCK) < 0 || fcntl(w->write, F_SETFL, O_NONBLOCK) < 0) {
-        close(w->read);
-        close(w->write);
-        return -1;
-    }
-
-    return 0;
-}
-
-int _wakeup_fds_signal(struct wakeup_fds *w) {
-    ssize_t n = write(w->write, &(uint8_t){1}, 1);
-    if (n < 0) {
-        if (errno == EAGAIN)
-            return 0;  // pipe full; scheduler will wake up anyway
-        return -1;
+int _wakeup_fd_signal(int fd) {
+    if (write(fd, &(uint64_t){1}, sizeof(uint64_t)) < 0) {
+        // The counter only overflows if nobody ever reads it, and the loop
+        // wakes up anyway in that case
+        return errno == EAGAIN ? 0 : -1;
     }
     return 0;
 }
 
-void _wakeup_fds_drain(struct wakeup_fds *w) {
-    uint8_t buffer[128];
-
-    while (1) {
-        ssize_t n = read(w->read, buffer, sizeof(buffer));
-        if (n <= 0)
-            break;
+void _wakeup_fd_drain(int fd) {
+    // A single read resets the counter, however many signals came in
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        warnf("failed to drain wakeup eventfd: '%s'\n", strerror(errno));
     }
 }
 
-void _wakeup_fds_free(struct wakeup_fds *w) {
-    if (w->read >= 0) close(w->read);
-    if (w->write >= 0) close(w->write);
-
-    w->read  = -1;
-    w->write = -1;
+async_context_t* async_context_create() {
+    return async_context_create_with_options(0);
 }
 
-async_context_t* async_context_create() {
+async_context_t* async_context_create_with_options(int options) {
     async_context_t *ctx = malloc(sizeof(async_context_t));
     if (ctx == NULL) {
         return NULL;
     }
-    ctx->scheduled_coroutines = dllist_create(NULL);
-    if (ctx->scheduled_coroutines == NULL) {
+    *ctx = (async_context_t){
+        .epoll_fd = -1,
+        .dispatch_max_threads = DISPATCH_DEFAULT_MAX_THREADS,
+        .wakeup_fd = -1
+    };
+    if (mtx_init(&ctx->spawned_lock, mtx_plain) != thrd_success) {
         free(ctx);
         return NULL;
     }
-    if (_wakeup_fds_init(&ctx->wakeup_fds)) {
-        dllist_destroy(ctx->scheduled_coroutines);
-        free(ctx);
+    mpsc_init(&ctx->remote_wakeups);
+    atomic_init(&ctx->remote_wakeups_signalled, 0);
+    atomic_init(&ctx->loop_state, LOOP_AWAKE);
+
+    // From here on, async_context_destroy() knows how to clean up whatever
+    // was set up before a failure
+    ctx->timers = heap_create(64, sizeof(struct timer_entry), _timer_entry_priority);
+    ilist_init(&ctx->ready_coroutines);
+    ilist_init(&ctx->spawned_coroutines);
+    ctx->stack_pool = stack_pool_create();
+    if (ctx->timers == NULL || ctx->stack_pool == NULL) {
+        async_context_destroy(ctx);
         return NULL;
     }
-    if (_pollfd_array_init(&ctx->watched_file_descriptors) != 0) {
-        _wakeup_fds_free(&ctx->wakeup_fds);
-        dllist_destroy(ctx->scheduled_coroutines);
-        free(ctx);
+    ctx->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ctx->wakeup_fd < 0 || _fd_watch_array_init(&ctx->watched_file_descriptors) != 0) {
+        async_context_destroy(ctx);
         return NULL;
     }
-    _pollfd_array_push(&ctx->watched_file_descriptors, ctx->wakeup_fds.read, POLLIN);
+    ctx->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event wakeup_event = {
+        .events = EPOLLIN,
+        .data.fd = ctx->wakeup_fd
+    };
+    if (ctx->epoll_fd < 0 || epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, ctx->wakeup_fd, &wakeup_event) != 0) {
+        async_context_destroy(ctx);
+        return NULL;
+    }
+    if (options & ASYNC_CTX_OPT_IO_URING) {
+        ctx->uring = uring_create(URING_ENTRIES);
+        if (ctx->uring == NULL) {
+            warnf("io_uring is not available, falling back to epoll\n");
+        }
+    }
     return ctx;
 }
 
+int async_context_set_dispatch_limits(async_context_t *ctx, size_t max_threads, size_t max_queued) {
+    if (ctx->dispatch_pool != NULL) {
+        errorf("dispatch limits must be set before the first async_dispatch()\n");
+        return -1;
+    }
+    if (max_threads == 0) {
+        errorf("async_dispatch() needs at least one thread\n");
+        return -1;
+    }
+    ctx->dispatch_max_threads = max_threads;
+    ctx->dispatch_max_queued = max_queued;
+    return 0;
+}
+
+void async_context_attach_runtime(async_context_t *ctx, async_runtime_t *runtime, size_t worker_id) {
+    ctx->runtime = runtime;
+    ctx->worker_id = worker_id;
+}
+
+async_runtime_t *async_context_get_runtime(async_context_t *ctx) {
+    return ctx->runtime;
+}
+
 async_context_t* async_context_get_current() {
     return _async_ctx_current;
 }
@@ -159,101 +275,419 @@ coroutine_t* async_context_get_current_coroutine(async_context_t *ctx) {
     return ctx->current;
 }
 
+stack_pool_t *async_context_get_stack_pool(async_context_t *ctx) {
+    return ctx->stack_pool;
+}
+
 context_t* async_context_get_stack_context(async_context_t *ctx) {
     return &ctx->scheduler_ctx;
 }
 
-iteration_result_e _async_next_coroutine_iterator_helper(dllist_element_t *element, void *value, void *_args) {
-    struct async_next_coroutine_iterator_helper_args *args = (struct async_next_coroutine_iterator_helper_args*) _args;
-    coroutine_t *co = (coroutine_t*) value;
-    
-    if ((coro_get_state(co) == CO_SUSPENDED && coro_is_ready(co)) || coro_get_state(co) == CO_NEW) {
-        args->element = element;
-        args->coroutine = co;
-        return ITERATION_BREAK;
+void _async_drain_remote_wakeups(async_context_t *ctx) {
+    // Cleared before draining, so anything posted from here on signals again.
+    // An exchange rather than a store, so that it synchronises with the last
+    // poster that saw the flag set and its node is visible below
+    atomic_exchange(&ctx->remote_wakeups_signalled, 0);
+    mpsc_node_t *node = NULL;
+    while ((node = mpsc_pop(&ctx->remote_wakeups)) != NULL) {
+        coro_wakeup_t *wakeup = mpsc_entry(node, coro_wakeup_t, link);
+        coroutine_t *co = wakeup->co;
+        awaitable_t awaitable = wakeup->awaitable;
+        coro_release_wakeup(wakeup);
+        if (awaitable.type == AWAITABLE_TYPE_CANCEL) {
+            async_cancel_token_interrupt(awaitable.cancel_token);
+            async_cancel_token_release(awaitable.cancel_token);
+            continue;
+        }
+        if (awaitable.type == AWAITABLE_TYPE_IO_CANCEL) {
+            async_context_cancel_io(ctx, awaitable.future);
+            future_destroy(awaitable.future);
+            continue;
+        }
+        coro_remove_waiting(co, awaitable);
     }
-    return ITERATION_CONTINUE;
 }
 
-coroutine_t* _async_next_coroutine(async_context_t *ctx) {
-    struct async_next_coroutine_iterator_helper_args args = {
-        .element = NULL,
-        .coroutine = NULL
+void _async_wake_fd_waiter(async_context_t *ctx, coroutine_t *co, int fd) {
+    ctx->n_fd_waiting--;
+    coro_remove_waiting(co, AWAITABLE_FD(fd));
+}
+
+void _async_dispatch_fd_event(async_context_t *ctx, int fd, uint32_t events) {
+    struct fd_watch *watch = &ctx->watched_file_descriptors.elements[fd];
+    uint32_t read_events = events & FD_READ_EVENTS, write_events = events & FD_WRITE_EVENTS;
+
+    // Readiness nobody is waiting for is kept for the next async_await_fd(),
+    // since edge-triggered epoll won't report it again
+    if (watch->reader == NULL) watch->ready |= read_events;
+    if (watch->writer == NULL) watch->ready |= write_events;
+
+    struct fd_wait *woken[2] = {
+        watch->reader != NULL && read_events ? watch->reader : NULL,
+        watch->writer != NULL && write_events ? watch->writer : NULL
     };
-    dllist_iterate_with_args(ctx->scheduled_coroutines, _async_next_coroutine_iterator_helper, &args);
-    if (args.element) {
-        dllist_remove(ctx->scheduled_coroutines, args.element);
+    if (woken[0] == woken[1]) {
+        // A coroutine waiting on both directions only needs one wakeup
+        woken[1] = NULL;
     }
-    return args.coroutine;
+
+    for (size_t i = 0; i < 2; i++) {
+        struct fd_wait *wait = woken[i];
+        if (wait == NULL) continue;
+        if (watch->reader == wait) {
+            watch->reader = NULL;
+            wait->events |= read_events;
+        }
+        if (watch->writer == wait) {
+            watch->writer = NULL;
+            wait->events |= write_events;
+        }
+        _async_wake_fd_waiter(ctx, wait->co, fd);
+    }
+}
+
+int _async_poll_epoll(async_context_t *ctx, int64_t timeout_ns) {
+    struct epoll_event events[EPOLL_BATCH_SIZE];
+    struct timespec ts = {
+        .tv_sec = timeout_ns / 1000000000,
+        .tv_nsec = timeout_ns % 1000000000
+    };
+    int n = epoll_pwait2(ctx->epoll_fd, events, EPOLL_BATCH_SIZE, timeout_ns < 0 ? NULL : &ts, NULL);
+    if (n < 0 && errno == ENOSYS) {
+        // Kernel without epoll_pwait2(), round up to whole milliseconds
+        int timeout_ms = timeout_ns < 0 ? -1 : (int) ((timeout_ns + 999999) / 1000000);
+        n = epoll_wait(ctx->epoll_fd, events, EPOLL_BATCH_SIZE, timeout_ms);
+    }
+    if (n < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    for (int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        if (fd == ctx->wakeup_fd) {
+            debugf("epoll woken up through signal\n");
+            _wakeup_fd_drain(ctx->wakeup_fd);
+            continue;
+        }
+        _async_dispatch_fd_event(ctx, fd, events[i].events);
+    }
+    return 0;
+}
+
+void _async_handle_completion(uint64_t user_data, int32_t res, void *arg) {
+    async_context_t *ctx = (async_context_t*) arg;
+    if (user_data == URING_TAG_EPOLL) {
+        // Some fd watched through epoll is ready, or the scheduler was signalled
+        ctx->uring_epoll_armed = 0;
+        _async_poll_epoll(ctx, 0);
+        return;
+    }
+    ctx->n_io_inflight--;
+    if (user_data == URING_TAG_NONE) return;
+    future_t *f = (future_t*) (uintptr_t) user_data;
+    future_resolve(f, (void*) (intptr_t) res, NULL);
+    // The operation kept a reference in case the future was given up on
+    future_destroy(f);
+}
+
+int _async_poll_uring(async_context_t *ctx, int64_t timeout_ns) {
+    if (!ctx->uring_epoll_armed) {
+        struct io_uring_sqe *sqe = uring_get_sqe(ctx->uring);
+        if (sqe == NULL) {
+            return -1;
+        }
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = ctx->epoll_fd;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = URING_TAG_EPOLL;
+        ctx->uring_epoll_armed = 1;
+    }
+    // Everything queued since the last pass is submitted in this one call
+    if (uring_submit_and_wait(ctx->uring, timeout_ns) < 0) {
+        return -1;
+    }
+    uring_reap(ctx->uring, _async_handle_completion, ctx);
+    return 0;
+}
+
+int _async_poll_events(async_context_t *ctx, int64_t timeout_ns) {
+    if (ctx->uring != NULL) {
+        return _async_poll_uring(ctx, timeout_ns);
+    }
+    return _async_poll_epoll(ctx, timeout_ns);
+}
+
+void _async_fire_timers(async_context_t *ctx) {
+    if (heap_empty(ctx->timers)) return;
+    uint64_t now = async_now();
+    struct timer_entry *entry = NULL;
+    while ((entry = heap_min(ctx->timers)) != NULL && entry->deadline <= now) {
+        future_t *f = entry->future;
+        struct async_timeout *timeout = entry->timeout;
+        heap_pop(ctx->timers);
+        if (timeout != NULL) {
+            timeout->has_fired = 1;
+            coro_interrupt(timeout->co);
+            continue;
+        }
+        future_resolve(f, NULL, NULL);
+        future_destroy(f);
+    }
+}
+
+int64_t _async_next_timeout(async_context_t *ctx) {
+    struct timer_entry *entry = heap_min(ctx->timers);
+    if (entry == NULL) {
+        // Nothing to time out, sleep until an fd or a signal wakes us up
+        return -1;
+    }
+    uint64_t now = async_now();
+    return entry->deadline > now ? (int64_t) (entry->deadline - now) : 0;
+}
+
+void _async_push_ready(async_context_t *ctx, coroutine_t *co) {
+    assert(!ilist_node_is_linked(coro_get_run_link(co)));
+    ilist_push_back(&ctx->ready_coroutines, coro_get_run_link(co));
+    ctx->n_ready++;
+}
+
+void _async_spawned_lock_begin(async_context_t *ctx) {
+    if (mtx_lock(&ctx->spawned_lock) != thrd_success) {
+        errorf("failed to acquire spawn queue lock of async context at %p\n", ctx);
+        abort();
+    }
+}
+
+void _async_spawned_lock_end(async_context_t *ctx) {
+    if (mtx_unlock(&ctx->spawned_lock) != thrd_success) {
+        errorf("failed to release spawn queue lock of async context at %p\n", ctx);
+        abort();
+    }
+}
+
+coroutine_t *_async_pop_spawned(async_context_t *ctx) {
+    if (atomic_load(&ctx->n_spawned) == 0) return NULL;
+    _async_spawned_lock_begin(ctx);
+    coroutine_t *co = coro_from_run_link(ilist_pop_front(&ctx->spawned_coroutines));
+    if (co != NULL) {
+        atomic_fetch_sub(&ctx->n_spawned, 1);
+    }
+    _async_spawned_lock_end(ctx);
+    return co;
+}
+
+static void _async_prepare_run(async_context_t *ctx, coroutine_t *co) {
+    if (coro_get_state(co) == CO_NEW) {
+        // The coroutine stays on whichever context starts it
+        coro_set_context(co, ctx);
+        async_cancel_token_t *token = coro_get_cancel_token(co);
+        if (token != NULL) {
+            async_cancel_token_set_context(token, ctx);
+        }
+    }
+    ctx->current = co;
+}
+
+static void _async_coroutine_finished(async_context_t *ctx, coroutine_t *co) {
+    // Coroutine has finished and is no longer in any queue
+    if (!coro_is_owned(co)) {
+        // This coroutine has no owner and must be destroyed by the async
+        // context
+        coro_destroy(co);
+    }
+    debugf("coroutine at %p has finished\n", co);
+    if (ctx->runtime != NULL) {
+        async_runtime_coroutine_finished(ctx->runtime);
+    }
+}
+
+static void _async_reap_finished(async_context_t *ctx) {
+    coroutine_t *co = ctx->finished;
+    if (co == NULL) return;
+    ctx->finished = NULL;
+    _async_coroutine_finished(ctx, co);
+}
+
+// Takes a coroutine that is ready to run out of the ready queue, so the
+// caller can switch to it directly. Returns 0 if it isn't queued there
+static int _async_take_ready(async_context_t *ctx, coroutine_t *co) {
+    ilist_node_t *link = coro_get_run_link(co);
+    if (coro_get_context(co) != ctx || coro_get_state(co) != CO_SUSPENDED || !ilist_node_is_linked(link)) {
+        return 0;
+    }
+    ilist_remove(link);
+    ctx->n_ready--;
+    return 1;
+}
+
+// Switches from one coroutine straight to another without going through
+// the scheduler. Returns once from runs again
+static void _async_transfer(async_context_t *ctx, coroutine_t *from, coroutine_t *to) {
+    _async_prepare_run(ctx, to);
+    debugf("transferring from coroutine at %p to coroutine at %p\n", from, to);
+    _context_switch(coro_get_stack_context(from), coro_get_stack_context(to));
+    _async_reap_finished(ctx);
+}
+
+void _async_run_coroutine(async_context_t *ctx, coroutine_t *co) {
+    _async_prepare_run(ctx, co);
+    debugf("switching context to coroutine at %p\n", co);
+    coro_run(co, &ctx->scheduler_ctx);
+
+    // When the coroutine yields or finishes, it will
+    // do _context_switch(&co->ctx, &ctx->scheduler_ctx),
+    // and execution will resume here. Coroutines may have transferred to
+    // each other in the meantime, so it is the current one that came back
+    co = ctx->current;
+    ctx->handoff = NULL;
+    _async_reap_finished(ctx);
+    debugf("switched context back to scheduler from coroutine at %p\n", co);
+
+    if (coro_get_state(co) == CO_FINISHED) {
+        _async_coroutine_finished(ctx, co);
+    } else if (coro_get_state(co) == CO_SUSPENDED && coro_is_ready(co)) {
+        // Coroutine has only yielded control; place it back at the end
+        // of the ready queue
+        debugf("coroutine at %p has yielded, adding it to queue\n", co);
+        _async_push_ready(ctx, co);
+    } else if (coro_get_state(co) == CO_SUSPENDED) {
+        // Coroutine is waiting on something; park it until its last
+        // awaitable is removed
+        debugf("coroutine at %p is waiting, parking it\n", co);
+        coro_set_state(co, CO_WAITING);
+        ctx->n_parked++;
+    } else {
+        errorf("coroutine at %p was left in an invalid state\n", co);
+        abort();
+    }
+}
+
+int _async_has_work(async_context_t *ctx) {
+    return ctx->n_ready > 0 || atomic_load(&ctx->n_spawned) > 0;
+}
+
+int _async_is_finished(async_context_t *ctx) {
+    if (ctx->runtime != NULL) {
+        // Parked coroutines may be woken by any worker, so only stop once
+        // every coroutine in the runtime is done
+        return async_runtime_is_finished(ctx->runtime);
+    }
+    return ctx->n_parked == 0;
+}
+
+// Returns 0 if the loop was signalled since it last went to sleep, in which
+// case whatever the signal was about has to be picked up before blocking
+int _async_begin_sleep(async_context_t *ctx) {
+    int expected = LOOP_AWAKE;
+    if (atomic_compare_exchange_strong(&ctx->loop_state, &expected, LOOP_SLEEPING)) {
+        return 1;
+    }
+    atomic_store(&ctx->loop_state, LOOP_AWAKE);
+    return 0;
 }
 
 int _async_main_loop(async_context_t *ctx) {
     debugf("started async context main loop (%p)\n", ctx);
     _async_ctx_current = ctx;
     while (1) {
+        _async_drain_remote_wakeups(ctx);
+        _async_fire_timers(ctx);
+
+        // Only run the coroutines that were ready when this pass started, so a
+        // coroutine that keeps yielding can't starve wakeups from other threads
+        // Coroutines run through a handoff leave the queue early, so it may
+        // run dry before that
+        size_t n_runnable = ctx->n_ready;
         coroutine_t *co = NULL;
-        while ((co = _async_next_coroutine(ctx)) != NULL) {
-            // _async_next_coroutine() has removed `co` from the queue
-            ctx->current = co;
-            debugf("switching context to coroutine at %p\n", co);
-            coro_run(co, &ctx->scheduler_ctx);
-            debugf("switched context back to scheduler from coroutine at %p\n", co);
-    
-            // When the coroutine yields or finishes, it will
-            // do _context_switch(&co->ctx, &ctx->scheduler_ctx),
-            // and execution will resume here.
-    
-            if (coro_get_state(co) == CO_FINISHED) {
-                // Coroutine has finished and can be removed from scheduled queue
-                if (!coro_is_owned(co)) {
-                    // This coroutine has no owner and must be destroyed by the async
-                    // context
-                    coro_destroy(co);
-                }
-                debugf("coroutine at %p has finished\n", co);
-            } else if (coro_get_state(co) == CO_SUSPENDED) {
-                // Coroutine has yielded control but is still scheduled; place it
-                // back at the end of the queue
-                debugf("coroutine at %p has not finished, adding it to queue\n", co);
-                dllist_push_back(ctx->scheduled_coroutines, co);
-            } else {
-                errorf("coroutine at %p was left in an invalid state\n", co);
-                abort();
-            }
+        for (size_t i = 0; i < n_runnable && (co = coro_from_run_link(ilist_pop_front(&ctx->ready_coroutines))) != NULL; i++) {
+            ctx->n_ready--;
+            _async_run_coroutine(ctx, co);
+        }
+        size_t n_spawned = atomic_load(&ctx->n_spawned);
+        for (size_t i = 0; i < n_spawned && (co = _async_pop_spawned(ctx)) != NULL; i++) {
+            _async_run_coroutine(ctx, co);
         }
 
         ctx->current = NULL;
 
-        if (dllist_is_empty(ctx->scheduled_coroutines)) {
+        if (!_async_has_work(ctx) && ctx->runtime != NULL) {
+            // Advertise that this worker is idle before looking for work, so a
+            // coroutine spawned after the search still wakes us up
+            async_runtime_set_idle(ctx->runtime, ctx->worker_id, 1);
+            if (async_runtime_steal(ctx->runtime, ctx->worker_id) > 0) {
+                async_runtime_set_idle(ctx->runtime, ctx->worker_id, 0);
+                continue;
+            }
+        }
+
+        int has_work = _async_has_work(ctx);
+        if (has_work && ctx->n_fd_waiting == 0 && ctx->n_io_inflight == 0) {
+            continue;
+        }
+
+        if (!has_work && _async_is_finished(ctx)) {
             // No more scheduled coroutines, stop the main loop
             debugf("no more scheduled coroutines, stopping main loop (%p)\n", ctx);
             break;
         }
-        
-        // TODO: handle a possible timeout through minheap of timers
-        int poll_result = poll(
-            ctx->watched_file_descriptors.elements,
-            ctx->watched_file_descriptors.size,
-            1000 // TODO: figure out the timeout
-        );
-        if (poll_result == -1) {
-            debugf("poll() returned an error: '%s'\n", strerror(errno));
+
+        // Don't block if there is still work to do, only pick up fd events;
+        // otherwise sleep until the nearest timer is due
+        int64_t timeout = has_work ? 0 : _async_next_timeout(ctx);
+        int sleeping = timeout != 0 && _async_begin_sleep(ctx);
+        if (_async_poll_events(ctx, sleeping ? timeout : 0) != 0) {
+            debugf("polling for events returned an error: '%s'\n", strerror(errno));
+        }
+        if (sleeping) {
+            atomic_store(&ctx->loop_state, LOOP_AWAKE);
         }
-        if (ctx->watched_file_descriptors.elements[0].revents & POLLIN) {
-            // ctx->watched_file_descriptors.elements[0] is guaranteed to be wakeup_fd
-            debugf("poll woken up through signal\n");
-            _wakeup_fds_drain(&ctx->wakeup_fds);
+        if (ctx->runtime != NULL) {
+            async_runtime_set_idle(ctx->runtime, ctx->worker_id, 0);
         }
     }
 
+    if (ctx->runtime != NULL) {
+        async_runtime_set_idle(ctx->runtime, ctx->worker_id, 0);
+    }
     debugf("finished async context main loop (%p)\n", ctx);
     _async_ctx_current = NULL;
     return 0;
 }
 
+int async_context_run_loop(async_context_t *ctx) {
+    return _async_main_loop(ctx);
+}
+
+size_t async_context_steal(async_context_t *victim, async_context_t *thief) {
+    if (atomic_load(&victim->n_spawned) == 0) return 0;
+
+    // Take half of the victim's queue, from the front so the oldest
+    // coroutines are started first
+    _async_spawned_lock_begin(victim);
+    size_t n = (atomic_load(&victim->n_spawned) + 1) / 2, stolen = 0;
+    coroutine_t *co = NULL;
+    for (; stolen < n && (co = coro_from_run_link(ilist_pop_front(&victim->spawned_coroutines))) != NULL; stolen++) {
+        _async_push_ready(thief, co);
+    }
+    atomic_fetch_sub(&victim->n_spawned, stolen);
+    _async_spawned_lock_end(victim);
+
+    if (stolen > 0) {
+        debugf("stole %zu coroutines from async context at %p\n", stolen, victim);
+    }
+    return stolen;
+}
+
 int async_context_run(async_context_t *ctx, coroutine_function_t entrypoint, void *arg) {
-    coroutine_t *co = coro_create(entrypoint, arg, CORO_OPT_OWNED);
-    if (dllist_push_back(ctx->scheduled_coroutines, co)) {
+    return async_context_run_with_stack_size(ctx, entrypoint, arg, 0);
+}
+
+int async_context_run_with_stack_size(async_context_t *ctx, coroutine_function_t entrypoint, void *arg, size_t stack_size) {
+    coroutine_t *co = coro_create_with_stack_size(entrypoint, arg, CORO_OPT_OWNED, stack_size);
+    if (co == NULL) {
+        return -1;
+    }
+    if (async_schedule_coroutine(ctx, co)) {
+        coro_destroy(co);
         return -1;
     }
     
@@ -262,8 +696,101 @@ int async_context_run(async_context_t *ctx, coroutine_function_t entrypoint, voi
     return result;
 }
 
+struct io_uring_sqe *async_context_get_sqe(async_context_t *ctx) {
+    if (ctx->uring == NULL) {
+        return NULL;
+    }
+    struct io_uring_sqe *sqe = uring_get_sqe(ctx->uring);
+    if (sqe != NULL) {
+        ctx->n_io_inflight++;
+    }
+    return sqe;
+}
+
 int async_schedule_coroutine(async_context_t *ctx, coroutine_t *co) {
-    return dllist_push_back(ctx->scheduled_coroutines, co);
+    if (ctx->runtime == NULL || coro_get_state(co) != CO_NEW) {
+        _async_push_ready(ctx, co);
+        return 0;
+    }
+
+    // This may be called from any worker, and other workers can steal from
+    // this queue
+    _async_spawned_lock_begin(ctx);
+    ilist_push_back(&ctx->spawned_coroutines, coro_get_run_link(co));
+    atomic_fetch_add(&ctx->n_spawned, 1);
+    _async_spawned_lock_end(ctx);
+    async_runtime_coroutine_spawned(ctx->runtime, ctx);
+    return 0;
+}
+
+void async_unpark_coroutine(async_context_t *ctx, coroutine_t *co) {
+    if (ctx == NULL) {
+        errorf("unparking coroutine at %p outside async context\n", co);
+        abort();
+    }
+    coro_set_state(co, CO_SUSPENDED);
+    ctx->n_parked--;
+    _async_push_ready(ctx, co);
+}
+
+static int _async_post_detached(async_context_t *ctx, awaitable_t awaitable) {
+    // Not tied to any coroutine, which may well finish before this is seen
+    coro_wakeup_t *wakeup = malloc(sizeof(coro_wakeup_t));
+    if (wakeup == NULL) {
+        errorf("failed to allocate memory for wakeup\n");
+        return -1;
+    }
+    *wakeup = (coro_wakeup_t){
+        .co = NULL,
+        .awaitable = awaitable,
+        .is_allocated = 1
+    };
+    mpsc_push(&ctx->remote_wakeups, &wakeup->link);
+    if (!atomic_exchange(&ctx->remote_wakeups_signalled, 1)) {
+        async_signal_scheduler(ctx);
+    }
+    return 0;
+}
+
+int async_post_cancel(async_context_t *ctx, async_cancel_token_t *token) {
+    return _async_post_detached(ctx, AWAITABLE_CANCEL(token));
+}
+
+int async_context_cancel_io(async_context_t *ctx, future_t *f) {
+    if (ctx != async_context_get_current()) {
+        // Only the loop that owns the ring may touch it. The reference
+        // keeps the future from being reused for another operation before
+        future_retain(f);
+        if (_async_post_detached(ctx, AWAITABLE_IO_CANCEL(f)) != 0) {
+            future_destroy(f);
+            return -1;
+        }
+        return 0;
+    }
+    // Completes on its own, the operation it stops completes too
+    struct io_uring_sqe *sqe = async_context_get_sqe(ctx);
+    if (sqe == NULL) {
+        errorf("failed to stop I/O operation of future at %p\n", f);
+        return -1;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t) (uintptr_t) f;
+    sqe->user_data = URING_TAG_NONE;
+    return 0;
+}
+
+int async_post_wakeup(async_context_t *ctx, coroutine_t *co, awaitable_t awaitable) {
+    coro_wakeup_t *wakeup = coro_acquire_wakeup(co, awaitable);
+    if (wakeup == NULL) {
+        return -1;
+    }
+    mpsc_push(&ctx->remote_wakeups, &wakeup->link);
+    // A burst of completions costs the loop a single wakeup
+    if (!atomic_exchange(&ctx->remote_wakeups_signalled, 1)) {
+        async_signal_scheduler(ctx);
+    }
+    return 0;
 }
 
 void _async_yield(async_context_t *ctx, coroutine_t *co) {
@@ -274,6 +801,26 @@ void _async_yield(async_context_t *ctx, coroutine_t *co) {
         coro_get_stack_context(co),
         async_context_get_stack_context(ctx)
     );
+    // May have been resumed by a coroutine that finished
+    _async_reap_finished(ctx);
+}
+
+void async_context_set_handoff(async_context_t *ctx, coroutine_t *co) {
+    ctx->handoff = co;
+}
+
+void async_context_finish_coroutine(async_context_t *ctx, coroutine_t *co) {
+    coroutine_t *next = ctx->handoff;
+    ctx->handoff = NULL;
+    if (next != NULL && _async_take_ready(ctx, next)) {
+        _async_reap_finished(ctx);
+        ctx->finished = co;
+        _async_transfer(ctx, co, next);
+    } else {
+        _context_switch(coro_get_stack_context(co), &ctx->scheduler_ctx);
+    }
+    errorf("finished coroutine at %p was resumed\n", co);
+    abort();
 }
 
 void async_yield() {
@@ -299,7 +846,12 @@ void async_signal_scheduler(async_context_t *ctx) {
         errorf("no async context to signal\n");
         abort();
     }
-    while (_wakeup_fds_signal(&ctx->wakeup_fds) != 0) {
+    // Only the first signal since the loop went to sleep needs the syscall;
+    // an awake loop sees LOOP_NOTIFIED before it tries to sleep again
+    if (atomic_exchange(&ctx->loop_state, LOOP_NOTIFIED) != LOOP_SLEEPING) {
+        return;
+    }
+    while (_wakeup_fd_signal(ctx->wakeup_fd) != 0) {
         errorf("failed to signal scheduler, trying again\n");
         thrd_yield();
     }
@@ -311,15 +863,40 @@ struct dispatch_thread_wrapper_arg {
     future_t *future;
 };
 
-static int _dispatch_thread_wrapper(void *_arg) {
+static void _dispatch_thread_wrapper(void *_arg) {
     struct dispatch_thread_wrapper_arg *arg = (struct dispatch_thread_wrapper_arg*) _arg;
-    future_set_state(arg->future, FUTURE_PENDING);
     arg->func(arg->future, arg->original_arg);
+    future_destroy(arg->future);
     free(arg);
-    return 0;
+}
+
+static thread_pool_t *_dispatch_fallback_pool = NULL;
+static once_flag _dispatch_fallback_pool_once = ONCE_FLAG_INIT;
+
+static void _dispatch_fallback_pool_init() {
+    _dispatch_fallback_pool = thread_pool_create(DISPATCH_DEFAULT_MAX_THREADS, 0);
+}
+
+static thread_pool_t *_async_get_dispatch_pool(async_context_t *ctx) {
+    if (ctx == NULL) {
+        // Dispatching outside of any context shares one process-wide pool
+        call_once(&_dispatch_fallback_pool_once, _dispatch_fallback_pool_init);
+        return _dispatch_fallback_pool;
+    }
+    if (ctx->dispatch_pool == NULL) {
+        ctx->dispatch_pool = thread_pool_create(ctx->dispatch_max_threads, ctx->dispatch_max_queued);
+    }
+    return ctx->dispatch_pool;
 }
 
 future_t *async_dispatch(dispatch_function_t f, void *arg) {
+    async_context_t *ctx = async_context_get_current();
+    thread_pool_t *pool = _async_get_dispatch_pool(ctx);
+    if (pool == NULL) {
+        errorf("failed to create thread pool for dispatched functions\n");
+        return NULL;
+    }
+
     struct dispatch_thread_wrapper_arg *dispatch_arg = malloc(sizeof(struct dispatch_thread_wrapper_arg));
     if (dispatch_arg == NULL) {
         errorf("failed to allocate memory for dispatched thread arguments\n");
@@ -332,6 +909,14 @@ future_t *async_dispatch(dispatch_function_t f, void *arg) {
         free(dispatch_arg);
         return NULL;
     }
+    // Pending from the moment it is queued, so the future can be awaited
+    // before a thread picks it up
+    future_set_state(result, FUTURE_PENDING);
+    // A thread can't be interrupted, but the function may poll the token of
+    // its future
+    future_set_cancel_token(result, async_cancel_token_create(async_get_cancel_token()));
+    // Dropped once the function has returned
+    future_retain(result);
 
     *dispatch_arg = (struct dispatch_thread_wrapper_arg){
         .func = f,
@@ -339,22 +924,74 @@ future_t *async_dispatch(dispatch_function_t f, void *arg) {
         .original_arg = arg
     };
 
-    thrd_t thread;
-    if (thrd_create(&thread, _dispatch_thread_wrapper, dispatch_arg) != thrd_success) {
-        errorf("failed to spawn thread\n");
+    int submitted;
+    if (ctx != NULL && ctx->current != NULL) {
+        // A full queue pushes back on the dispatching coroutine only, the
+        // rest of the loop keeps running while it waits for a free slot
+        while ((submitted = thread_pool_try_submit(pool, _dispatch_thread_wrapper, dispatch_arg)) == 1) {
+            async_yield();
+        }
+    } else {
+        submitted = thread_pool_submit(pool, _dispatch_thread_wrapper, dispatch_arg);
+    }
+    if (submitted != 0) {
+        errorf("failed to submit dispatched function\n");
         free(dispatch_arg);
+        future_set_state(result, FUTURE_REJECTED);
+        // Both the reference the function would have dropped and ours
+        future_destroy(result);
         future_destroy(result);
         return NULL;
     }
-    if (thrd_detach(thread) != thrd_success) {
-        warnf("failed to detach thread, memory will be leaked\n");
-    }
 
     return result;
 }
 
-void* async_await_future(future_t *f) {
-    // FIXME: race condition, need to acquire f->lock
+#define ASYNC_NO_DEADLINE UINT64_MAX
+
+static int _async_timeout_start(async_context_t *ctx, struct async_timeout *timeout, uint64_t deadline) {
+    struct timer_entry entry = {
+        .deadline = deadline,
+        .future = NULL,
+        .timeout = timeout
+    };
+    timeout->has_fired = 0;
+    if (heap_insert_with_handle(ctx->timers, &entry, &timeout->handle) != 0) {
+        errorf("failed to add timeout to async context at %p\n", ctx);
+        return -1;
+    }
+    return 0;
+}
+
+static void _async_timeout_stop(async_context_t *ctx, struct async_timeout *timeout) {
+    if (!timeout->has_fired) {
+        heap_remove(ctx->timers, timeout->handle);
+    }
+}
+
+static void _async_await_future_interrupt(coroutine_t *co, void *arg) {
+    future_t *f = (future_t*) arg;
+    // Unless whoever settles it is already waking the coroutine up
+    if (future_remove_waiting(f, co)) {
+        coro_remove_waiting(co, AWAITABLE_FUTURE(f));
+    }
+}
+
+static void *_async_await_future_until(future_t *f, uint64_t deadline);
+
+// An operation that can't just be abandoned is stopped, and waited for,
+// before its awaiter gives up on it and takes the buffers it uses along
+static void _async_await_stopped(future_t *f) {
+    if (future_get_state(f) != FUTURE_PENDING || !future_has_stop_function(f)) return;
+    future_cancel(f);
+    async_cancel_token_t *shielded = async_cancel_shield();
+    _async_await_future_until(f, ASYNC_NO_DEADLINE);
+    async_cancel_unshield(shielded);
+}
+
+static void *_async_await_future_until(future_t *f, uint64_t deadline) {
+    // future_add_waiting() checks the state again atomically with joining
+    // the waiter list, so a future settled after this check is not waited on
     future_state_e state = future_get_state(f);
     if (state == FUTURE_RESOLVED) {
         return future_borrow_return_value(f);
@@ -373,21 +1010,55 @@ void* async_await_future(future_t *f) {
         errorf("running coroutine outside async context\n");
         abort();
     }
+    if (async_is_cancelled()) {
+        _async_await_stopped(f);
+        return NULL;
+    }
 
-    // If the future is not executing yet, schedule it
+    // If the future is not executing yet, schedule it. Nothing else can run
+    // before this coroutine parks, so unless other workers could steal it,
+    // its coroutine is run from here instead of going through the queue
+    coroutine_t *next = NULL;
     if (state == FUTURE_NEW) {
-        if (future_start(f) != 0) {
+        if (current_async_ctx->runtime == NULL) {
+            next = future_claim(f);
+        }
+        if (next == NULL && future_start(f) != 0) {
             errorf("failed to schedule future at %p\n", f);
             return NULL;
         }
     }
 
-    if (future_add_waiting(f, co) != 0) {
+    int waiting = future_add_waiting(f, co);
+    if (waiting != 0 && next != NULL) {
+        // Has to run all the same, if only to find out it was cancelled
+        async_schedule_coroutine(current_async_ctx, next);
+    }
+    if (waiting < 0) {
         errorf("failed to add coroutine at %p to waiting list of future at %p\n", co, f);
         return NULL;
     }
-
-    _async_yield(current_async_ctx, co);
+    if (waiting == 0) {
+        struct async_timeout timeout = { .co = co };
+        int has_timeout = deadline != ASYNC_NO_DEADLINE &&
+            _async_timeout_start(current_async_ctx, &timeout, deadline) == 0;
+        // Cancellation and the timeout both stop the wait the same way
+        coro_set_interrupt(co, _async_await_future_interrupt, f);
+        if (next != NULL) {
+            // Parked the way the scheduler would park it
+            coro_set_state(co, CO_WAITING);
+            current_async_ctx->n_parked++;
+            _async_transfer(current_async_ctx, co, next);
+        } else {
+            _async_yield(current_async_ctx, co);
+        }
+        coro_set_interrupt(co, NULL, NULL);
+        if (has_timeout) {
+            _async_timeout_stop(current_async_ctx, &timeout);
+        }
+        // Interrupted or timed out
+        _async_await_stopped(f);
+    }
     if (future_get_state(f) != FUTURE_RESOLVED) {
         return NULL;
     }
@@ -397,6 +1068,230 @@ void* async_await_future(future_t *f) {
     return result;
 }
 
+void* async_await_future(future_t *f) {
+    return _async_await_future_until(f, ASYNC_NO_DEADLINE);
+}
+
+void *async_await_future_timeout(future_t *f, uint64_t ns) {
+    return _async_await_future_until(f, async_now() + ns);
+}
+
+static void _async_await_fd_interrupt(coroutine_t *co, void *arg) {
+    struct fd_wait *wait = (struct fd_wait*) arg;
+    struct fd_watch *watch = &wait->ctx->watched_file_descriptors.elements[wait->fd];
+    int was_waiting = 0;
+    if (watch->reader == wait) {
+        watch->reader = NULL;
+        was_waiting = 1;
+    }
+    if (watch->writer == wait) {
+        watch->writer = NULL;
+        was_waiting = 1;
+    }
+    // Otherwise an event has woken it up already
+    if (!was_waiting) return;
+    wait->is_interrupted = 1;
+    _async_wake_fd_waiter(wait->ctx, co, wait->fd);
+}
+
+// Arms the fd before a coroutine parks on it. A plain close() drops the fd
+// from epoll behind our back, and the number may since have been reused, so
+// a registered fd is re-armed with EPOLL_CTL_MOD and added again on ENOENT
+static int _async_watch_fd(async_context_t *ctx, struct fd_watch *watch, int fd) {
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+        .data.fd = fd
+    };
+    if (watch->registered) {
+        if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_MOD, fd, &event) == 0) return 0;
+        if (errno != ENOENT) return -1;
+        watch->registered = 0;
+    }
+    // Whatever was cached belonged to a file that has been closed since
+    watch->ready = 0;
+    if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) return -1;
+    watch->registered = 1;
+    return 0;
+}
+
+int async_await_fd(int fd, short events) {
+    async_context_t *current_async_ctx = async_context_get_current();
+    if (current_async_ctx == NULL) {
+        errorf("running coroutine outside async context\n");
+        abort();
+    }
+    coroutine_t *co = async_context_get_current_coroutine(current_async_ctx);
+    if (co == NULL) {
+        errorf("running coroutine outside async context\n");
+        abort();
+    }
+    if (fd < 0 || !(events & (POLLIN | POLLOUT))) {
+        errorf("invalid arguments to async_await_fd(%d, %hd)\n", fd, events);
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct fd_watch *watch = _fd_watch_array_get(&current_async_ctx->watched_file_descriptors, fd);
+    if (watch == NULL) {
+        errorf("failed to allocate memory to watch fd %d\n", fd);
+        errno = ENOMEM;
+        return -1;
+    }
+    uint32_t interest = 0;
+    if (events & POLLIN) interest |= FD_READ_EVENTS;
+    if (events & POLLOUT) interest |= FD_WRITE_EVENTS;
+
+    // Armed before anything cached is trusted, so that a closed and reused
+    // fd number doesn't see the readiness of the file it had before
+    if (_async_watch_fd(current_async_ctx, watch, fd) != 0) {
+        errorf("failed to register fd %d with epoll: '%s'\n", fd, strerror(errno));
+        return -1;
+    }
+    // Consume readiness that arrived while nobody was waiting
+    uint32_t ready = watch->ready & interest;
+    if (ready) {
+        watch->ready &= ~ready;
+        return (int) ready;
+    }
+
+    if (async_is_cancelled()) {
+        errno = ECANCELED;
+        return -1;
+    }
+    if (((events & POLLIN) && watch->reader != NULL) || ((events & POLLOUT) && watch->writer != NULL)) {
+        errorf("fd %d is already being awaited by another coroutine\n", fd);
+        errno = EBUSY;
+        return -1;
+    }
+    if (coro_add_waiting(co, AWAITABLE_FD(fd)) != 0) {
+        errorf("failed to add fd %d to waiting list of coroutine at %p\n", fd, co);
+        errno = ENOMEM;
+        return -1;
+    }
+    struct fd_wait wait = {
+        .ctx = current_async_ctx,
+        .co = co,
+        .fd = fd
+    };
+    if (events & POLLIN) watch->reader = &wait;
+    if (events & POLLOUT) watch->writer = &wait;
+    current_async_ctx->n_fd_waiting++;
+
+    coro_set_interrupt(co, _async_await_fd_interrupt, &wait);
+    _async_yield(current_async_ctx, co);
+    coro_set_interrupt(co, NULL, NULL);
+    if (wait.is_interrupted) {
+        errno = ECANCELED;
+        return -1;
+    }
+    if (wait.error != 0) {
+        errno = wait.error;
+        return -1;
+    }
+    return (int) wait.events;
+}
+
+void async_forget_fd(int fd) {
+    async_context_t *current_async_ctx = async_context_get_current();
+    if (current_async_ctx == NULL) {
+        errorf("running coroutine outside async context\n");
+        abort();
+    }
+    if (fd < 0 || (size_t) fd >= current_async_ctx->watched_file_descriptors.capacity) return;
+    struct fd_watch *watch = &current_async_ctx->watched_file_descriptors.elements[fd];
+    if (!watch->registered) return;
+
+    if (epoll_ctl(current_async_ctx->epoll_fd, EPOLL_CTL_DEL, fd, NULL) != 0) {
+        debugf("failed to unregister fd %d from epoll: '%s'\n", fd, strerror(errno));
+    }
+    // Anyone still waiting on this fd would never be woken up otherwise. They
+    // are detached first, the watch may be reused before they run
+    struct fd_wait *waits[2] = { watch->reader, watch->writer != watch->reader ? watch->writer : NULL };
+    *watch = (struct fd_watch){};
+    for (size_t i = 0; i < 2; i++) {
+        if (waits[i] == NULL) continue;
+        waits[i]->error = EBADF;
+        _async_wake_fd_waiter(current_async_ctx, waits[i]->co, fd);
+    }
+}
+
+uint64_t async_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+future_t *async_timer_at(uint64_t deadline) {
+    async_context_t *current_async_ctx = async_context_get_current();
+    if (current_async_ctx == NULL) {
+        errorf("running coroutine outside async context\n");
+        abort();
+    }
+
+    future_t *result = future_create(0);
+    if (result == NULL) {
+        return NULL;
+    }
+    struct timer_entry entry = {
+        .deadline = deadline,
+        .future = result,
+        .timeout = NULL
+    };
+    if (heap_insert(current_async_ctx->timers, &entry) != 0) {
+        errorf("failed to add timer to async context at %p\n", current_async_ctx);
+        future_destroy(result);
+        return NULL;
+    }
+    future_set_state(result, FUTURE_PENDING);
+    // Dropped by the heap once the timer fires
+    future_retain(result);
+    return result;
+}
+
+future_t *async_timer(uint64_t ns) {
+    return async_timer_at(async_now() + ns);
+}
+
+static void _async_sleep_interrupt(coroutine_t *co, void *arg) {
+    coro_remove_waiting(co, AWAITABLE_TIMEOUT((struct async_timeout*) arg));
+}
+
+void async_sleep_until(uint64_t deadline) {
+    async_context_t *current_async_ctx = async_context_get_current();
+    if (current_async_ctx == NULL) {
+        errorf("running coroutine outside async context\n");
+        abort();
+    }
+    coroutine_t *co = async_context_get_current_coroutine(current_async_ctx);
+    if (co == NULL) {
+        errorf("running coroutine outside async context\n");
+        abort();
+    }
+    if (async_is_cancelled()) {
+        return;
+    }
+
+    // Parked on the timeout itself, without a future to allocate
+    struct async_timeout timeout = { .co = co };
+    if (_async_timeout_start(current_async_ctx, &timeout, deadline) != 0) {
+        errorf("failed to create timer, not sleeping\n");
+        return;
+    }
+    if (coro_add_waiting(co, AWAITABLE_TIMEOUT(&timeout)) != 0) {
+        errorf("failed to add timer to waiting list of coroutine at %p\n", co);
+        _async_timeout_stop(current_async_ctx, &timeout);
+        return;
+    }
+    coro_set_interrupt(co, _async_sleep_interrupt, &timeout);
+    _async_yield(current_async_ctx, co);
+    coro_set_interrupt(co, NULL, NULL);
+    _async_timeout_stop(current_async_ctx, &timeout);
+}
+
+void async_sleep(uint64_t ns) {
+    async_sleep_until(async_now() + ns);
+}
+
 void* async_await_function(coroutine_function_t func, void *arg) {
     async_yield();
     return func(arg);
@@ -404,8 +1299,19 @@ void* async_await_function(coroutine_function_t func, void *arg) {
 
 void async_context_destroy(async_context_t *ctx) {
     if (ctx == NULL) return;
-    dllist_destroy(ctx->scheduled_coroutines);
-    _pollfd_array_free(&ctx->watched_file_descriptors);
-    _wakeup_fds_free(&ctx->wakeup_fds);
+    // Lets dispatched functions finish first, since they may still post
+    // wakeups to this context
+    thread_pool_destroy(ctx->dispatch_pool);
+    uring_destroy(ctx->uring);
+    heap_destroy(ctx->timers);
+    mpsc_node_t *node = NULL;
+    while ((node = mpsc_pop(&ctx->remote_wakeups)) != NULL) {
+        coro_release_wakeup(mpsc_entry(node, coro_wakeup_t, link));
+    }
+    stack_pool_destroy(ctx->stack_pool);
+    mtx_destroy(&ctx->spawned_lock);
+    if (ctx->epoll_fd >= 0) close(ctx->epoll_fd);
+    _fd_watch_array_free(&ctx->watched_file_descriptors);
+    if (ctx->wakeup_fd >= 0) close(ctx->wakeup_fd);
     free(ctx);
 }
@@ -0,0 +1,190 @@
+#include "cancel.h"
+#include "async.h"
+#include "ilist.h"
+#include "logging.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#define CANCEL_SPINS_BEFORE_YIELD 64
+
+struct async_cancel_token {
+    atomic_uint refs;
+    atomic_int is_cancelled;
+    // Guards the list of children, and the links of each child in it
+    atomic_uint lock;
+    async_cancel_token_t *parent;
+    ilist_node_t link;
+    ilist_t children;
+    // Set once the bound coroutine has started. The coroutine itself is only
+    // touched on the thread of that context
+    _Atomic(async_context_t*) ctx;
+    coroutine_t *co;
+};
+
+static void _cancel_token_lock(async_cancel_token_t *t) {
+    unsigned spins = 0;
+    while (atomic_exchange_explicit(&t->lock, 1, memory_order_acquire)) {
+        while (atomic_load_explicit(&t->lock, memory_order_relaxed)) {
+            if (++spins % CANCEL_SPINS_BEFORE_YIELD == 0) {
+                thrd_yield();
+            } else {
+                __builtin_ia32_pause();
+            }
+        }
+    }
+}
+
+static void _cancel_token_unlock(async_cancel_token_t *t) {
+    atomic_store_explicit(&t->lock, 0, memory_order_release);
+}
+
+async_cancel_token_t *async_cancel_token_create(async_cancel_token_t *parent) {
+    async_cancel_token_t *t = malloc(sizeof(async_cancel_token_t));
+    if (t == NULL) {
+        errorf("failed to allocate memory for a cancellation token\n");
+        return NULL;
+    }
+    atomic_init(&t->refs, 1);
+    atomic_init(&t->is_cancelled, 0);
+    atomic_init(&t->lock, 0);
+    atomic_init(&t->ctx, NULL);
+    t->parent = parent;
+    t->co = NULL;
+    ilist_node_init(&t->link);
+    ilist_init(&t->children);
+    if (parent == NULL) return t;
+
+    async_cancel_token_retain(parent);
+    // Checked under the lock, so a parent being cancelled right now either
+    // sees this child or has already set its flag
+    _cancel_token_lock(parent);
+    if (atomic_load(&parent->is_cancelled)) {
+        atomic_store(&t->is_cancelled, 1);
+    } else {
+        ilist_push_back(&parent->children, &t->link);
+    }
+    _cancel_token_unlock(parent);
+    return t;
+}
+
+void async_cancel_token_retain(async_cancel_token_t *t) {
+    atomic_fetch_add_explicit(&t->refs, 1, memory_order_relaxed);
+}
+
+// Fails for a token that is already on its way out
+static int _cancel_token_try_retain(async_cancel_token_t *t) {
+    unsigned refs = atomic_load_explicit(&t->refs, memory_order_relaxed);
+    while (refs > 0) {
+        if (atomic_compare_exchange_weak_explicit(&t->refs, &refs, refs + 1,
+                memory_order_relaxed, memory_order_relaxed)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void async_cancel_token_release(async_cancel_token_t *t) {
+    if (t == NULL) return;
+    if (atomic_fetch_sub_explicit(&t->refs, 1, memory_order_acq_rel) != 1) return;
+    // Children hold a reference to their parent, so there are none left
+    async_cancel_token_t *parent = t->parent;
+    if (parent != NULL) {
+        _cancel_token_lock(parent);
+        if (ilist_node_is_linked(&t->link)) {
+            ilist_remove(&t->link);
+        }
+        _cancel_token_unlock(parent);
+        async_cancel_token_release(parent);
+    }
+    free(t);
+}
+
+static void _cancel_token_interrupt_bound(async_cancel_token_t *t) {
+    // Pairs with async_cancel_token_set_context(): either the coroutine sees
+    // the flag when it starts, or the context is seen here
+    async_context_t *ctx = atomic_load(&t->ctx);
+    if (ctx == NULL) return;
+    if (ctx == async_context_get_current()) {
+        async_cancel_token_interrupt(t);
+        return;
+    }
+    // Dropped by the other context once it has interrupted the coroutine
+    if (!_cancel_token_try_retain(t)) return;
+    if (async_post_cancel(ctx, t) != 0) {
+        errorf("failed to post cancellation to async context at %p\n", ctx);
+        async_cancel_token_release(t);
+    }
+}
+
+void async_cancel_token_cancel(async_cancel_token_t *t) {
+    if (atomic_exchange(&t->is_cancelled, 1)) return;
+    _cancel_token_interrupt_bound(t);
+
+    // A child whose last reference is gone waits on this lock to unlink
+    // itself, so every child in the list is still there to be cancelled
+    _cancel_token_lock(t);
+    ilist_node_t *node, *next;
+    ilist_for_each_safe(&t->children, node, next) {
+        async_cancel_token_cancel(ilist_entry(node, async_cancel_token_t, link));
+    }
+    _cancel_token_unlock(t);
+}
+
+int async_cancel_token_is_cancelled(async_cancel_token_t *t) {
+    return atomic_load(&t->is_cancelled);
+}
+
+async_cancel_token_t *async_get_cancel_token() {
+    async_context_t *ctx = async_context_get_current();
+    if (ctx == NULL) return NULL;
+    coroutine_t *co = async_context_get_current_coroutine(ctx);
+    return co != NULL ? coro_get_cancel_token(co) : NULL;
+}
+
+int async_is_cancelled() {
+    async_cancel_token_t *t = async_get_cancel_token();
+    return t != NULL && async_cancel_token_is_cancelled(t);
+}
+
+async_cancel_token_t *async_cancel_shield() {
+    async_context_t *ctx = async_context_get_current();
+    coroutine_t *co = ctx != NULL ? async_context_get_current_coroutine(ctx) : NULL;
+    if (co == NULL) return NULL;
+    async_cancel_token_t *t = coro_get_cancel_token(co);
+    if (t == NULL) return NULL;
+    // Interrupts are only ever delivered through the bound coroutine, so
+    // with neither link in place nothing reaches this one
+    coro_set_cancel_token(co, NULL);
+    async_cancel_token_unbind(t);
+    return t;
+}
+
+void async_cancel_unshield(async_cancel_token_t *t) {
+    if (t == NULL) return;
+    coroutine_t *co = async_context_get_current_coroutine(async_context_get_current());
+    t->co = co;
+    coro_set_cancel_token(co, t);
+}
+
+void async_cancel_token_bind(async_cancel_token_t *t, coroutine_t *co) {
+    async_cancel_token_retain(t);
+    t->co = co;
+    coro_set_cancel_token(co, t);
+}
+
+void async_cancel_token_set_context(async_cancel_token_t *t, async_context_t *ctx) {
+    atomic_store(&t->ctx, ctx);
+}
+
+void async_cancel_token_interrupt(async_cancel_token_t *t) {
+    coroutine_t *co = t->co;
+    async_context_t *ctx = async_context_get_current();
+    // A coroutine cancelling itself finds out at its next cancellation point
+    if (co == NULL || (ctx != NULL && co == async_context_get_current_coroutine(ctx))) return;
+    coro_interrupt(co);
+}
+
+void async_cancel_token_unbind(async_cancel_token_t *t) {
+    t->co = NULL;
+}
@@ -0,0 +1,201 @@
+#include "channel.h"
+#include "logging.h"
+#include "wait_queue.h"
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHANNEL_CACHE_LINE 64
+
+// Each slot carries a sequence number telling whether it is free for the
+// sender at a given position or holds the element for the receiver at it,
+// so senders and receivers only ever contend on their own end of the ring
+struct chan_slot {
+    atomic_size_t sequence;
+    alignas(max_align_t) unsigned char data[];
+};
+
+struct async_chan {
+    alignas(CHANNEL_CACHE_LINE) atomic_size_t tail;
+    alignas(CHANNEL_CACHE_LINE) atomic_size_t head;
+    alignas(CHANNEL_CACHE_LINE) unsigned char *slots;
+    size_t mask;
+    size_t slot_size;
+    size_t element_size;
+    atomic_int is_closed;
+    wait_queue_t senders;
+    wait_queue_t receivers;
+};
+
+static struct chan_slot *_chan_slot(async_chan_t *c, size_t position) {
+    return (struct chan_slot*) (c->slots + (position & c->mask) * c->slot_size);
+}
+
+async_chan_t *async_chan_create(size_t capacity, size_t element_size) {
+    // With a single slot, a full one would look free to the next lap's sender
+    size_t rounded = 2;
+    while (rounded < capacity) rounded <<= 1;
+
+    async_chan_t *c = aligned_alloc(alignof(async_chan_t), sizeof(async_chan_t));
+    if (c == NULL) {
+        errorf("failed to allocate memory for a channel\n");
+        return NULL;
+    }
+    size_t slot_size = sizeof(struct chan_slot) + element_size;
+    slot_size = (slot_size + alignof(struct chan_slot) - 1) & ~(alignof(struct chan_slot) - 1);
+    c->slots = malloc(rounded * slot_size);
+    if (c->slots == NULL) {
+        errorf("failed to allocate memory for a channel\n");
+        free(c);
+        return NULL;
+    }
+    c->mask = rounded - 1;
+    c->slot_size = slot_size;
+    c->element_size = element_size;
+    atomic_init(&c->tail, 0);
+    atomic_init(&c->head, 0);
+    atomic_init(&c->is_closed, 0);
+    for (size_t i = 0; i < rounded; i++) {
+        atomic_init(&_chan_slot(c, i)->sequence, i);
+    }
+    wait_queue_init(&c->senders);
+    wait_queue_init(&c->receivers);
+    return c;
+}
+
+// Returns 0 if the element went in and 1 if the ring was full
+static int _chan_push(async_chan_t *c, const void *element) {
+    size_t position = atomic_load_explicit(&c->tail, memory_order_relaxed);
+    struct chan_slot *slot;
+    while (1) {
+        slot = _chan_slot(c, position);
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t) sequence - (intptr_t) position;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&c->tail, &position, position + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The receiver a whole lap behind hasn't taken this slot yet
+            return 1;
+        } else {
+            position = atomic_load_explicit(&c->tail, memory_order_relaxed);
+        }
+    }
+    memcpy(slot->data, element, c->element_size);
+    atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+    return 0;
+}
+
+// Returns 0 if an element came out and 1 if the ring was empty
+static int _chan_pop(async_chan_t *c, void *element) {
+    size_t position = atomic_load_explicit(&c->head, memory_order_relaxed);
+    struct chan_slot *slot;
+    while (1) {
+        slot = _chan_slot(c, position);
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t) sequence - (intptr_t) (position + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&c->head, &position, position + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 1;
+        } else {
+            position = atomic_load_explicit(&c->head, memory_order_relaxed);
+        }
+    }
+    memcpy(element, slot->data, c->element_size);
+    // Free for the sender one lap ahead
+    atomic_store_explicit(&slot->sequence, position + c->mask + 1, memory_order_release);
+    return 0;
+}
+
+// Neither of these wakes anyone, so they can run with a wait queue locked
+static int _chan_send_once(async_chan_t *c, const void *element) {
+    if (atomic_load_explicit(&c->is_closed, memory_order_acquire)) {
+        return -1;
+    }
+    return _chan_push(c, element);
+}
+
+static int _chan_recv_once(async_chan_t *c, void *element) {
+    if (_chan_pop(c, element) == 0) {
+        return 0;
+    }
+    if (!atomic_load_explicit(&c->is_closed, memory_order_acquire)) {
+        return 1;
+    }
+    // Something may have gone in right before the channel was closed
+    return _chan_pop(c, element) == 0 ? 0 : -1;
+}
+
+int async_chan_try_send(async_chan_t *c, const void *element) {
+    int result = _chan_send_once(c, element);
+    if (result == 0) {
+        wait_queue_wake(&c->receivers, 1);
+    }
+    return result;
+}
+
+int async_chan_try_recv(async_chan_t *c, void *element) {
+    int result = _chan_recv_once(c, element);
+    if (result == 0) {
+        wait_queue_wake(&c->senders, 1);
+    }
+    return result;
+}
+
+int async_chan_send(async_chan_t *c, const void *element) {
+    while (1) {
+        int result = async_chan_try_send(c, element);
+        if (result != 1) return result;
+
+        // Checked again once counted as a waiter, a receiver that made room
+        // in between either sees this sender or is seen here
+        wait_queue_prepare(&c->senders);
+        result = _chan_send_once(c, element);
+        if (result != 1) {
+            wait_queue_cancel(&c->senders);
+            if (result == 0) wait_queue_wake(&c->receivers, 1);
+            return result;
+        }
+        if (wait_queue_wait(&c->senders) != 0) return -1;
+    }
+}
+
+int async_chan_recv(async_chan_t *c, void *element) {
+    while (1) {
+        int result = async_chan_try_recv(c, element);
+        if (result != 1) return result;
+
+        wait_queue_prepare(&c->receivers);
+        result = _chan_recv_once(c, element);
+        if (result != 1) {
+            wait_queue_cancel(&c->receivers);
+            if (result == 0) wait_queue_wake(&c->senders, 1);
+            return result;
+        }
+        if (wait_queue_wait(&c->receivers) != 0) return -1;
+    }
+}
+
+void async_chan_close(async_chan_t *c) {
+    atomic_store_explicit(&c->is_closed, 1, memory_order_release);
+    wait_queue_wake(&c->senders, SIZE_MAX);
+    wait_queue_wake(&c->receivers, SIZE_MAX);
+}
+
+size_t async_chan_get_capacity(async_chan_t *c) {
+    return c->mask + 1;
+}
+
+void async_chan_destroy(async_chan_t *c) {
+    if (c == NULL) return;
+    free(c->slots);
+    free(c);
+}
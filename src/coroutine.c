@@ -1,8 +1,11 @@
 #include "coroutine.h"
 #include "logging.h"
 #include "async.h"
+#include "cancel.h"
 #include "dllist.h"
+#include "stack_pool.h"
 #include <assert.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -12,6 +15,10 @@
     #include <valgrind/valgrind.h>
 #endif
 
+// Debug builds fill every new stack with this byte, whatever is left of it
+// when the coroutine is destroyed was never touched
+#define CORO_STACK_PAINT 0xCD
+
 struct coroutine {
     int options;
 
@@ -22,7 +29,26 @@ struct coroutine {
     void *arg;
 
     coroutine_state_e state;
-    dllist_t *waiting_on;
+    // Number of awaitables this coroutine is still parked on. Almost always
+    // at most one, which is kept inline; any others go to `more_awaiting`,
+    // only created the first time a coroutine waits on several at once
+    size_t n_pending;
+    int has_awaiting;
+    awaitable_t awaiting;
+    dllist_t *more_awaiting;
+
+    ilist_node_t run_link;
+    ilist_node_t wait_link;
+    coro_wakeup_t wakeup;
+    atomic_int wakeup_in_use;
+
+    // Context this coroutine started running on; it never moves after that
+    async_context_t *async_ctx;
+
+    async_cancel_token_t *cancel_token;
+    // Set while parked at a cancellation point, stops waiting early
+    void (*interrupt)(coroutine_t *, void *arg);
+    void *interrupt_arg;
 
     context_t ctx;
 
@@ -35,13 +61,33 @@ struct coroutine {
 
 static void _coro_run_trampoline();
 
+static stack_pool_t *_coro_current_stack_pool() {
+    // Stacks are recycled through the pool of the context running on this
+    // thread; without one they are mapped and unmapped directly
+    async_context_t *ctx = async_context_get_current();
+    return ctx != NULL ? async_context_get_stack_pool(ctx) : NULL;
+}
+
 coroutine_t* coro_create(coroutine_function_t f, void *arg, int options) {
-    size_t stack_size = 64 * 1024;
+    return coro_create_with_stack_size(f, arg, options, 0);
+}
+
+coroutine_t* coro_create_with_stack_size(coroutine_function_t f, void *arg, int options, size_t stack_size) {
+    if (stack_size == 0) {
+        stack_size = (options & CORO_OPT_SMALL_STACK) ? CORO_SMALL_STACK_SIZE : CORO_DEFAULT_STACK_SIZE;
+    }
+    // The pool hands out whole size classes, so the rest is usable too
+    size_t rounded = stack_pool_round_size(stack_size);
+    if (rounded == 0) {
+        errorf("coroutine stack of %zu bytes is too large\n", stack_size);
+        return NULL;
+    }
+    stack_size = rounded;
 
     coroutine_t *co = malloc(sizeof *co);
     if (!co) return NULL;
 
-    co->stack = malloc(stack_size);
+    co->stack = stack_pool_acquire(_coro_current_stack_pool(), stack_size);
     if (!co->stack) {
         free(co);
         return NULL;
@@ -52,9 +98,27 @@ coroutine_t* coro_create(coroutine_function_t f, void *arg, int options) {
     co->arg = arg;
     co->state = CO_NEW;
     co->return_value = NULL;
-    co->waiting_on = dllist_create(free);
+    co->n_pending = 0;
+    co->has_awaiting = 0;
+    co->more_awaiting = NULL;
     co->ctx = (context_t){};
     co->options = options;
+    co->async_ctx = NULL;
+    co->cancel_token = NULL;
+    co->interrupt = NULL;
+    co->interrupt_arg = NULL;
+    ilist_node_init(&co->run_link);
+    ilist_node_init(&co->wait_link);
+    co->wakeup = (coro_wakeup_t){
+        .co = co,
+        .is_allocated = 0
+    };
+    atomic_init(&co->wakeup_in_use, 0);
+
+#ifdef DEBUGGING
+    // Commits the whole stack, which is fine for debugging
+    memset(co->stack, CORO_STACK_PAINT, co->stack_size);
+#endif
 
     // Register this stack with valgrind when debugging
 #if defined DEBUGGING || defined VALGRIND
@@ -96,12 +160,10 @@ coroutine_t* coro_create(coroutine_function_t f, void *arg, int options) {
     co->return_value = co->func(co->arg);
     debugf("coroutine at %p has finished with value %p\n", co, co->return_value);
     co->state = CO_FINISHED;
-    
-    // Switch back to scheduler context
-    _context_switch(
-        &co->ctx,
-        async_context_get_stack_context(current_async_ctx)
-    );
+
+    // Switch back to scheduler context, or straight to the coroutine waiting
+    // for this one
+    async_context_finish_coroutine(current_async_ctx, co);
     __builtin_unreachable();
 }
 
@@ -112,7 +174,7 @@ void coro_run(coroutine_t *co, context_t *from) {
 int coro_is_ready(coroutine_t *co) {
     if (co->state == CO_NEW) return 1;
     if (co->state == CO_SUSPENDED) {
-        return dllist_is_empty(co->waiting_on);
+        return co->n_pending == 0;
     }
     return 0;
 }
@@ -129,6 +191,14 @@ context_t *coro_get_stack_context(coroutine_t *co) {
     return &co->ctx;
 }
 
+async_context_t *coro_get_context(coroutine_t *co) {
+    return co->async_ctx;
+}
+
+void coro_set_context(coroutine_t *co, async_context_t *ctx) {
+    co->async_ctx = ctx;
+}
+
 void *coro_get_return_value(coroutine_t *co) {
     return co->return_value;
 }
@@ -137,14 +207,92 @@ int coro_is_owned(coroutine_t *co) {
     return co->options & CORO_OPT_OWNED;
 }
 
+ilist_node_t *coro_get_run_link(coroutine_t *co) {
+    return &co->run_link;
+}
+
+coroutine_t *coro_from_run_link(ilist_node_t *node) {
+    return node != NULL ? ilist_entry(node, coroutine_t, run_link) : NULL;
+}
+
+ilist_node_t *coro_get_wait_link(coroutine_t *co) {
+    return &co->wait_link;
+}
+
+coroutine_t *coro_from_wait_link(ilist_node_t *node) {
+    return node != NULL ? ilist_entry(node, coroutine_t, wait_link) : NULL;
+}
+
+coro_wakeup_t *coro_acquire_wakeup(coroutine_t *co, awaitable_t awaitable) {
+    coro_wakeup_t *wakeup = &co->wakeup;
+    if (atomic_exchange_explicit(&co->wakeup_in_use, 1, memory_order_acquire)) {
+        // Only when several wakeups for the same coroutine are in flight
+        wakeup = malloc(sizeof(coro_wakeup_t));
+        if (wakeup == NULL) {
+            errorf("failed to allocate memory for wakeup\n");
+            return NULL;
+        }
+        *wakeup = (coro_wakeup_t){
+            .co = co,
+            .is_allocated = 1
+        };
+    }
+    wakeup->awaitable = awaitable;
+    return wakeup;
+}
+
+void coro_release_wakeup(coro_wakeup_t *wakeup) {
+    if (wakeup->is_allocated) {
+        free(wakeup);
+        return;
+    }
+    atomic_store_explicit(&wakeup->co->wakeup_in_use, 0, memory_order_release);
+}
+
+size_t coro_get_stack_size(coroutine_t *co) {
+    return co->stack_size;
+}
+
+size_t coro_get_stack_usage(coroutine_t *co) {
+#ifdef DEBUGGING
+    size_t untouched = 0;
+    while (untouched < co->stack_size && co->stack[untouched] == CORO_STACK_PAINT) {
+        untouched++;
+    }
+    return co->stack_size - untouched;
+#else
+    (void) co;
+    return 0;
+#endif
+}
+
 int coro_add_waiting(coroutine_t *co, awaitable_t awaitable) {
+    if (!co->has_awaiting) {
+        co->awaiting = awaitable;
+        co->has_awaiting = 1;
+        co->n_pending++;
+        return 0;
+    }
+
+    if (co->more_awaiting == NULL) {
+        co->more_awaiting = dllist_create(free);
+        if (co->more_awaiting == NULL) {
+            errorf("failed to allocate memory for new awaitable\n");
+            return -1;
+        }
+    }
     awaitable_t *new_awaitable = malloc(sizeof(awaitable_t));
     if (new_awaitable == NULL) {
         errorf("failed to allocate memory for new awaitable\n");
         return -1;
     }
     memcpy(new_awaitable, &awaitable, sizeof(awaitable_t));
-    return dllist_push_back(co->waiting_on, new_awaitable);
+    if (dllist_push_back(co->more_awaiting, new_awaitable) != 0) {
+        free(new_awaitable);
+        return -1;
+    }
+    co->n_pending++;
+    return 0;
 }
 
 int _find_awaitable(void *_value, void *_arg) {
@@ -155,23 +303,73 @@ int _find_awaitable(void *_value, void *_arg) {
             return arg->future == value->future;
         case AWAITABLE_TYPE_FD:
             return arg->fd == value->fd;
+        case AWAITABLE_TYPE_WAIT_QUEUE:
+            return arg->wait_queue == value->wait_queue;
+        case AWAITABLE_TYPE_TIMEOUT:
+            return arg->timeout == value->timeout;
+        case AWAITABLE_TYPE_CANCEL:
+            return arg->cancel_token == value->cancel_token;
+        case AWAITABLE_TYPE_IO_CANCEL:
+            return arg->future == value->future;
     }
     return 0;
 }
 
 void coro_remove_waiting(coroutine_t *co, awaitable_t awaitable) {
-    dllist_element_t *element = dllist_find_by_predicate(co->waiting_on, _find_awaitable, &awaitable);
-    if (element == NULL) return;
-    dllist_remove(co->waiting_on, element);
+    // Wakeups for something the coroutine no longer waits on are ignored,
+    // which the identity check on the inline slot makes constant time
+    if (co->has_awaiting && _find_awaitable(&co->awaiting, &awaitable)) {
+        co->has_awaiting = 0;
+    } else {
+        dllist_element_t *element = co->more_awaiting != NULL
+            ? dllist_find_by_predicate(co->more_awaiting, _find_awaitable, &awaitable)
+            : NULL;
+        if (element == NULL) return;
+        dllist_remove(co->more_awaiting, element);
+    }
+    co->n_pending--;
+    if (co->state == CO_WAITING && co->n_pending == 0) {
+        // That was the last thing this coroutine was parked on, hand it back
+        // to the scheduler's ready queue
+        async_unpark_coroutine(co->async_ctx, co);
+    }
+}
+
+void coro_set_cancel_token(coroutine_t *co, async_cancel_token_t *token) {
+    co->cancel_token = token;
+}
+
+async_cancel_token_t *coro_get_cancel_token(coroutine_t *co) {
+    return co->cancel_token;
+}
+
+void coro_set_interrupt(coroutine_t *co, void (*interrupt)(coroutine_t *, void *arg), void *arg) {
+    co->interrupt = interrupt;
+    co->interrupt_arg = arg;
+}
+
+void coro_interrupt(coroutine_t *co) {
+    void (*interrupt)(coroutine_t *, void *) = co->interrupt;
+    if (interrupt == NULL) return;
+    // Only once, whatever it was waiting on may still wake it up as well
+    co->interrupt = NULL;
+    interrupt(co, co->interrupt_arg);
 }
 
 void coro_destroy(coroutine_t *co) {
     if (co == NULL) return; 
+#ifdef DEBUGGING
+    debugf("coroutine at %p used %zu of %zu stack bytes\n", co, coro_get_stack_usage(co), co->stack_size);
+#endif
     // Unregister this stack with valgrind when debugging
 #if defined DEBUGGING || defined VALGRIND
     VALGRIND_STACK_DEREGISTER(co->valgrind_stack_id);
 #endif
-    dllist_destroy(co->waiting_on);
-    free(co->stack);
+    dllist_destroy(co->more_awaiting);
+    if (co->cancel_token != NULL) {
+        async_cancel_token_unbind(co->cancel_token);
+        async_cancel_token_release(co->cancel_token);
+    }
+    stack_pool_release(_coro_current_stack_pool(), co->stack, co->stack_size);
     free(co);
 }
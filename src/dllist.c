@@ -41,6 +41,20 @@ int dllist_push_back(dllist_t *list, void *value) {
     return 0;
 }
 
+void *dllist_pop_front(dllist_t *list) {
+    dllist_element_t *head = list->head;
+    if (head == NULL) return NULL;
+    void *value = head->value;
+    list->head = head->next;
+    if (list->head) {
+        list->head->previous = NULL;
+    } else {
+        list->tail = NULL;
+    }
+    free(head);
+    return value;
+}
+
 void dllist_iterate_with_args(dllist_t *list, dllist_iterator_with_args_callback_t cb, void *args) {
     for (dllist_element_t *cur = list->head; cur != NULL; cur = cur->next) {
         if (cb(cur, cur->value, args) != ITERATION_CONTINUE) break;
@@ -1,20 +1,38 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 #include "funcs.h"
+#include "cancel.h"
 #include "logging.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
 #include <string.h>
+#include <signal.h>
+#include <sys/pidfd.h>
+#include <sys/wait.h>
+#include <threads.h>
+#include <unistd.h>
 
-struct async_spawn_args {
-    char *command;
-};
+#define SPAWN_READ_CHUNK 4096
+// How often the exit status is polled for when the kernel has no pidfd
+#define SPAWN_EXIT_POLL_NS (1000 * 1000)
 
-void async_spawn_free_args(struct async_spawn_args *args) {
-    if (args == NULL) return;
-    free(args->command);
-    free(args);
-}
+extern char **environ;
+
+struct async_process {
+    pid_t pid;
+    // Whether the child leads a process group of its own
+    int has_group;
+    // Readable once the child has exited, -1 if pidfds are not supported
+    int pidfd;
+    int has_exited;
+    int status;
+    // Our ends of the pipes asked for, -1 for streams the child inherited
+    int stdin_fd;
+    int stdout_fd;
+    int stderr_fd;
+};
 
 void async_spawn_free_result(void *_result) {
     async_spawn_result_t *result = (async_spawn_result_t *) _result;
@@ -23,102 +41,385 @@ void async_spawn_free_result(void *_result) {
     free(result);
 }
 
-void _spawn(future_t *f, void *_arg) {
-    struct async_spawn_args *arg = (struct async_spawn_args *) _arg;
-    async_spawn_result_t *result = malloc(sizeof(async_spawn_result_t));
-    if (result == NULL) {
-        errorf("failed to allocate memory for async_spawn() result\n");
-        async_spawn_free_args(arg);
-        future_reject(f);
-        return;
+static void _close_pipe(int pipe_fds[2]) {
+    if (pipe_fds[0] >= 0) close(pipe_fds[0]);
+    if (pipe_fds[1] >= 0) close(pipe_fds[1]);
+}
+
+// Creates a pipe for child_fd if it was asked for. Only the end kept here is
+// non-blocking, the child gets a regular pipe
+static int _process_pipe(int pipe_fds[2], int wanted, int child_fd) {
+    pipe_fds[0] = pipe_fds[1] = -1;
+    if (!wanted) return 0;
+    if (pipe2(pipe_fds, O_CLOEXEC) != 0) {
+        errorf("failed to create pipe for child process: '%s'\n", strerror(errno));
+        return -1;
     }
+    int ours = child_fd == STDIN_FILENO ? pipe_fds[1] : pipe_fds[0];
+    if (fcntl(ours, F_SETFL, O_NONBLOCK) != 0) {
+        errorf("failed to make pipe for child process non-blocking: '%s'\n", strerror(errno));
+        _close_pipe(pipe_fds);
+        return -1;
+    }
+    return 0;
+}
+
+static once_flag _process_sigpipe_once = ONCE_FLAG_INIT;
+static int _process_ignored_sigpipe = 0;
 
-    FILE *pipe = popen(arg->command, "r");
-    async_spawn_free_args(arg);
-    if (!pipe) {
-        errorf("failed to start process in async_spawn()\n");
-        free(result);
-        future_reject(f);
+// A child that closed its stdin would otherwise kill the whole process with
+// SIGPIPE on the next write to it. Unless the application handles the signal
+// itself, it is ignored for good, so such writes fail with EPIPE instead
+static void _process_ignore_sigpipe() {
+    struct sigaction action;
+    if (sigaction(SIGPIPE, NULL, &action) != 0 || (action.sa_flags & SA_SIGINFO) || action.sa_handler != SIG_DFL) {
         return;
     }
+    action.sa_handler = SIG_IGN;
+    _process_ignored_sigpipe = sigaction(SIGPIPE, &action, NULL) == 0;
+}
+
+// Starts command through the shell like popen() would, with the streams in
+// options going to non-blocking pipes. Nothing in the loop blocks on the
+// child after this
+static int _process_start(const char *command, int options, async_process_t *p) {
+    int pipes[3][2];
+    int child_fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    int wanted[3] = { options & ASYNC_PROC_OPT_STDIN, options & ASYNC_PROC_OPT_STDOUT, options & ASYNC_PROC_OPT_STDERR };
+    int error = 0;
+    call_once(&_process_sigpipe_once, _process_ignore_sigpipe);
+    for (size_t i = 0; i < 3; i++) {
+        if (_process_pipe(pipes[i], wanted[i], child_fds[i]) != 0) {
+            while (i-- > 0) _close_pipe(pipes[i]);
+            return -1;
+        }
+    }
+
+    posix_spawn_file_actions_t actions;
+    error = posix_spawn_file_actions_init(&actions);
+    if (error == 0) {
+        for (size_t i = 0; i < 3 && error == 0; i++) {
+            if (!wanted[i]) continue;
+            int theirs = child_fds[i] == STDIN_FILENO ? pipes[i][0] : pipes[i][1];
+            error = posix_spawn_file_actions_adddup2(&actions, theirs, child_fds[i]);
+        }
+        // A process group of its own lets a cancelled caller kill whatever
+        // the shell started along with the shell
+        posix_spawnattr_t attr;
+        if (error == 0) error = posix_spawnattr_init(&attr);
+        if (error == 0) {
+            short flags = 0;
+            if (options & ASYNC_PROC_OPT_PROCESS_GROUP) {
+                flags |= POSIX_SPAWN_SETPGROUP;
+                error = posix_spawnattr_setpgroup(&attr, 0);
+            }
+            // An ignored signal stays ignored across exec, and the child
+            // should die of SIGPIPE like any other process
+            if (error == 0 && _process_ignored_sigpipe) {
+                sigset_t sigpipe;
+                sigemptyset(&sigpipe);
+                sigaddset(&sigpipe, SIGPIPE);
+                flags |= POSIX_SPAWN_SETSIGDEF;
+                error = posix_spawnattr_setsigdefault(&attr, &sigpipe);
+            }
+            if (error == 0) error = posix_spawnattr_setflags(&attr, flags);
+            if (error == 0) {
+                char *argv[] = { "sh", "-c", (char*) command, NULL };
+                error = posix_spawn(&p->pid, "/bin/sh", &actions, &attr, argv, environ);
+            }
+            posix_spawnattr_destroy(&attr);
+        }
+        posix_spawn_file_actions_destroy(&actions);
+    }
+    // The child's ends only live on in the child
+    for (size_t i = 0; i < 3; i++) {
+        int theirs = child_fds[i] == STDIN_FILENO ? 0 : 1;
+        if (pipes[i][theirs] >= 0) close(pipes[i][theirs]);
+        pipes[i][theirs] = -1;
+    }
+    if (error != 0) {
+        errorf("failed to start process '%s': '%s'\n", command, strerror(error));
+        for (size_t i = 0; i < 3; i++) _close_pipe(pipes[i]);
+        return -1;
+    }
 
+    p->stdin_fd = pipes[0][1];
+    p->stdout_fd = pipes[1][0];
+    p->stderr_fd = pipes[2][0];
+    p->has_group = (options & ASYNC_PROC_OPT_PROCESS_GROUP) != 0;
+    p->has_exited = 0;
+    p->status = 0;
+    p->pidfd = pidfd_open(p->pid, 0);
+    if (p->pidfd < 0) {
+        debugf("no pidfd for process %d, polling for its exit instead: '%s'\n", p->pid, strerror(errno));
+    }
+    return 0;
+}
+
+// Reads up to size bytes, suspending the coroutine until some are available.
+// Returns 0 at end of file
+static ssize_t _process_read(int fd, char *buffer, size_t size) {
+    while (1) {
+        ssize_t n = read(fd, buffer, size);
+        if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            return n;
+        }
+        if (errno != EINTR && async_await_fd(fd, POLLIN) < 0) {
+            return -1;
+        }
+    }
+}
+
+static void _process_close(int *fd) {
+    if (*fd < 0) return;
+    if (async_context_get_current() != NULL) async_forget_fd(*fd);
+    close(*fd);
+    *fd = -1;
+}
+
+// Returns the wait status of the child once it has exited
+static int _process_wait(async_process_t *p) {
+    if (p->has_exited) {
+        return p->status;
+    }
+
+    int status = 0;
+    pid_t reaped;
+    async_cancel_token_t *shielded = NULL;
+    while ((reaped = waitpid(p->pid, &status, WNOHANG)) == 0) {
+        if (shielded == NULL && async_is_cancelled()) {
+            // Nobody is going to wait for the child any more, and a killed
+            // one is gone right away. It still has to be reaped, without
+            // blocking the loop, so the awaits below must not give up
+            kill(p->has_group ? -p->pid : p->pid, SIGKILL);
+            shielded = async_cancel_shield();
+        }
+        if (p->pidfd >= 0) {
+            if (async_await_fd(p->pidfd, POLLIN) < 0 && errno != ECANCELED) {
+                errorf("failed to await exit of process %d, polling for it instead\n", p->pid);
+                _process_close(&p->pidfd);
+            }
+        } else {
+            async_sleep(SPAWN_EXIT_POLL_NS);
+        }
+    }
+    async_cancel_unshield(shielded);
+    _process_close(&p->pidfd);
+    if (reaped < 0) {
+        errorf("failed to wait for process %d: '%s'\n", p->pid, strerror(errno));
+        return -1;
+    }
+    p->has_exited = 1;
+    p->status = status;
+    return status;
+}
+
+struct spawn_args {
+    future_t *future;
+    char *command;
+    int options;
+};
+
+static async_spawn_result_t *_spawn_collect(async_process_t *p) {
     char *buffer = NULL;
     size_t capacity = 0;
     size_t used = 0;
-
-    const size_t chunk = 4096;
+    int failed = 0;
     while (1) {
-        if (used + chunk + 1 > capacity) {
-            size_t new_capacity = capacity == 0 ? (chunk + 1) : (2 * capacity);
+        if (used + SPAWN_READ_CHUNK + 1 > capacity) {
+            size_t new_capacity = capacity == 0 ? (SPAWN_READ_CHUNK + 1) : (2 * capacity);
             char *new_buf = realloc(buffer, new_capacity);
             if (!new_buf) {
                 errorf("failed to allocate memory for async_spawn() result\n");
-                free(buffer);
-                pclose(pipe);
-                free(result);
-                future_reject(f);
-                return;
+                failed = 1;
+                break;
             }
             buffer = new_buf;
             capacity = new_capacity;
         }
 
-        size_t n = fread(buffer + used, 1, chunk, pipe);
-        used += n;
-
-        if (n < chunk) {
-            if (ferror(pipe)) {
-                errorf("failed to read from async_spawn() pipe\n");
-                free(buffer);
-                pclose(pipe);
-                free(result);
-                future_reject(f);
-                return;
+        // Fill whatever room there is, a chatty child then costs fewer reads
+        ssize_t n = _process_read(p->stdout_fd, buffer + used, capacity - used - 1);
+        if (n < 0) {
+            if (errno != ECANCELED) {
+                errorf("failed to read from async_spawn() pipe: '%s'\n", strerror(errno));
             }
-            // n < chunk and !ferror -> EOF
+            failed = 1;
             break;
         }
+        if (n == 0) break;
+        used += n;
     }
+    // Closing first lets a child that is still writing die of SIGPIPE
+    // instead of blocking forever
+    _process_close(&p->stdout_fd);
+    int status = _process_wait(p);
 
-    // NUL-terminate
-    if (buffer == NULL) {
-        // no output at all: still return a valid empty string
-        buffer = malloc(1);
-        if (!buffer) {
-            errorf("failed to allocate memory for async_spawn() result\n");
-            pclose(pipe);
-            free(result);
-            future_reject(f);
-            return;
-        }
-        buffer[0] = '\0';
-    } else {
-        buffer[used] = '\0';
-    }
-
-    result->status = pclose(pipe);
-
-    if (result->status != 0) {
+    async_spawn_result_t *result = failed || status != 0 ? NULL : malloc(sizeof(async_spawn_result_t));
+    if (result == NULL) {
         free(buffer);
-        free(result);
-        future_reject(f);
-        return;
+        return NULL;
     }
-
+    buffer[used] = '\0';
     result->stdout = buffer;
-    future_resolve(f, result, async_spawn_free_result);
-    return;
+    result->status = status;
+    return result;
+}
+
+void *_spawn(void *_arg) {
+    struct spawn_args *arg = (struct spawn_args*) _arg;
+    async_process_t p;
+    async_spawn_result_t *result = NULL;
+    // Not even started when cancelled early enough
+    if (!async_is_cancelled() && _process_start(arg->command, arg->options, &p) == 0) {
+        result = _spawn_collect(&p);
+    }
+    if (result == NULL) {
+        future_reject(arg->future);
+    } else {
+        future_resolve(arg->future, result, async_spawn_free_result);
+    }
+    future_destroy(arg->future);
+    free(arg->command);
+    free(arg);
+    return NULL;
 }
 
 future_t *async_spawn(const char *command) {
-    struct async_spawn_args *spawn_args = malloc(sizeof(struct async_spawn_args)); 
+    return async_spawn_with_options(command, 0);
+}
+
+future_t *async_spawn_with_options(const char *command, int options) {
+    async_context_t *current_async_ctx = async_context_get_current();
+    if (current_async_ctx == NULL) {
+        errorf("running coroutine outside async context\n");
+        abort();
+    }
+    struct spawn_args *spawn_args = malloc(sizeof(struct spawn_args));
     if (spawn_args == NULL) {
         errorf("failed to allocate memory for async_spawn()\n");
         return NULL;
     }
-    char *command_copy = strdup(command);
-    *spawn_args = (struct async_spawn_args){
-        .command = command_copy
+    *spawn_args = (struct spawn_args){
+        .future = future_create(0),
+        .command = strdup(command),
+        .options = ASYNC_PROC_OPT_STDOUT | (options & ASYNC_PROC_OPT_PROCESS_GROUP)
     };
-    return async_dispatch(_spawn, spawn_args);
+    async_cancel_token_t *token = async_cancel_token_create(async_get_cancel_token());
+    if (spawn_args->future == NULL || spawn_args->command == NULL || token == NULL) {
+        errorf("failed to allocate memory for async_spawn()\n");
+        future_destroy(spawn_args->future);
+        async_cancel_token_release(token);
+        free(spawn_args->command);
+        free(spawn_args);
+        return NULL;
+    }
+    future_t *result = spawn_args->future;
+    future_set_state(result, FUTURE_PENDING);
+    // Cancelling the future kills the child
+    future_set_cancel_token(result, token);
+
+    // The child is driven by a coroutine on this loop instead of a thread:
+    // its output and its exit are both awaited as file descriptors
+    coroutine_t *co = coro_create(_spawn, spawn_args, 0);
+    if (co == NULL) {
+        errorf("failed to schedule coroutine for async_spawn()\n");
+        future_set_state(result, FUTURE_REJECTED);
+        future_destroy(result);
+        free(spawn_args->command);
+        free(spawn_args);
+        return NULL;
+    }
+    async_cancel_token_bind(token, co);
+    // Dropped by the coroutine once it has settled the future
+    future_retain(result);
+    if (async_schedule_coroutine(current_async_ctx, co) != 0) {
+        errorf("failed to schedule coroutine for async_spawn()\n");
+        coro_destroy(co);
+        future_set_state(result, FUTURE_REJECTED);
+        future_destroy(result);
+        future_destroy(result);
+        free(spawn_args->command);
+        free(spawn_args);
+        return NULL;
+    }
+    return result;
+}
+
+async_process_t *async_process_start(const char *command, int options) {
+    async_process_t *p = malloc(sizeof(async_process_t));
+    if (p == NULL) {
+        errorf("failed to allocate memory for a child process\n");
+        return NULL;
+    }
+    if (_process_start(command, options, p) != 0) {
+        free(p);
+        return NULL;
+    }
+    return p;
+}
+
+ssize_t async_process_read_stdout(async_process_t *p, void *buffer, size_t size) {
+    if (p->stdout_fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    return _process_read(p->stdout_fd, buffer, size);
+}
+
+ssize_t async_process_read_stderr(async_process_t *p, void *buffer, size_t size) {
+    if (p->stderr_fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    return _process_read(p->stderr_fd, buffer, size);
+}
+
+ssize_t async_process_write_stdin(async_process_t *p, const void *buffer, size_t size) {
+    if (p->stdin_fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    size_t written = 0;
+    while (written < size) {
+        ssize_t n = write(p->stdin_fd, (const char*) buffer + written, size - written);
+        if (n >= 0) {
+            written += n;
+            continue;
+        }
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return -1;
+        }
+        // The pipe is full, so wait for the child to catch up
+        if (async_await_fd(p->stdin_fd, POLLOUT) < 0) {
+            return -1;
+        }
+    }
+    return (ssize_t) written;
+}
+
+void async_process_close_stdin(async_process_t *p) {
+    _process_close(&p->stdin_fd);
+}
+
+int async_process_wait(async_process_t *p) {
+    return _process_wait(p);
+}
+
+void async_process_destroy(async_process_t *p) {
+    if (p == NULL) return;
+    // Closing the pipes first lets a child that still uses them finish
+    _process_close(&p->stdin_fd);
+    _process_close(&p->stdout_fd);
+    _process_close(&p->stderr_fd);
+    async_context_t *ctx = async_context_get_current();
+    if (ctx != NULL && async_context_get_current_coroutine(ctx) != NULL) {
+        _process_wait(p);
+    } else if (!p->has_exited) {
+        // Nothing to suspend outside of a coroutine, so this blocks
+        while (waitpid(p->pid, &p->status, 0) < 0 && errno == EINTR);
+        _process_close(&p->pidfd);
+    }
+    free(p);
 }
@@ -1,85 +1,184 @@
 #include "future.h"
 #include "async.h"
+#include "cancel.h"
 #include "logging.h"
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <threads.h>
 
+// The state and a lock bit for the waiter list share one atomic word. Reading
+// the state, starting, and reading a settled value never take the lock, and
+// settling publishes the value and the final state in a single release store
+#define FUTURE_STATE_MASK 0x3u
+#define FUTURE_WAITERS_LOCKED 0x4u
+// Kept next to FUTURE_REJECTED when that came from future_cancel()
+#define FUTURE_CANCELLED 0x8u
+#define FUTURE_SPINS_BEFORE_YIELD 64
+
+// Runs on whichever thread settles the future, after it has settled. The
+// future itself may already be destroyed by then, so the callback gets the
+// outcome instead
+typedef struct future_callback future_callback_t;
+struct future_callback {
+    ilist_node_t link;
+    void (*func)(future_callback_t *, future_state_e state, void *value);
+};
+
 struct future {
     async_context_t *ctx;
+    // Only created once the future is started, from func and the rest. A
+    // future nobody starts never gets a stack
     coroutine_t *coroutine;
+    coroutine_function_t func;
+    void *arg;
+    size_t stack_size;
+    int coro_options;
 
     void *value;
     void (*free_value)(void *);
 
-    future_state_e state;
-    dllist_t *waited_on_by;
-
-    int is_taken, is_locked;
-    mtx_t lock;
+    atomic_uint word;
+    // Coroutines awaiting this future, linked through their wait link and
+    // only touched with FUTURE_WAITERS_LOCKED set
+    ilist_t waited_on_by;
+    // future_callback_t nodes, under the same lock
+    ilist_t callbacks;
+
+    atomic_int is_taken;
+    // One for whoever created the future, and one for anything that settles
+    // it later, like its coroutine, a timer or a dispatched function
+    atomic_uint refs;
+    // Cancelled along with the future, NULL when nothing runs on its behalf
+    async_cancel_token_t *cancel_token;
+    // Called by future_cancel() instead of settling the future
+    void (*stop)(future_t *, void *arg);
+    void *stop_arg;
 };
 
-iteration_result_e _future_notify_waiting_iterator_helper(dllist_element_t *, void *value, void *awaitable) {
-    coro_remove_waiting((coroutine_t*) value, *(awaitable_t*) awaitable);
-    return ITERATION_CONTINUE;
+static future_state_e _future_state_of(unsigned word) {
+    return (future_state_e) (word & FUTURE_STATE_MASK);
 }
 
-void _future_notify_waiting(future_t *f) {
-    awaitable_t awaitable = AWAITABLE_FUTURE(f);
-    dllist_iterate_with_args(f->waited_on_by, _future_notify_waiting_iterator_helper, &awaitable);
+static int _future_is_settled(future_state_e state) {
+    return state == FUTURE_RESOLVED || state == FUTURE_REJECTED;
 }
 
-struct coroutine_future_wrapper_args {
-    void *original_arg;
-    future_t *future;
-    coroutine_function_t original_func;
-};
-
-void *_coroutine_future_wrapper(void *_arg) {
-    struct coroutine_future_wrapper_args *arg = (struct coroutine_future_wrapper_args*) _arg;
-    void *result = arg->original_func(arg->original_arg);
-
-    // Update the future after the coroutine has finished
-    arg->future->value = result;
-    arg->future->state = FUTURE_RESOLVED;
-    arg->future->coroutine = NULL;
-
-    // Notify all coroutines awaiting this future
-    _future_notify_waiting(arg->future);
-
-    free(arg);
+// Returns the state the future was in when the lock was taken
+static future_state_e _future_waiters_lock(future_t *f) {
+    unsigned spins = 0;
+    while (1) {
+        unsigned word = atomic_load_explicit(&f->word, memory_order_relaxed);
+        if (!(word & FUTURE_WAITERS_LOCKED) && atomic_compare_exchange_weak_explicit(
+                &f->word, &word, word | FUTURE_WAITERS_LOCKED,
+                memory_order_acquire, memory_order_relaxed)) {
+            return _future_state_of(word);
+        }
+        // The lock is only held for a few instructions, but its holder may
+        // have been preempted
+        if (++spins % FUTURE_SPINS_BEFORE_YIELD == 0) {
+            thrd_yield();
+        } else {
+            __builtin_ia32_pause();
+        }
+    }
+}
 
-    return result;
+static void _future_waiters_unlock(future_t *f) {
+    atomic_fetch_and_explicit(&f->word, ~FUTURE_WAITERS_LOCKED, memory_order_release);
 }
 
-struct future_all_wrapper_args {
-    future_t **arr;
-    size_t size;
-};
+static void _future_notify_waiting(future_t *f, ilist_t *waiters, int is_finishing) {
+    awaitable_t awaitable = AWAITABLE_FUTURE(f);
+    coroutine_t *co = NULL;
+    int is_single = ilist_is_singular(waiters);
+    // Unlinking first leaves each coroutine free to await something else
+    // as soon as it is woken up
+    while ((co = coro_from_wait_link(ilist_pop_front(waiters))) != NULL) {
+        async_context_t *owner = coro_get_context(co);
+        if (is_single && is_finishing && owner == async_context_get_current()) {
+            // The future's coroutine is about to return and can switch to
+            // its only waiter directly
+            async_context_set_handoff(owner, co);
+        }
+        if (owner != async_context_get_current()) {
+            // The waiting coroutine lives on a loop in another thread, so let
+            // that loop do the bookkeeping
+            if (async_post_wakeup(owner, co, awaitable) != 0) {
+                errorf("failed to post wakeup for coroutine at %p\n", co);
+                abort();
+            }
+            continue;
+        }
+        coro_remove_waiting(co, awaitable);
+    }
+}
 
-void *_future_all_wrapper(void *_arg) {
-    struct future_all_wrapper_args *arg = (struct future_all_wrapper_args*) _arg;
+// Moves a pending future to its final state, or a new one too when it is
+// cancelled. Returns 0 if it was already settled, and otherwise stores the
+// state it was in to from, if given
+static int _future_settle(future_t *f, future_state_e state, void *value, free_function_t free_value,
+        int is_cancelled, future_state_e *from) {
+    future_state_e previous = _future_waiters_lock(f);
+    if (previous != FUTURE_PENDING && !(is_cancelled && previous == FUTURE_NEW)) {
+        _future_waiters_unlock(f);
+        return 0;
+    }
+    if (from != NULL) *from = previous;
+    if (state == FUTURE_RESOLVED) {
+        f->value = value;
+        f->free_value = free_value;
+    }
+    async_context_t *ctx = async_context_get_current();
+    int is_finishing = f->coroutine != NULL && ctx != NULL && f->coroutine == async_context_get_current_coroutine(ctx);
+    ilist_t waiters, callbacks;
+    ilist_move(&waiters, &f->waited_on_by);
+    ilist_move(&callbacks, &f->callbacks);
+    // Publishes the value and unlocks at once. Whoever sees the new state may
+    // destroy the future straight away, so it isn't touched after this
+    atomic_store_explicit(&f->word, state | (is_cancelled ? FUTURE_CANCELLED : 0), memory_order_release);
+    _future_notify_waiting(f, &waiters, is_finishing);
+    ilist_node_t *node = NULL;
+    while ((node = ilist_pop_front(&callbacks)) != NULL) {
+        future_callback_t *cb = ilist_entry(node, future_callback_t, link);
+        cb->func(cb, state, value);
+    }
+    return 1;
+}
 
-    future_sized_array_t *result = malloc(sizeof(future_sized_array_t));
-    if (result == NULL) {
-        errorf("failed to allocate memory for future_all_result_t\n");
-        return NULL;
+// Runs cb once f has settled, straight away if it already has
+static void _future_on_settled(future_t *f, future_callback_t *cb) {
+    future_state_e state = _future_waiters_lock(f);
+    if (!_future_is_settled(state)) {
+        ilist_push_back(&f->callbacks, &cb->link);
+        _future_waiters_unlock(f);
+        return;
     }
-    result->future_arr = malloc(sizeof(future_t*) * arg->size);
-    if (result->future_arr == NULL) {
-        free(result);
-        errorf("failed to allocate memory for future_all_result_t\n");
-        return NULL;
+    _future_waiters_unlock(f);
+    cb->func(cb, state, f->value);
+}
+
+void *_coroutine_future_wrapper(void *_f) {
+    future_t *f = (future_t*) _f;
+    void *result = NULL;
+    // A future cancelled before its coroutine got to run only gives its
+    // stack back, unless the function has to report being stopped itself
+    if (f->stop != NULL || !async_is_cancelled()) {
+        result = f->func(f->arg);
     }
-    result->n = arg->size;
 
-    for (size_t i = 0; i < arg->size; i++) {
-        debugf("awaiting future at %p (state=%d)\n", arg->arr[i], arg->arr[i]->state);
-        async_await_future(arg->arr[i]);
-        result->future_arr[i] = arg->arr[i];
+    // Update the future after the coroutine has finished, which also
+    // notifies all coroutines awaiting it
+    // free_value may have been set by whoever created the future before it
+    // was started
+    if (!_future_settle(f, FUTURE_RESOLVED, result, f->free_value, 0, NULL) && result != NULL && f->free_value != NULL) {
+        // Cancelled while running, nobody is going to see the result
+        f->free_value(result);
+        result = NULL;
     }
 
-    free(arg);
+    future_destroy(f);
+
     return result;
 }
 
@@ -100,22 +199,6 @@ void _future_all_free_result_simple(void *_result) {
     free(result);
 }
 
-void _future_lock_guard_begin(future_t *f) {
-    if (!f->is_locked) return;
-    if (mtx_lock(&f->lock) != thrd_success) {
-        errorf("failed to release lock for future at %p\n", f);
-        abort();
-    }
-}
-
-void _future_lock_guard_end(future_t *f) {
-    if (!f->is_locked) return;
-    if (mtx_unlock(&f->lock) != thrd_success) {
-        errorf("failed to release lock for future at %p\n", f);
-        abort();
-    }
-}
-
 future_t *future_create(int options) {
     future_t *result = malloc(sizeof(future_t));
     if (result == NULL) {
@@ -127,37 +210,27 @@ future_t *future_create(int options) {
         warnf("a future created with future_create() cannot be eager\n");
     }
 
-    int thread_protected = options & FUT_OPT_THREADED;
     *result = (future_t){
         .ctx = async_context_get_current(),
         .coroutine = NULL,
-        .waited_on_by = dllist_create(NULL),
-        .state = FUTURE_NEW,
         .value = NULL,
-        .free_value = NULL,
-        .is_locked = thread_protected ? 1 : 0,
-        .is_taken = 0
+        .free_value = NULL
     };
-
-    if (result->waited_on_by == NULL) {
-        errorf("failed to allocate memory for a future\n");
-        free(result);        
-        return NULL;
-    }
-
-    if (thread_protected) {
-        if (mtx_init(&result->lock, mtx_plain) != thrd_success) {
-            errorf("error creating lock for future\n");
-            result->is_locked = 0;
-            future_destroy(result);
-            return NULL;
-        }
-    }
+    atomic_init(&result->word, FUTURE_NEW);
+    atomic_init(&result->is_taken, 0);
+    atomic_init(&result->refs, 1);
+    result->cancel_token = NULL;
+    ilist_init(&result->waited_on_by);
+    ilist_init(&result->callbacks);
 
     return result;
 }
 
 future_t *future_create_from_function(coroutine_function_t func, void *arg, int options) {
+    return future_create_from_function_with_stack_size(func, arg, options, 0);
+}
+
+future_t *future_create_from_function_with_stack_size(coroutine_function_t func, void *arg, int options, size_t stack_size) {
     async_context_t *current_async_ctx = async_context_get_current();
     if (current_async_ctx == NULL) {
         errorf("running coroutine outside async context\n");
@@ -175,178 +248,472 @@ future_t *future_create_from_function(coroutine_function_t func, void *arg, int
         return NULL;
     }
 
-    dllist_t *waited_on_by = dllist_create(NULL);
-    if (waited_on_by == NULL) {
-        errorf("failed to allocate memory for a future\n");
+    // Whatever this future's coroutine starts is cancelled along with it. The
+    // token is made now, so that its parent is the creator's one
+    async_cancel_token_t *token = async_cancel_token_create(async_get_cancel_token());
+    if (token == NULL) {
         free(result);
         return NULL;
     }
 
-    struct coroutine_future_wrapper_args *wrapper_arg = malloc(sizeof(struct coroutine_future_wrapper_args));
-    if (wrapper_arg == NULL) {
-        errorf("failed to allocate memory for a future\n");
-        dllist_destroy(waited_on_by);
-        free(result);
-        return NULL;
+    *result = (future_t){
+        .ctx = current_async_ctx,
+        .coroutine = NULL,
+        .func = func,
+        .arg = arg,
+        .stack_size = stack_size,
+        .coro_options = (options & FUT_OPT_SMALL_STACK) ? CORO_OPT_SMALL_STACK : 0,
+        .value = NULL,
+        .free_value = NULL,
+        .cancel_token = token
+    };
+    atomic_init(&result->word, FUTURE_NEW);
+    atomic_init(&result->is_taken, 0);
+    // The coroutine drops its reference once it has settled the future
+    atomic_init(&result->refs, 2);
+    ilist_init(&result->waited_on_by);
+    ilist_init(&result->callbacks);
+
+    // Start an eager future only once it is fully set up, since another
+    // worker may start running it. If that fails the future is rejected, and
+    // still the caller's to await and destroy
+    if (options & FUT_OPT_EAGER) {
+        future_start(result);
     }
 
-    *wrapper_arg = (struct coroutine_future_wrapper_args){
-        .future = result,
-        .original_arg = arg,
-        .original_func = func
-    };
+    return result;
+}
 
-    // Create a new coroutine for the given function
-    coroutine_t *new_co = coro_create(_coroutine_future_wrapper, wrapper_arg, 0);
-    if (new_co == NULL) {
-        errorf("failed create coroutine new coroutine to await\n");
-        dllist_destroy(waited_on_by);
-        free(result);
+// Creates the coroutine of a future that is being started, on the stack
+// pool of the thread starting it. Rejects the future if that fails
+static coroutine_t *_future_materialize(future_t *f) {
+    coroutine_t *co = coro_create_with_stack_size(_coroutine_future_wrapper, f, f->coro_options, f->stack_size);
+    if (co == NULL) {
+        errorf("failed to create coroutine for future at %p\n", f);
+        future_reject(f);
+        // The reference the coroutine would have dropped
+        future_destroy(f);
         return NULL;
     }
+    async_cancel_token_bind(f->cancel_token, co);
+    f->coroutine = co;
+    return co;
+}
 
-    // Add future coroutine to schedule if specified as eager
-    int eager = options & FUT_OPT_EAGER;
-    if (eager) {
-        if (async_schedule_coroutine(current_async_ctx, new_co)) {
-            errorf("failed to add coroutine at %p to scheduled queue\n");
-            dllist_destroy(waited_on_by);
-            free(result);
-            coro_destroy(new_co);
-            return NULL;
-        }
+// Only one caller gets to move the future out of FUTURE_NEW, and with it run
+// the coroutine
+static int _future_try_claim(future_t *f) {
+    if (f->func == NULL) {
+        // Nothing to run, the future is settled by someone else
+        return 0;
     }
+    unsigned word = atomic_load_explicit(&f->word, memory_order_relaxed);
+    do {
+        if (_future_state_of(word) != FUTURE_NEW) return 0;
+        // Never while locked, future_cancel() may be settling it
+        word &= ~FUTURE_WAITERS_LOCKED;
+    } while (!atomic_compare_exchange_weak_explicit(
+        &f->word, &word, (word & ~FUTURE_STATE_MASK) | FUTURE_PENDING,
+        memory_order_acq_rel, memory_order_relaxed));
+    return 1;
+}
 
-    *result = (future_t){
-        .ctx = current_async_ctx,
-        .coroutine = new_co,
-        .waited_on_by = waited_on_by,
-        .state = eager ? FUTURE_PENDING : FUTURE_NEW,
-        .value = NULL,
-        .free_value = NULL,
-        .is_locked = 0,
-        .is_taken = 0
-    };
-
-    return result;
+coroutine_t *future_claim(future_t *f) {
+    if (!_future_try_claim(f)) return NULL;
+    return _future_materialize(f);
 }
 
 int future_start(future_t *f) {
-    if (f->coroutine == NULL) return 0;
-    return async_schedule_coroutine(f->ctx, f->coroutine);
+    if (!_future_try_claim(f)) return 0;
+    coroutine_t *co = _future_materialize(f);
+    // Rejected already, so whoever awaits it is woken up rather than parked
+    if (co == NULL) return -1;
+    return async_schedule_coroutine(f->ctx, co);
 }
 
 int future_add_waiting(future_t *waited, coroutine_t *waiting) {
-    _future_lock_guard_begin(waited);
-    if (dllist_push_back(waited->waited_on_by, waiting) != 0) {
-        _future_lock_guard_end(waited);
+    // Settling takes the same lock, so the future can't settle between this
+    // check and the coroutine joining the waiter list
+    if (_future_is_settled(_future_waiters_lock(waited))) {
+        // Settled since the caller last checked, there is nothing to wait for
+        _future_waiters_unlock(waited);
+        return 1;
+    }
+    ilist_node_t *link = coro_get_wait_link(waiting);
+    if (ilist_node_is_linked(link)) {
+        _future_waiters_unlock(waited);
+        errorf("coroutine at %p is already awaiting another future\n", waiting);
         return -1;
     }
-    _future_lock_guard_end(waited);
+    ilist_push_back(&waited->waited_on_by, link);
+    _future_waiters_unlock(waited);
     coro_add_waiting(waiting, AWAITABLE_FUTURE(waited));
     return 0;
 }
 
+int future_remove_waiting(future_t *waited, coroutine_t *waiting) {
+    // Once settled, the waiter list belongs to whoever settled it, and a
+    // wakeup for the coroutine is on its way
+    if (_future_is_settled(_future_waiters_lock(waited))) {
+        _future_waiters_unlock(waited);
+        return 0;
+    }
+    ilist_node_t *link = coro_get_wait_link(waiting);
+    int was_waiting = ilist_node_is_linked(link);
+    if (was_waiting) {
+        ilist_remove(link);
+    }
+    _future_waiters_unlock(waited);
+    return was_waiting;
+}
+
 void *future_borrow_return_value(future_t *f) {
-    _future_lock_guard_begin(f);
-    void *value = f->value;
-    _future_lock_guard_end(f);
-    return value;
+    // Only meaningful once settled, and the acquire in future_get_state() is
+    // what makes the value visible
+    return f->value;
 }
 
 void *future_take_return_value(future_t *f) {
-    _future_lock_guard_begin(f);
-    if (f->is_taken) {
+    if (atomic_exchange_explicit(&f->is_taken, 1, memory_order_relaxed)) {
         errorf("tried to take the value of future %p when it was already taken\n", f);
         return NULL;
     }
-    void *value = f->value;
-    f->is_taken = 1;
-    _future_lock_guard_end(f);
-    return value;
+    return f->value;
 }
 
 free_function_t future_get_free_result_func(future_t *f) {
-    _future_lock_guard_begin(f);
-    free_function_t result = f->free_value;
-    _future_lock_guard_end(f);
-    return result;
+    return f->free_value;
 }
 
 future_state_e future_get_state(future_t *f) {
-    _future_lock_guard_begin(f);
-    future_state_e state = f->state;
-    _future_lock_guard_end(f);
-    return state;
+    return _future_state_of(atomic_load_explicit(&f->word, memory_order_acquire));
 }
 
 void future_set_state(future_t *f, future_state_e state) {
-    _future_lock_guard_begin(f);
-    f->state = state;
-    _future_lock_guard_end(f);
+    unsigned word = atomic_load_explicit(&f->word, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(
+        &f->word, &word, (word & ~FUTURE_STATE_MASK) | state,
+        memory_order_acq_rel, memory_order_relaxed));
+}
+
+int future_is_cancelled(future_t *f) {
+    return (atomic_load_explicit(&f->word, memory_order_acquire) & FUTURE_CANCELLED) != 0;
 }
 
 void future_resolve(future_t *f, void *result, free_function_t free_result) {
-    _future_lock_guard_begin(f);
-    if (f->state != FUTURE_PENDING) {
-        _future_lock_guard_end(f);
-        return;
+    if (!_future_settle(f, FUTURE_RESOLVED, result, free_result, 0, NULL) && result != NULL && free_result != NULL) {
+        // Cancelled before it could resolve, so the result is nobody's
+        free_result(result);
     }
-    f->state = FUTURE_RESOLVED;
-    f->value = result;
-    f->free_value = free_result;
-    async_signal_scheduler(f->ctx);
-    _future_lock_guard_end(f);
-    _future_notify_waiting(f);
 }
 
 void future_reject(future_t *f) {
-    _future_lock_guard_begin(f);
-    if (f->state != FUTURE_PENDING) {
-        _future_lock_guard_end(f);
+    _future_settle(f, FUTURE_REJECTED, NULL, NULL, 0, NULL);
+}
+
+int future_cancel(future_t *f) {
+    if (f->stop != NULL) {
+        // Settled by the operation itself once it has stopped
+        if (_future_is_settled(future_get_state(f))) return 1;
+        f->stop(f, f->stop_arg);
+        return 0;
+    }
+    future_state_e from;
+    if (!_future_settle(f, FUTURE_REJECTED, NULL, NULL, 1, &from)) {
+        return 1;
+    }
+    if (f->cancel_token != NULL) {
+        async_cancel_token_cancel(f->cancel_token);
+    }
+    if (from == FUTURE_NEW && f->func != NULL) {
+        // Never started, so there is no coroutine to drop its reference
+        future_destroy(f);
+    }
+    return 0;
+}
+
+void future_set_stop_function(future_t *f, void (*stop)(future_t *, void *arg), void *arg) {
+    f->stop = stop;
+    f->stop_arg = arg;
+}
+
+int future_has_stop_function(future_t *f) {
+    return f->stop != NULL;
+}
+
+void future_retain(future_t *f) {
+    atomic_fetch_add_explicit(&f->refs, 1, memory_order_relaxed);
+}
+
+void future_set_cancel_token(future_t *f, async_cancel_token_t *token) {
+    async_cancel_token_release(f->cancel_token);
+    f->cancel_token = token;
+}
+
+async_cancel_token_t *future_get_cancel_token(future_t *f) {
+    return f->cancel_token;
+}
+
+enum future_combinator_kind {
+    COMBINE_ALL,
+    COMBINE_ALL_FAIL_FAST,
+    COMBINE_ANY,
+    COMBINE_RACE
+};
+
+struct future_combinator_input {
+    future_callback_t callback;
+    struct future_combinator *combinator;
+    future_t *future;
+};
+
+// Shared by every input of a combinator and freed by whichever settles last,
+// so no coroutine has to sit awaiting the inputs one by one
+struct future_combinator {
+    future_t *result;
+    future_sized_array_t *members;
+    enum future_combinator_kind kind;
+    int take_futures;
+    // Inputs that have not settled yet, plus one held while setting up
+    atomic_size_t remaining;
+    atomic_size_t n_rejected;
+    // Set by whoever settles the result, which may be destroyed right after
+    atomic_int is_decided;
+    struct future_combinator_input inputs[];
+};
+
+static int _future_combinator_decide(struct future_combinator *c) {
+    return !atomic_exchange_explicit(&c->is_decided, 1, memory_order_acq_rel);
+}
+
+static void _future_combinator_release(struct future_combinator *c) {
+    if (atomic_fetch_sub_explicit(&c->remaining, 1, memory_order_acq_rel) != 1) {
         return;
     }
-    f->state = FUTURE_REJECTED;
-    async_signal_scheduler(f->ctx);
-    _future_lock_guard_end(f);
-    _future_notify_waiting(f);
+    // Every input has settled by now
+    int resolves_with_members = c->kind == COMBINE_ALL || c->kind == COMBINE_ALL_FAIL_FAST;
+    int gave_members = 0;
+    if (_future_combinator_decide(c)) {
+        if (resolves_with_members) {
+            // Unless the result was cancelled in the meantime
+            gave_members = _future_settle(c->result, FUTURE_RESOLVED, c->members,
+                c->take_futures ? _future_all_free_result : _future_all_free_result_simple, 0, NULL);
+        } else {
+            // Nothing resolved a future_any(), or a future_race() had no inputs
+            future_reject(c->result);
+        }
+    }
+    if (!gave_members) {
+        if (c->take_futures) {
+            _future_all_free_result(c->members);
+        } else {
+            _future_all_free_result_simple(c->members);
+        }
+    }
+    future_destroy(c->result);
+    free(c);
 }
 
-future_t *future_all(future_t **future_array, size_t n_members, int take_futures) {
-    struct future_all_wrapper_args *arg = malloc(sizeof(struct future_all_wrapper_args));
-    if (arg == NULL) {
+static void _future_combinator_on_settled(future_callback_t *cb, future_state_e state, void *value) {
+    (void) value;
+    struct future_combinator_input *input = ilist_entry(cb, struct future_combinator_input, callback);
+    struct future_combinator *c = input->combinator;
+    switch (c->kind) {
+    case COMBINE_ALL_FAIL_FAST:
+        if (state == FUTURE_REJECTED && _future_combinator_decide(c)) {
+            future_reject(c->result);
+        }
+        break;
+    case COMBINE_ANY:
+        if (state == FUTURE_RESOLVED) {
+            if (_future_combinator_decide(c)) {
+                future_resolve(c->result, input->future, NULL);
+            }
+        } else if (atomic_fetch_add_explicit(&c->n_rejected, 1, memory_order_relaxed) + 1 == c->members->n &&
+                _future_combinator_decide(c)) {
+            future_reject(c->result);
+        }
+        break;
+    case COMBINE_RACE:
+        if (_future_combinator_decide(c)) {
+            if (state == FUTURE_RESOLVED) {
+                future_resolve(c->result, input->future, NULL);
+            } else {
+                future_reject(c->result);
+            }
+        }
+        break;
+    case COMBINE_ALL:
+        break;
+    }
+    _future_combinator_release(c);
+}
+
+static future_t *_future_combine(future_t **future_array, size_t n_members, enum future_combinator_kind kind, int take_futures) {
+    struct future_combinator *c = malloc(sizeof(struct future_combinator) + n_members * sizeof(struct future_combinator_input));
+    if (c == NULL) {
+        errorf("failed to allocate memory for a future combinator\n");
+        return NULL;
+    }
+    future_sized_array_t *members = malloc(sizeof(future_sized_array_t));
+    if (members == NULL) {
+        errorf("failed to allocate memory for a future combinator\n");
+        free(c);
         return NULL;
     }
+    // Copied, since the caller's array may well be a compound literal
+    members->n = n_members;
+    members->future_arr = malloc(n_members * sizeof(future_t*));
+    if (members->future_arr == NULL && n_members > 0) {
+        errorf("failed to allocate memory for a future combinator\n");
+        free(members);
+        free(c);
+        return NULL;
+    }
+    future_t *result = future_create(0);
+    if (result == NULL) {
+        free(members->future_arr);
+        free(members);
+        free(c);
+        return NULL;
+    }
+    future_set_state(result, FUTURE_PENDING);
+    // Settled by whichever input decides it, after the caller may be done
+    future_retain(result);
+
+    c->result = result;
+    c->members = members;
+    c->kind = kind;
+    c->take_futures = take_futures;
+    atomic_init(&c->remaining, n_members + 1);
+    atomic_init(&c->n_rejected, 0);
+    atomic_init(&c->is_decided, 0);
+    for (size_t i = 0; i < n_members; i++) {
+        members->future_arr[i] = future_array[i];
+        c->inputs[i] = (struct future_combinator_input){
+            .callback = { .func = _future_combinator_on_settled },
+            .combinator = c,
+            .future = future_array[i]
+        };
+    }
 
-    *arg = (struct future_all_wrapper_args){
-        .arr = future_array,
-        .size = n_members,
-    };
+    // Inputs may settle on other threads while this runs, the extra count in
+    // remaining keeps the combinator alive until every callback is in place
+    for (size_t i = 0; i < n_members; i++) {
+        _future_on_settled(future_array[i], &c->inputs[i].callback);
+        if (future_start(future_array[i]) != 0) {
+            errorf("failed to schedule future at %p\n", future_array[i]);
+        }
+    }
+    _future_combinator_release(c);
+    return result;
+}
+
+future_t *future_all(future_t **future_array, size_t n_members, int take_futures) {
+    return _future_combine(future_array, n_members, COMBINE_ALL, take_futures);
+}
+
+future_t *future_all_fail_fast(future_t **future_array, size_t n_members, int take_futures) {
+    return _future_combine(future_array, n_members, COMBINE_ALL_FAIL_FAST, take_futures);
+}
+
+future_t *future_any(future_t **future_array, size_t n_members) {
+    return _future_combine(future_array, n_members, COMBINE_ANY, 0);
+}
 
-    future_t *result = future_create_from_function(_future_all_wrapper, arg, 0);
-    result->free_value = take_futures ? _future_all_free_result : _future_all_free_result_simple;
+future_t *future_race(future_t **future_array, size_t n_members) {
+    return _future_combine(future_array, n_members, COMBINE_RACE, 0);
+}
+
+// Settles its result from the input's callback, on whichever stack settles
+// the input, so nothing but this and the result future is allocated
+struct future_continuation {
+    future_callback_t callback;
+    future_t *input;
+    future_t *result;
+    future_then_function_t then;
+    future_map_function_t map;
+    void *arg;
+    free_function_t free_result;
+};
+
+static void _future_continuation_on_settled(future_callback_t *cb, future_state_e state, void *value) {
+    struct future_continuation *c = ilist_entry(cb, struct future_continuation, callback);
+    if (c->then != NULL) {
+        c->then(c->result, state, value, c->arg);
+    } else if (state != FUTURE_RESOLVED) {
+        future_reject(c->result);
+    } else if (!_future_is_settled(future_get_state(c->result))) {
+        // Skipped when the result was cancelled, nobody would see it
+        future_resolve(c->result, c->map(value, c->arg), c->free_result);
+    }
+    if (!_future_is_settled(future_get_state(c->result))) {
+        errorf("continuation of future at %p left its result pending\n", c->input);
+        future_reject(c->result);
+    }
+    future_destroy(c->result);
+    // Only now, the value was borrowed from it
+    future_destroy(c->input);
+    free(c);
+}
+
+static future_t *_future_continue(future_t *f, future_then_function_t then, future_map_function_t map,
+        void *arg, free_function_t free_result) {
+    struct future_continuation *c = malloc(sizeof(struct future_continuation));
+    if (c == NULL) {
+        errorf("failed to allocate memory for a future continuation\n");
+        return NULL;
+    }
+    future_t *result = future_create(0);
     if (result == NULL) {
-        free(arg);
+        free(c);
         return NULL;
     }
-
+    future_set_state(result, FUTURE_PENDING);
+    // Settled by the continuation, after the caller may be done with it
+    future_retain(result);
+    // Cancelling the result stops whatever runs for the input
+    if (f->cancel_token != NULL) {
+        async_cancel_token_retain(f->cancel_token);
+        future_set_cancel_token(result, f->cancel_token);
+    }
+    *c = (struct future_continuation){
+        .callback = { .func = _future_continuation_on_settled },
+        .input = f,
+        .result = result,
+        .then = then,
+        .map = map,
+        .arg = arg,
+        .free_result = free_result
+    };
+    // Before the callback is in place, which may drop the input right away
+    if (future_start(f) != 0) {
+        errorf("failed to schedule future at %p\n", f);
+    }
+    _future_on_settled(f, &c->callback);
     return result;
 }
 
+future_t *future_then(future_t *f, future_then_function_t func, void *arg) {
+    return _future_continue(f, func, NULL, arg, NULL);
+}
+
+future_t *future_map(future_t *f, future_map_function_t func, void *arg, free_function_t free_result) {
+    return _future_continue(f, NULL, func, arg, free_result);
+}
+
 void future_destroy(future_t *f) {
     if (f == NULL) return;
-    _future_lock_guard_begin(f);
-    if (f->state == FUTURE_PENDING) {
-        _future_lock_guard_end(f);
-        errorf("attempting to free a pending future at %p\n", f);
+    if (!_future_is_settled(future_get_state(f))) {
+        // Nobody is left to care about the outcome
+        future_cancel(f);
+    }
+    if (atomic_fetch_sub_explicit(&f->refs, 1, memory_order_acq_rel) != 1) {
         return;
     }
-    if (!f->is_taken && f->free_value != NULL && f->value != NULL) {
+    if (!atomic_load_explicit(&f->is_taken, memory_order_relaxed) && f->free_value != NULL && f->value != NULL) {
         f->free_value(f->value);
     }
-    dllist_destroy(f->waited_on_by);
-    if (f->is_locked) {
-        mtx_destroy(&f->lock);
-    }
+    async_cancel_token_release(f->cancel_token);
     free(f);
 }
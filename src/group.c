@@ -0,0 +1,161 @@
+#include "group.h"
+#include "async.h"
+#include "cancel.h"
+#include "coroutine.h"
+#include "logging.h"
+#include "sync.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#define GROUP_CHUNK_SIZE 64
+
+struct group_child {
+    async_group_t *group;
+    async_group_function_t func;
+    void *arg;
+};
+
+struct group_chunk {
+    struct group_chunk *next;
+    size_t n_used;
+    struct group_child children[GROUP_CHUNK_SIZE];
+};
+
+struct async_group {
+    async_waitgroup_t running;
+    atomic_int has_failed;
+    async_cancel_token_t *token;
+    // Children that finish after the joiner has moved on still touch the
+    // group, so it goes away with whichever reference is dropped last
+    atomic_size_t refs;
+    // Only grows until the group is freed
+    struct group_chunk *chunks;
+};
+
+async_group_t *async_group_create() {
+    async_group_t *g = malloc(sizeof(async_group_t));
+    if (g == NULL) {
+        errorf("failed to allocate memory for a task group\n");
+        return NULL;
+    }
+    g->token = async_cancel_token_create(async_get_cancel_token());
+    if (g->token == NULL) {
+        free(g);
+        return NULL;
+    }
+    async_waitgroup_init(&g->running);
+    atomic_init(&g->has_failed, 0);
+    atomic_init(&g->refs, 1);
+    g->chunks = NULL;
+    return g;
+}
+
+static void _group_release(async_group_t *g) {
+    if (atomic_fetch_sub_explicit(&g->refs, 1, memory_order_acq_rel) != 1) return;
+    struct group_chunk *chunk = g->chunks;
+    while (chunk != NULL) {
+        struct group_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    async_cancel_token_release(g->token);
+    free(g);
+}
+
+static struct group_child *_group_alloc_child(async_group_t *g) {
+    if (g->chunks == NULL || g->chunks->n_used == GROUP_CHUNK_SIZE) {
+        struct group_chunk *chunk = malloc(sizeof(struct group_chunk));
+        if (chunk == NULL) {
+            errorf("failed to allocate memory for task group children\n");
+            return NULL;
+        }
+        chunk->next = g->chunks;
+        chunk->n_used = 0;
+        g->chunks = chunk;
+    }
+    return &g->chunks->children[g->chunks->n_used++];
+}
+
+static void *_group_child_wrapper(void *_child) {
+    struct group_child *child = (struct group_child*) _child;
+    async_group_t *g = child->group;
+    // A sibling may have failed before this one got to run
+    if (!async_is_cancelled() && child->func(child->arg) != 0) {
+        if (atomic_exchange(&g->has_failed, 1) == 0) {
+            async_cancel_token_cancel(g->token);
+        }
+    }
+    async_waitgroup_done(&g->running);
+    _group_release(g);
+    return NULL;
+}
+
+int async_group_spawn(async_group_t *g, async_group_function_t func, void *arg) {
+    async_context_t *ctx = async_context_get_current();
+    if (ctx == NULL) {
+        errorf("async_group_spawn() called outside of an async context\n");
+        return -1;
+    }
+    if (async_cancel_token_is_cancelled(g->token)) {
+        return -1;
+    }
+
+    struct group_child *child = _group_alloc_child(g);
+    if (child == NULL) {
+        return -1;
+    }
+    *child = (struct group_child){
+        .group = g,
+        .func = func,
+        .arg = arg
+    };
+    async_cancel_token_t *token = async_cancel_token_create(g->token);
+    if (token == NULL) {
+        // The slot is simply never used
+        return -1;
+    }
+    coroutine_t *co = coro_create(_group_child_wrapper, child, 0);
+    if (co == NULL) {
+        errorf("failed to create coroutine for task group child\n");
+        async_cancel_token_release(token);
+        return -1;
+    }
+    // The coroutine holds the token from here on
+    async_cancel_token_bind(token, co);
+    async_cancel_token_release(token);
+
+    async_waitgroup_add(&g->running, 1);
+    atomic_fetch_add_explicit(&g->refs, 1, memory_order_relaxed);
+    if (async_schedule_coroutine(ctx, co) != 0) {
+        errorf("failed to schedule task group child\n");
+        coro_destroy(co);
+        async_waitgroup_done(&g->running);
+        _group_release(g);
+        return -1;
+    }
+    return 0;
+}
+
+// Waits even when cancelled, the children are cancelled along with the
+// group and are bound to return soon
+static void _group_wait(async_group_t *g) {
+    async_cancel_token_t *shielded = async_cancel_shield();
+    async_waitgroup_wait(&g->running);
+    async_cancel_unshield(shielded);
+}
+
+int async_group_join(async_group_t *g) {
+    _group_wait(g);
+    return atomic_load(&g->has_failed) || async_cancel_token_is_cancelled(g->token) ? -1 : 0;
+}
+
+void async_group_cancel(async_group_t *g) {
+    async_cancel_token_cancel(g->token);
+}
+
+void async_group_destroy(async_group_t *g) {
+    if (g == NULL) return;
+    async_group_cancel(g);
+    _group_wait(g);
+    _group_release(g);
+}
@@ -3,36 +3,67 @@
 #include <stdint.h>
 #include <stdlib.h>
 
-#define PARENT(i) (((i) - 1) / 2)
-#define LEFT(i)   (2 * (i) + 1)
-#define RIGHT(i)  (2 * (i) + 2)
+// Four children per node keeps siblings on one cache line and halves the
+// depth of a binary heap, for one more comparison per level going down
+#ifndef HEAP_ARITY
+#define HEAP_ARITY 4
+#endif
+
+#define PARENT(i)      (((i) - 1) / HEAP_ARITY)
+#define FIRST_CHILD(i) (HEAP_ARITY * (i) + 1)
+
+// Only nodes move while sifting, elements stay in their slot so a handle,
+// which is the slot index, stays valid
+struct heap_node {
+    uint64_t key;
+    size_t slot;
+};
 
 struct heap_s {
-    void *data; 
+    struct heap_node *nodes;
+    void *elements;
+    // Where in nodes each slot currently is
+    size_t *positions;
+    // Slots below next_slot that are free again
+    size_t *free_slots;
+    size_t n_free;
+    size_t next_slot;
     size_t size;
     size_t capacity;
     size_t element_size;
-    uint64_t (*priority) (void*); 
+    uint64_t (*priority) (void*);
 };
 
+static void *_heap_slot(heap h, size_t slot) {
+    return (char*) h->elements + slot * h->element_size;
+}
+
 heap heap_create(size_t initial_size, size_t element_size, uint64_t (*priority) (void*)) {
     struct heap_s *h = malloc(sizeof(struct heap_s));
     if (!h) return NULL;
-    h->data = malloc(initial_size * element_size);
-    if (!h->data) { 
-        free(h); 
+    if (initial_size == 0) initial_size = 1;
+    *h = (struct heap_s){
+        .nodes = malloc(initial_size * sizeof(struct heap_node)),
+        .elements = malloc(initial_size * element_size),
+        .positions = malloc(initial_size * sizeof(size_t)),
+        .free_slots = malloc(initial_size * sizeof(size_t)),
+        .capacity = initial_size,
+        .element_size = element_size,
+        .priority = priority
+    };
+    if (!h->nodes || !h->elements || !h->positions || !h->free_slots) {
+        heap_destroy(h);
         return NULL;
     }
-    h->size = 0;
-    h->capacity = initial_size;
-    h->element_size = element_size;
-    h->priority = priority;
     return h;
 }
 
 void heap_destroy(heap h) {
     if (!h) return;
-    free(h->data);
+    free(h->nodes);
+    free(h->elements);
+    free(h->positions);
+    free(h->free_slots);
     free(h);
 }
 
@@ -40,70 +71,120 @@ int heap_empty(heap h) {
     return h->size == 0;
 }
 
+size_t heap_size(heap h) {
+    return h->size;
+}
+
 void *heap_min(heap h) {
-    return (h->size > 0) ? h->data : NULL;
+    return (h->size > 0) ? _heap_slot(h, h->nodes[0].slot) : NULL;
 }
 
-static int swap(heap h, size_t a, size_t b) {
-    void *buffer = malloc(h->element_size);
-    if (buffer == NULL) {
-        return -1;
-    }
-    memcpy(buffer, (char*) h->data + a * h->element_size, h->element_size);
-    memcpy((char*) h->data + a * h->element_size, (char*) h->data + b * h->element_size, h->element_size);
-    memcpy((char*) h->data + b * h->element_size, buffer, h->element_size);
-    free(buffer);
-    return 0;
+void *heap_get(heap h, heap_handle_t handle) {
+    return _heap_slot(h, handle);
 }
 
-static int heapify_up(heap h, size_t i) {
+static void _heap_place(heap h, size_t i, struct heap_node node) {
+    h->nodes[i] = node;
+    h->positions[node.slot] = i;
+}
+
+// Both sifts carry the moving node along and write it once at the end,
+// instead of swapping at every level
+static void _heap_sift_up(heap h, size_t i) {
+    struct heap_node node = h->nodes[i];
     while (i > 0) {
         size_t p = PARENT(i);
-        if (h->priority((char*) h->data + i * h->element_size) >= h->priority((char*) h->data + p * h->element_size)) break;
-        if (swap(h, i, p) == -1) return -1;
+        if (node.key >= h->nodes[p].key) break;
+        _heap_place(h, i, h->nodes[p]);
         i = p;
     }
-    return 0;
+    _heap_place(h, i, node);
 }
 
-static int heapify_down(heap h, size_t i) {
+static void _heap_sift_down(heap h, size_t i) {
+    struct heap_node node = h->nodes[i];
     while (1) {
-        size_t l = LEFT(i), r = RIGHT(i), smallest = i;
-        if (l < h->size && h->priority((char*) h->data + l * h->element_size) < h->priority((char*) h->data + smallest * h->element_size))
-            smallest = l;
-        if (r < h->size && h->priority((char*) h->data + r * h->element_size) < h->priority((char*) h->data + smallest * h->element_size))
-            smallest = r;
-        if (smallest == i) break;
-        if (swap(h, i, smallest) == -1) {
-            return -1;
+        size_t first = FIRST_CHILD(i);
+        if (first >= h->size) break;
+        size_t last = first + HEAP_ARITY < h->size ? first + HEAP_ARITY : h->size;
+        size_t smallest = first;
+        for (size_t c = first + 1; c < last; c++) {
+            if (h->nodes[c].key < h->nodes[smallest].key) smallest = c;
         }
+        if (h->nodes[smallest].key >= node.key) break;
+        _heap_place(h, i, h->nodes[smallest]);
         i = smallest;
     }
+    _heap_place(h, i, node);
+}
+
+static int _heap_grow(heap h) {
+    size_t newcap = h->capacity * 2;
+    // A failed realloc leaves the earlier arrays larger than needed, which
+    // is harmless since capacity only moves once all of them succeeded
+    struct heap_node *nodes = realloc(h->nodes, newcap * sizeof(struct heap_node));
+    if (!nodes) return -1;
+    h->nodes = nodes;
+    void *elements = realloc(h->elements, newcap * h->element_size);
+    if (!elements) return -1;
+    h->elements = elements;
+    size_t *positions = realloc(h->positions, newcap * sizeof(size_t));
+    if (!positions) return -1;
+    h->positions = positions;
+    size_t *free_slots = realloc(h->free_slots, newcap * sizeof(size_t));
+    if (!free_slots) return -1;
+    h->free_slots = free_slots;
+    h->capacity = newcap;
     return 0;
 }
 
-int heap_insert(heap h, void* element) {
-    if (h->size == h->capacity) {
-        size_t newcap = h->capacity * 2;
-        void *newdata = realloc(h->data, newcap * h->element_size);
-        if (!newdata) return -1;
-        h->data = newdata;
-        h->capacity = newcap;
-    }
-    memcpy((char*) h->data + (h->size) * h->element_size, element, h->element_size);
-    if (heapify_up(h, h->size) == -1) {
+int heap_insert_with_handle(heap h, void* element, heap_handle_t *handle) {
+    if (h->size == h->capacity && _heap_grow(h) != 0) {
         return -1;
     }
-    h->size++;
+    size_t slot = h->n_free > 0 ? h->free_slots[--h->n_free] : h->next_slot++;
+    memcpy(_heap_slot(h, slot), element, h->element_size);
+    h->nodes[h->size] = (struct heap_node){
+        .key = h->priority(_heap_slot(h, slot)),
+        .slot = slot
+    };
+    _heap_sift_up(h, h->size++);
+    if (handle != NULL) *handle = slot;
     return 0;
 }
 
-int heap_pop(heap h) {
-    if (h->size == 0) return -1;
+int heap_insert(heap h, void* element) {
+    return heap_insert_with_handle(h, element, NULL);
+}
 
-    memcpy(h->data, (char*) h->data + (h->size - 1) * h->element_size, h->element_size);
+void heap_update(heap h, heap_handle_t handle) {
+    size_t i = h->positions[handle];
+    uint64_t old_key = h->nodes[i].key;
+    h->nodes[i].key = h->priority(_heap_slot(h, handle));
+    if (h->nodes[i].key < old_key) {
+        _heap_sift_up(h, i);
+    } else {
+        _heap_sift_down(h, i);
+    }
+}
 
+void heap_remove(heap h, heap_handle_t handle) {
+    size_t i = h->positions[handle];
+    h->free_slots[h->n_free++] = handle;
     h->size--;
-    if (h->size > 0) return heapify_down(h, 0);
+    if (i == h->size) return;
+    // The last node takes the hole and may have to go either way from there
+    uint64_t old_key = h->nodes[i].key;
+    _heap_place(h, i, h->nodes[h->size]);
+    if (h->nodes[i].key < old_key) {
+        _heap_sift_up(h, i);
+    } else {
+        _heap_sift_down(h, i);
+    }
+}
+
+int heap_pop(heap h) {
+    if (h->size == 0) return -1;
+    heap_remove(h, h->nodes[0].slot);
     return 0;
 }
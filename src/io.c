@@ -0,0 +1,184 @@
+#define _GNU_SOURCE
+#include "io.h"
+#include "cancel.h"
+#include "logging.h"
+#include "uring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef enum io_operation {
+    IO_READ,
+    IO_WRITE,
+    IO_ACCEPT
+} io_operation_e;
+
+struct io_fallback_args {
+    io_operation_e op;
+    int fd;
+    void *buffer;
+    size_t size;
+    off_t offset;
+    struct sockaddr *addr;
+    socklen_t *addrlen;
+};
+
+static async_context_t *_io_get_context() {
+    async_context_t *current_async_ctx = async_context_get_current();
+    if (current_async_ctx == NULL) {
+        errorf("running coroutine outside async context\n");
+        abort();
+    }
+    return current_async_ctx;
+}
+
+static ssize_t _io_fallback_try(struct io_fallback_args *arg) {
+    switch (arg->op) {
+        case IO_READ:
+            return arg->offset < 0
+                ? read(arg->fd, arg->buffer, arg->size)
+                : pread(arg->fd, arg->buffer, arg->size, arg->offset);
+        case IO_WRITE:
+            return arg->offset < 0
+                ? write(arg->fd, arg->buffer, arg->size)
+                : pwrite(arg->fd, arg->buffer, arg->size, arg->offset);
+        case IO_ACCEPT:
+            return accept4(arg->fd, arg->addr, arg->addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+void *_io_fallback(void *_arg) {
+    struct io_fallback_args *arg = (struct io_fallback_args*) _arg;
+    ssize_t result;
+    while (1) {
+        // Checked before every attempt, since the awaiter may be gone along
+        // with the buffer once this coroutine has been stopped
+        if (async_is_cancelled()) {
+            result = -ECANCELED;
+            break;
+        }
+        if ((result = _io_fallback_try(arg)) >= 0) break;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            result = -errno;
+            break;
+        }
+        if (async_await_fd(arg->fd, arg->op == IO_WRITE ? POLLOUT : POLLIN) < 0) {
+            result = -errno;
+            break;
+        }
+    }
+    free(arg);
+    return (void*) (intptr_t) result;
+}
+
+// Either way the future resolves with -ECANCELED, or with the result of an
+// operation that got there first
+static void _io_fallback_stop(future_t *f, void *arg) {
+    (void) arg;
+    async_cancel_token_cancel(future_get_cancel_token(f));
+}
+
+static void _io_uring_stop(future_t *f, void *ctx) {
+    async_context_cancel_io((async_context_t*) ctx, f);
+}
+
+static future_t *_io_submit(struct io_fallback_args arg) {
+    async_context_t *ctx = _io_get_context();
+
+    struct io_uring_sqe *sqe = async_context_get_sqe(ctx);
+    if (sqe == NULL) {
+        // No io_uring on this context, do the operation on a coroutine that
+        // waits for readiness through epoll instead. That only works if the
+        // fd never blocks, otherwise it would stall the whole loop
+        int flags = fcntl(arg.fd, F_GETFL);
+        if (flags < 0 || (!(flags & O_NONBLOCK) && fcntl(arg.fd, F_SETFL, flags | O_NONBLOCK) != 0)) {
+            errorf("failed to make fd %d non-blocking: '%s'\n", arg.fd, strerror(errno));
+            return NULL;
+        }
+        struct io_fallback_args *fallback_arg = malloc(sizeof(struct io_fallback_args));
+        if (fallback_arg == NULL) {
+            errorf("failed to allocate memory for I/O operation\n");
+            return NULL;
+        }
+        *fallback_arg = arg;
+        future_t *result = future_create_from_function(_io_fallback, fallback_arg, FUT_OPT_EAGER);
+        if (result == NULL) {
+            free(fallback_arg);
+            return NULL;
+        }
+        future_set_stop_function(result, _io_fallback_stop, NULL);
+        return result;
+    }
+
+    future_t *result = future_create(0);
+    if (result == NULL) {
+        // The SQE can't be given back, so turn it into a no-op
+        sqe->opcode = IORING_OP_NOP;
+        return NULL;
+    }
+
+    switch (arg.op) {
+        case IO_READ:
+            sqe->opcode = IORING_OP_READ;
+            break;
+        case IO_WRITE:
+            sqe->opcode = IORING_OP_WRITE;
+            break;
+        case IO_ACCEPT:
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->addr2 = (uint64_t) (uintptr_t) arg.addrlen;
+            sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+            break;
+    }
+    sqe->fd = arg.fd;
+    if (arg.op == IO_ACCEPT) {
+        sqe->addr = (uint64_t) (uintptr_t) arg.addr;
+    } else {
+        sqe->addr = (uint64_t) (uintptr_t) arg.buffer;
+        sqe->len = arg.size;
+        sqe->off = (uint64_t) arg.offset;
+    }
+    sqe->user_data = (uint64_t) (uintptr_t) result;
+    // Dropped on completion, the kernel may still be at it after the caller
+    // has given up on the future
+    future_retain(result);
+    future_set_stop_function(result, _io_uring_stop, ctx);
+
+    // The operation is submitted with the next batch, when the loop polls
+    future_set_state(result, FUTURE_PENDING);
+    return result;
+}
+
+future_t *async_read(int fd, void *buffer, size_t size, off_t offset) {
+    return _io_submit((struct io_fallback_args){
+        .op = IO_READ,
+        .fd = fd,
+        .buffer = buffer,
+        .size = size,
+        .offset = offset
+    });
+}
+
+future_t *async_write(int fd, const void *buffer, size_t size, off_t offset) {
+    return _io_submit((struct io_fallback_args){
+        .op = IO_WRITE,
+        .fd = fd,
+        .buffer = (void*) buffer,
+        .size = size,
+        .offset = offset
+    });
+}
+
+future_t *async_accept(int fd, struct sockaddr *addr, socklen_t *addrlen) {
+    return _io_submit((struct io_fallback_args){
+        .op = IO_ACCEPT,
+        .fd = fd,
+        .addr = addr,
+        .addrlen = addrlen
+    });
+}
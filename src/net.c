@@ -0,0 +1,161 @@
+#define _GNU_SOURCE
+#include "net.h"
+#include "logging.h"
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+// Called after an operation on fd failed. Returns 1 if it should be retried,
+// once fd is ready if the operation would have blocked
+static int _net_should_retry(int fd, short events) {
+    if (errno == EINTR) return 1;
+    if (errno != EAGAIN && errno != EWOULDBLOCK) return 0;
+    // Keeps the errno of the await, ECANCELED when cancelled
+    return async_await_fd(fd, events) >= 0;
+}
+
+static int _net_resolve(const char *host, uint16_t port, int flags, struct addrinfo **result) {
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        // Numeric only, so resolving never blocks the loop
+        .ai_flags = AI_NUMERICHOST | AI_NUMERICSERV | flags
+    };
+    int error = getaddrinfo(host, service, &hints, result);
+    if (error != 0) {
+        errorf("failed to resolve '%s': '%s'\n", host == NULL ? "*" : host, gai_strerror(error));
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+int async_tcp_listen(const char *host, uint16_t port, int backlog) {
+    struct addrinfo *addresses;
+    if (_net_resolve(host, port, AI_PASSIVE, &addresses) != 0) {
+        return -1;
+    }
+    int fd = socket(addresses->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        errorf("failed to create socket: '%s'\n", strerror(errno));
+        freeaddrinfo(addresses);
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int));
+    if (bind(fd, addresses->ai_addr, addresses->ai_addrlen) != 0 || listen(fd, backlog) != 0) {
+        int saved_errno = errno;
+        errorf("failed to listen on port %u: '%s'\n", port, strerror(errno));
+        freeaddrinfo(addresses);
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    freeaddrinfo(addresses);
+    return fd;
+}
+
+int async_tcp_connect(const char *host, uint16_t port) {
+    struct addrinfo *addresses;
+    if (_net_resolve(host, port, 0, &addresses) != 0) {
+        return -1;
+    }
+    int fd = socket(addresses->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        errorf("failed to create socket: '%s'\n", strerror(errno));
+        freeaddrinfo(addresses);
+        return -1;
+    }
+    int result = async_connect(fd, addresses->ai_addr, addresses->ai_addrlen);
+    freeaddrinfo(addresses);
+    if (result != 0) {
+        int saved_errno = errno;
+        async_close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    // Requests and responses are usually small and written in one go
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+    return fd;
+}
+
+int async_tcp_accept(int listener, struct sockaddr *addr, socklen_t *addrlen) {
+    int fd;
+    while ((fd = accept4(listener, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0 && _net_should_retry(listener, POLLIN));
+    if (fd >= 0) {
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+    }
+    return fd;
+}
+
+int async_connect(int fd, const struct sockaddr *addr, socklen_t addrlen) {
+    if (connect(fd, addr, addrlen) == 0) {
+        return 0;
+    }
+    if (errno != EINPROGRESS) {
+        return -1;
+    }
+    // The outcome is reported through SO_ERROR once the socket is writable
+    if (async_await_fd(fd, POLLOUT) < 0) {
+        return -1;
+    }
+    int error = 0;
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &(socklen_t){sizeof(error)}) != 0) {
+        return -1;
+    }
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+ssize_t async_recv(int fd, void *buffer, size_t size, int flags) {
+    ssize_t n;
+    while ((n = recv(fd, buffer, size, flags)) < 0 && _net_should_retry(fd, POLLIN));
+    return n;
+}
+
+ssize_t async_send(int fd, const void *buffer, size_t size, int flags) {
+    ssize_t n;
+    while ((n = send(fd, buffer, size, flags | MSG_NOSIGNAL)) < 0 && _net_should_retry(fd, POLLOUT));
+    return n;
+}
+
+ssize_t async_readv(int fd, const struct iovec *iov, int iovcnt) {
+    ssize_t n;
+    while ((n = readv(fd, iov, iovcnt)) < 0 && _net_should_retry(fd, POLLIN));
+    return n;
+}
+
+static ssize_t _net_writev(int fd, const struct iovec *iov, int iovcnt) {
+    // sendmsg() is writev() with flags, which keeps SIGPIPE away
+    ssize_t n = sendmsg(fd, &(struct msghdr){ .msg_iov = (struct iovec*) iov, .msg_iovlen = iovcnt }, MSG_NOSIGNAL);
+    if (n < 0 && errno == ENOTSOCK) {
+        return writev(fd, iov, iovcnt);
+    }
+    return n;
+}
+
+ssize_t async_writev(int fd, const struct iovec *iov, int iovcnt) {
+    ssize_t n;
+    while ((n = _net_writev(fd, iov, iovcnt)) < 0 && _net_should_retry(fd, POLLOUT));
+    return n;
+}
+
+ssize_t async_sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    ssize_t n;
+    while ((n = sendfile(out_fd, in_fd, offset, count)) < 0 && _net_should_retry(out_fd, POLLOUT));
+    return n;
+}
+
+int async_close(int fd) {
+    async_forget_fd(fd);
+    return close(fd);
+}
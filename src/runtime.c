@@ -0,0 +1,159 @@
+#include "runtime.h"
+#include "async.h"
+#include "logging.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <threads.h>
+
+struct async_runtime {
+    size_t n_workers;
+    async_context_t **workers;
+    atomic_int *idle;
+
+    // Coroutines scheduled on any worker that haven't finished yet; every
+    // worker keeps running until this drops to zero
+    atomic_size_t n_live;
+};
+
+async_runtime_t *async_runtime_create(size_t n_workers, int context_options) {
+    if (n_workers == 0) {
+        errorf("a runtime needs at least one worker\n");
+        return NULL;
+    }
+
+    async_runtime_t *runtime = malloc(sizeof(async_runtime_t));
+    if (runtime == NULL) {
+        errorf("failed to allocate memory for runtime\n");
+        return NULL;
+    }
+    runtime->n_workers = n_workers;
+    runtime->workers = calloc(n_workers, sizeof(async_context_t*));
+    runtime->idle = calloc(n_workers, sizeof(atomic_int));
+    atomic_init(&runtime->n_live, 0);
+    if (runtime->workers == NULL || runtime->idle == NULL) {
+        errorf("failed to allocate memory for runtime\n");
+        async_runtime_destroy(runtime);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < n_workers; i++) {
+        runtime->workers[i] = async_context_create_with_options(context_options);
+        if (runtime->workers[i] == NULL) {
+            errorf("failed to create async context for worker %zu\n", i);
+            async_runtime_destroy(runtime);
+            return NULL;
+        }
+        async_context_attach_runtime(runtime->workers[i], runtime, i);
+        atomic_init(&runtime->idle[i], 0);
+    }
+
+    return runtime;
+}
+
+size_t async_runtime_get_worker_count(async_runtime_t *runtime) {
+    return runtime->n_workers;
+}
+
+async_context_t *async_runtime_get_worker(async_runtime_t *runtime, size_t worker_id) {
+    return worker_id < runtime->n_workers ? runtime->workers[worker_id] : NULL;
+}
+
+static int _worker_thread(void *_ctx) {
+    return async_context_run_loop((async_context_t*) _ctx);
+}
+
+int async_runtime_run(async_runtime_t *runtime, coroutine_function_t entrypoint, void *arg) {
+    coroutine_t *co = coro_create(entrypoint, arg, CORO_OPT_OWNED);
+    if (co == NULL) {
+        return -1;
+    }
+    // Scheduling the entrypoint first keeps the other workers from seeing an
+    // empty runtime and stopping straight away
+    if (async_schedule_coroutine(runtime->workers[0], co)) {
+        coro_destroy(co);
+        return -1;
+    }
+
+    thrd_t *threads = malloc(sizeof(thrd_t) * runtime->n_workers);
+    if (threads == NULL) {
+        errorf("failed to allocate memory for worker threads\n");
+        abort();
+    }
+    size_t n_started = 1;
+    for (; n_started < runtime->n_workers; n_started++) {
+        if (thrd_create(&threads[n_started], _worker_thread, runtime->workers[n_started]) != thrd_success) {
+            warnf("failed to start worker %zu, running with fewer threads\n", n_started);
+            break;
+        }
+    }
+
+    // The calling thread is worker 0
+    int result = async_context_run_loop(runtime->workers[0]);
+
+    for (size_t i = 1; i < n_started; i++) {
+        int worker_result = 0;
+        thrd_join(threads[i], &worker_result);
+        if (worker_result != 0) {
+            result = worker_result;
+        }
+    }
+    free(threads);
+    coro_destroy(co);
+    return result;
+}
+
+void async_runtime_coroutine_spawned(async_runtime_t *runtime, async_context_t *from) {
+    atomic_fetch_add(&runtime->n_live, 1);
+
+    // Wake up one idle worker so it can steal the new coroutine
+    for (size_t i = 0; i < runtime->n_workers; i++) {
+        if (runtime->workers[i] == from) continue;
+        int expected = 1;
+        if (atomic_compare_exchange_strong(&runtime->idle[i], &expected, 0)) {
+            async_signal_scheduler(runtime->workers[i]);
+            return;
+        }
+    }
+}
+
+void async_runtime_coroutine_finished(async_runtime_t *runtime) {
+    if (atomic_fetch_sub(&runtime->n_live, 1) != 1) return;
+    // That was the last one, let every worker leave its loop
+    for (size_t i = 0; i < runtime->n_workers; i++) {
+        async_signal_scheduler(runtime->workers[i]);
+    }
+}
+
+int async_runtime_is_finished(async_runtime_t *runtime) {
+    return atomic_load(&runtime->n_live) == 0;
+}
+
+void async_runtime_set_idle(async_runtime_t *runtime, size_t worker_id, int idle) {
+    atomic_store(&runtime->idle[worker_id], idle);
+}
+
+size_t async_runtime_steal(async_runtime_t *runtime, size_t thief_id) {
+    async_context_t *thief = runtime->workers[thief_id];
+
+    // Start with the next worker so thieves don't all pile onto worker 0
+    for (size_t i = 1; i < runtime->n_workers; i++) {
+        async_context_t *victim = runtime->workers[(thief_id + i) % runtime->n_workers];
+        size_t stolen = async_context_steal(victim, thief);
+        if (stolen > 0) {
+            return stolen;
+        }
+    }
+    return 0;
+}
+
+void async_runtime_destroy(async_runtime_t *runtime) {
+    if (runtime == NULL) return;
+    if (runtime->workers != NULL) {
+        for (size_t i = 0; i < runtime->n_workers; i++) {
+            async_context_destroy(runtime->workers[i]);
+        }
+    }
+    free(runtime->workers);
+    free(runtime->idle);
+    free(runtime);
+}
@@ -0,0 +1,182 @@
+#define _GNU_SOURCE
+#include "stack_pool.h"
+#include "logging.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define STACK_POOL_MIN_SHIFT 12
+#define STACK_POOL_N_CLASSES 20
+// Per size class, so small stacks get cached in much larger numbers. Only
+// pages a coroutine touched stay committed while a stack sits in the pool,
+// and only for the hot stacks below
+#define STACK_POOL_MAX_CACHED_BYTES (64 * 1024 * 1024)
+// The most recently released stacks of a class are the ones reused next, so
+// they keep their pages. A stack pushed past these by newer ones gives its
+// pages back to the kernel, all but the top one that holds the free list link
+#define STACK_POOL_HOT_STACKS 16
+
+// Kept inside the cached stack itself, at its top where the memory has
+// already been touched by the coroutine that used it
+struct cached_stack {
+    struct cached_stack *next;
+    struct cached_stack *prev;
+    int is_discarded;
+};
+
+struct stack_pool {
+    // One free list per power-of-two size class, most recently released first
+    struct cached_stack *free[STACK_POOL_N_CLASSES];
+    // The deepest of the hot stacks, the next one to go cold
+    struct cached_stack *last_hot[STACK_POOL_N_CLASSES];
+    size_t n_free[STACK_POOL_N_CLASSES];
+};
+
+static size_t _page_size() {
+    static size_t page_size = 0;
+    if (page_size == 0) {
+        page_size = (size_t) sysconf(_SC_PAGESIZE);
+    }
+    return page_size;
+}
+
+static size_t _stack_pool_class(size_t size) {
+    size_t class = 0;
+    while (((size_t) 1 << (class + STACK_POOL_MIN_SHIFT)) < size) {
+        class++;
+    }
+    return class;
+}
+
+size_t stack_pool_round_size(size_t size) {
+    // Past the largest power of two, rounding up would overflow
+    if (size > SIZE_MAX / 2 + 1) return 0;
+    size_t rounded = (size_t) 1 << STACK_POOL_MIN_SHIFT;
+    while (rounded < size) {
+        rounded <<= 1;
+    }
+    return rounded < _page_size() ? _page_size() : rounded;
+}
+
+static struct cached_stack *_cached_stack_of(void *stack, size_t size) {
+    return (struct cached_stack*) ((unsigned char*) stack + size - sizeof(struct cached_stack));
+}
+
+static void *_stack_map(size_t size) {
+    size_t guard = _page_size();
+    // Nothing is committed until the coroutine actually touches it
+    unsigned char *mapping = mmap(NULL, guard + size, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (mapping == MAP_FAILED) {
+        errorf("failed to map a coroutine stack of %zu bytes\n", size);
+        return NULL;
+    }
+    // Stacks grow down, so an overflow runs into this page and faults. Each
+    // guard page splits the mapping in two, so with enough live coroutines
+    // this runs into vm.max_map_count; such stacks go without a guard page
+    // rather than failing, since unprotected mappings get merged by the kernel
+    static _Thread_local int warned = 0;
+    if (mprotect(mapping, guard, PROT_NONE) != 0 && !warned) {
+        warnf("failed to protect guard page of coroutine stack, continuing without guard pages\n");
+        warned = 1;
+    }
+    return mapping + guard;
+}
+
+static void _stack_unmap(void *stack, size_t size) {
+    size_t guard = _page_size();
+    if (munmap((unsigned char*) stack - guard, guard + size) != 0) {
+        warnf("failed to unmap coroutine stack at %p\n", stack);
+    }
+}
+
+static void _stack_discard(void *stack, size_t size) {
+    size_t length = size - _page_size();
+    if (length == 0) return;
+    // MADV_FREE only reclaims under memory pressure and is cheaper to touch
+    // again, but needs Linux 4.5
+    static _Thread_local int has_madv_free = 1;
+    if (has_madv_free && madvise(stack, length, MADV_FREE) == 0) return;
+    has_madv_free = 0;
+    if (madvise(stack, length, MADV_DONTNEED) != 0) {
+        debugf("failed to discard pages of cached coroutine stack at %p\n", stack);
+    }
+}
+
+stack_pool_t *stack_pool_create() {
+    stack_pool_t *pool = calloc(1, sizeof(stack_pool_t));
+    if (pool == NULL) {
+        errorf("failed to allocate memory for stack pool\n");
+        return NULL;
+    }
+    return pool;
+}
+
+void *stack_pool_acquire(stack_pool_t *pool, size_t size) {
+    size_t rounded = stack_pool_round_size(size);
+    if (rounded == 0) {
+        errorf("coroutine stack of %zu bytes is too large\n", size);
+        return NULL;
+    }
+    size = rounded;
+    size_t class = _stack_pool_class(size);
+    if (pool != NULL && class < STACK_POOL_N_CLASSES && pool->free[class] != NULL) {
+        struct cached_stack *cached = pool->free[class];
+        pool->free[class] = cached->next;
+        if (cached->next != NULL) {
+            cached->next->prev = NULL;
+        }
+        // The first cold stack, if any, moves up among the hot ones
+        if (pool->n_free[class] > STACK_POOL_HOT_STACKS) {
+            pool->last_hot[class] = pool->last_hot[class]->next;
+        } else if (pool->last_hot[class] == cached) {
+            pool->last_hot[class] = NULL;
+        }
+        pool->n_free[class]--;
+        return (unsigned char*) cached + sizeof(struct cached_stack) - size;
+    }
+    return _stack_map(size);
+}
+
+void stack_pool_release(stack_pool_t *pool, void *stack, size_t size) {
+    if (stack == NULL) return;
+    size = stack_pool_round_size(size);
+    size_t class = _stack_pool_class(size);
+    if (pool == NULL || class >= STACK_POOL_N_CLASSES || (pool->n_free[class] + 1) * size > STACK_POOL_MAX_CACHED_BYTES) {
+        _stack_unmap(stack, size);
+        return;
+    }
+    struct cached_stack *cached = _cached_stack_of(stack, size);
+    *cached = (struct cached_stack){ .next = pool->free[class] };
+    if (cached->next != NULL) {
+        cached->next->prev = cached;
+    }
+    pool->free[class] = cached;
+    if (pool->n_free[class] >= STACK_POOL_HOT_STACKS) {
+        // Pushed one down by this one, the deepest hot stack goes cold
+        struct cached_stack *cold = pool->last_hot[class];
+        pool->last_hot[class] = cold->prev;
+        if (!cold->is_discarded) {
+            _stack_discard((unsigned char*) cold + sizeof(struct cached_stack) - size, size);
+            cold->is_discarded = 1;
+        }
+    } else if (pool->last_hot[class] == NULL) {
+        pool->last_hot[class] = cached;
+    }
+    pool->n_free[class]++;
+}
+
+void stack_pool_destroy(stack_pool_t *pool) {
+    if (pool == NULL) return;
+    for (size_t class = 0; class < STACK_POOL_N_CLASSES; class++) {
+        size_t size = (size_t) 1 << (class + STACK_POOL_MIN_SHIFT);
+        struct cached_stack *cached = pool->free[class];
+        while (cached != NULL) {
+            struct cached_stack *next = cached->next;
+            _stack_unmap((unsigned char*) cached + sizeof(struct cached_stack) - size, size);
+            cached = next;
+        }
+    }
+    free(pool);
+}
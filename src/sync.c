@@ -0,0 +1,145 @@
+#include "sync.h"
+#include "cancel.h"
+#include "logging.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Each waiter is counted by wait_queue_prepare() before it checks the state
+// once more, and each waker changes the state before checking for waiters,
+// so one of the two always sees the other. Where the woken waiter is meant
+// to own something on return, the waker claims it for them with the queue
+// lock held, and only if there is a waiter to give it to. A cancelled waiter
+// leaves the queue under the same lock, so it is either handed the thing or
+// gone before the waker looks
+
+void async_mutex_init(async_mutex_t *m) {
+    atomic_init(&m->is_locked, 0);
+    wait_queue_init(&m->waiters);
+}
+
+int async_mutex_try_lock(async_mutex_t *m) {
+    unsigned expected = 0;
+    return atomic_compare_exchange_strong_explicit(&m->is_locked, &expected, 1,
+        memory_order_acquire, memory_order_relaxed) ? 0 : 1;
+}
+
+int async_mutex_lock(async_mutex_t *m) {
+    if (async_mutex_try_lock(m) == 0) return 0;
+
+    wait_queue_prepare(&m->waiters);
+    if (async_mutex_try_lock(m) == 0) {
+        wait_queue_cancel(&m->waiters);
+        return 0;
+    }
+    // Owned on wakeup, the unlocking side took it on our behalf
+    return wait_queue_wait(&m->waiters);
+}
+
+static int _mutex_claim(void *arg) {
+    return async_mutex_try_lock((async_mutex_t*) arg) == 0;
+}
+
+void async_mutex_unlock(async_mutex_t *m) {
+    atomic_store_explicit(&m->is_locked, 0, memory_order_release);
+    if (!wait_queue_has_waiters(&m->waiters)) return;
+    wait_queue_wake_if(&m->waiters, 1, _mutex_claim, m);
+}
+
+void async_sem_init(async_sem_t *s, size_t count) {
+    atomic_init(&s->count, count);
+    wait_queue_init(&s->waiters);
+}
+
+int async_sem_try_acquire(async_sem_t *s) {
+    size_t count = atomic_load_explicit(&s->count, memory_order_relaxed);
+    while (count > 0) {
+        if (atomic_compare_exchange_weak_explicit(&s->count, &count, count - 1,
+                memory_order_acquire, memory_order_relaxed)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int async_sem_acquire(async_sem_t *s) {
+    if (async_sem_try_acquire(s) == 0) return 0;
+
+    wait_queue_prepare(&s->waiters);
+    if (async_sem_try_acquire(s) == 0) {
+        wait_queue_cancel(&s->waiters);
+        return 0;
+    }
+    return wait_queue_wait(&s->waiters);
+}
+
+static int _sem_claim(void *arg) {
+    return async_sem_try_acquire((async_sem_t*) arg) == 0;
+}
+
+void async_sem_release(async_sem_t *s) {
+    atomic_fetch_add_explicit(&s->count, 1, memory_order_release);
+    if (!wait_queue_has_waiters(&s->waiters)) return;
+    wait_queue_wake_if(&s->waiters, 1, _sem_claim, s);
+}
+
+size_t async_sem_get_count(async_sem_t *s) {
+    return atomic_load_explicit(&s->count, memory_order_relaxed);
+}
+
+void async_cond_init(async_cond_t *c) {
+    wait_queue_init(&c->waiters);
+}
+
+int async_cond_wait(async_cond_t *c, async_mutex_t *m) {
+    // Counted as a waiter before the mutex goes, so a signal sent by whoever
+    // takes it next can't be missed
+    wait_queue_prepare(&c->waiters);
+    async_mutex_unlock(m);
+    int result = wait_queue_wait(&c->waiters);
+    // The caller gets the mutex back even when cancelled
+    async_cancel_token_t *shielded = async_cancel_shield();
+    async_mutex_lock(m);
+    async_cancel_unshield(shielded);
+    if (result != 0) errno = ECANCELED;
+    return result;
+}
+
+void async_cond_signal(async_cond_t *c) {
+    wait_queue_wake(&c->waiters, 1);
+}
+
+void async_cond_broadcast(async_cond_t *c) {
+    wait_queue_wake(&c->waiters, SIZE_MAX);
+}
+
+void async_waitgroup_init(async_waitgroup_t *wg) {
+    atomic_init(&wg->count, 0);
+    wait_queue_init(&wg->waiters);
+}
+
+void async_waitgroup_add(async_waitgroup_t *wg, size_t n) {
+    atomic_fetch_add_explicit(&wg->count, n, memory_order_relaxed);
+}
+
+void async_waitgroup_done(async_waitgroup_t *wg) {
+    size_t previous = atomic_fetch_sub_explicit(&wg->count, 1, memory_order_acq_rel);
+    if (previous == 0) {
+        errorf("async_waitgroup_done() called more often than tasks were added\n");
+        abort();
+    }
+    if (previous == 1) {
+        wait_queue_wake(&wg->waiters, SIZE_MAX);
+    }
+}
+
+int async_waitgroup_wait(async_waitgroup_t *wg) {
+    if (atomic_load_explicit(&wg->count, memory_order_acquire) == 0) return 0;
+
+    wait_queue_prepare(&wg->waiters);
+    if (atomic_load_explicit(&wg->count, memory_order_acquire) == 0) {
+        wait_queue_cancel(&wg->waiters);
+        return 0;
+    }
+    return wait_queue_wait(&wg->waiters);
+}
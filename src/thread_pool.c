@@ -0,0 +1,216 @@
+#include "thread_pool.h"
+#include "logging.h"
+#include <stdlib.h>
+#include <threads.h>
+
+struct thread_pool_entry {
+    thread_pool_job_t func;
+    void *arg;
+    struct thread_pool_entry *next;
+};
+
+struct thread_pool {
+    mtx_t lock;
+    cnd_t has_work;
+    cnd_t has_space;
+
+    // FIFO of jobs waiting for a thread
+    struct thread_pool_entry *head, *tail;
+    size_t n_queued, max_queued;
+
+    thrd_t *threads;
+    size_t n_threads, max_threads;
+    size_t n_idle;
+    int shutting_down;
+};
+
+static void _thread_pool_lock(thread_pool_t *pool) {
+    if (mtx_lock(&pool->lock) != thrd_success) {
+        errorf("failed to acquire lock of thread pool at %p\n", (void*) pool);
+        abort();
+    }
+}
+
+static void _thread_pool_unlock(thread_pool_t *pool) {
+    if (mtx_unlock(&pool->lock) != thrd_success) {
+        errorf("failed to release lock of thread pool at %p\n", (void*) pool);
+        abort();
+    }
+}
+
+static int _thread_pool_worker(void *_pool) {
+    thread_pool_t *pool = (thread_pool_t*) _pool;
+
+    _thread_pool_lock(pool);
+    while (1) {
+        while (pool->head == NULL && !pool->shutting_down) {
+            pool->n_idle++;
+            cnd_wait(&pool->has_work, &pool->lock);
+            pool->n_idle--;
+        }
+        // Jobs queued before shutdown still run
+        if (pool->head == NULL) break;
+
+        struct thread_pool_entry *entry = pool->head;
+        pool->head = entry->next;
+        if (pool->head == NULL) pool->tail = NULL;
+        pool->n_queued--;
+        if (pool->max_queued != 0) {
+            cnd_signal(&pool->has_space);
+        }
+        _thread_pool_unlock(pool);
+
+        entry->func(entry->arg);
+        free(entry);
+
+        _thread_pool_lock(pool);
+    }
+    _thread_pool_unlock(pool);
+    return 0;
+}
+
+thread_pool_t *thread_pool_create(size_t max_threads, size_t max_queued) {
+    if (max_threads == 0) {
+        errorf("a thread pool needs at least one thread\n");
+        return NULL;
+    }
+
+    thread_pool_t *pool = malloc(sizeof(thread_pool_t));
+    if (pool == NULL) {
+        errorf("failed to allocate memory for thread pool\n");
+        return NULL;
+    }
+    *pool = (thread_pool_t){
+        .max_queued = max_queued,
+        .max_threads = max_threads,
+        .threads = malloc(sizeof(thrd_t) * max_threads)
+    };
+    if (pool->threads == NULL) {
+        errorf("failed to allocate memory for thread pool\n");
+        free(pool);
+        return NULL;
+    }
+    if (mtx_init(&pool->lock, mtx_plain) != thrd_success) {
+        errorf("failed to create lock for thread pool\n");
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    if (cnd_init(&pool->has_work) != thrd_success) {
+        errorf("failed to create condition variable for thread pool\n");
+        mtx_destroy(&pool->lock);
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    if (cnd_init(&pool->has_space) != thrd_success) {
+        errorf("failed to create condition variable for thread pool\n");
+        cnd_destroy(&pool->has_work);
+        mtx_destroy(&pool->lock);
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+// Expects the pool lock to be held
+static int _thread_pool_enqueue(thread_pool_t *pool, struct thread_pool_entry *entry) {
+    if (pool->tail == NULL) {
+        pool->head = entry;
+    } else {
+        pool->tail->next = entry;
+    }
+    pool->tail = entry;
+    pool->n_queued++;
+
+    if (pool->n_idle > 0) {
+        cnd_signal(&pool->has_work);
+        return 0;
+    }
+    if (pool->n_threads < pool->max_threads) {
+        if (thrd_create(&pool->threads[pool->n_threads], _thread_pool_worker, pool) == thrd_success) {
+            pool->n_threads++;
+        } else if (pool->n_threads == 0) {
+            // Nothing would ever run the job
+            pool->head = pool->tail = NULL;
+            pool->n_queued--;
+            errorf("failed to spawn thread for thread pool\n");
+            return -1;
+        } else {
+            warnf("failed to spawn thread for thread pool, queueing instead\n");
+        }
+    }
+    return 0;
+}
+
+static int _thread_pool_submit(thread_pool_t *pool, thread_pool_job_t func, void *arg, int block) {
+    struct thread_pool_entry *entry = malloc(sizeof(struct thread_pool_entry));
+    if (entry == NULL) {
+        errorf("failed to allocate memory for thread pool job\n");
+        return -1;
+    }
+    *entry = (struct thread_pool_entry){
+        .func = func,
+        .arg = arg,
+        .next = NULL
+    };
+
+    _thread_pool_lock(pool);
+    while (pool->max_queued != 0 && pool->n_queued >= pool->max_queued && !pool->shutting_down) {
+        if (!block) {
+            _thread_pool_unlock(pool);
+            free(entry);
+            return 1;
+        }
+        cnd_wait(&pool->has_space, &pool->lock);
+    }
+    if (pool->shutting_down) {
+        _thread_pool_unlock(pool);
+        free(entry);
+        errorf("submitted a job to a thread pool that is shutting down\n");
+        return -1;
+    }
+    int result = _thread_pool_enqueue(pool, entry);
+    _thread_pool_unlock(pool);
+    if (result != 0) {
+        free(entry);
+    }
+    return result;
+}
+
+int thread_pool_submit(thread_pool_t *pool, thread_pool_job_t func, void *arg) {
+    return _thread_pool_submit(pool, func, arg, 1);
+}
+
+int thread_pool_try_submit(thread_pool_t *pool, thread_pool_job_t func, void *arg) {
+    return _thread_pool_submit(pool, func, arg, 0);
+}
+
+size_t thread_pool_get_thread_count(thread_pool_t *pool) {
+    _thread_pool_lock(pool);
+    size_t n_threads = pool->n_threads;
+    _thread_pool_unlock(pool);
+    return n_threads;
+}
+
+void thread_pool_destroy(thread_pool_t *pool) {
+    if (pool == NULL) return;
+
+    _thread_pool_lock(pool);
+    pool->shutting_down = 1;
+    cnd_broadcast(&pool->has_work);
+    cnd_broadcast(&pool->has_space);
+    _thread_pool_unlock(pool);
+
+    // Only this thread touches n_threads now that submissions are refused
+    for (size_t i = 0; i < pool->n_threads; i++) {
+        thrd_join(pool->threads[i], NULL);
+    }
+
+    cnd_destroy(&pool->has_space);
+    cnd_destroy(&pool->has_work);
+    mtx_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
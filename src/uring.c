@@ -0,0 +1,171 @@
+#define _GNU_SOURCE
+#include "uring.h"
+#include "logging.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+struct uring {
+    int fd;
+    unsigned entries;
+
+    void *ring;
+    size_t ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    // Tail of the SQEs handed out by uring_get_sqe(), published to the kernel
+    // on the next uring_submit_and_wait()
+    unsigned sqe_tail;
+
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+static int _io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int _io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t arg_size) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+uring_t *uring_create(unsigned entries) {
+    struct io_uring_params params = {};
+    int fd = _io_uring_setup(entries, &params);
+    if (fd < 0) {
+        debugf("io_uring_setup() failed: '%s'\n", strerror(errno));
+        return NULL;
+    }
+
+    // Waiting with a timeout needs EXT_ARG, and a single mmap keeps the
+    // setup simple; anything older is treated as not having io_uring
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+        debugf("io_uring is missing required features (%x)\n", params.features);
+        close(fd);
+        return NULL;
+    }
+
+    uring_t *ring = malloc(sizeof(uring_t));
+    if (ring == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    ring->ring = mmap(NULL, ring->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->ring == MAP_FAILED) {
+        free(ring);
+        close(fd);
+        return NULL;
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        munmap(ring->ring, ring->ring_size);
+        free(ring);
+        close(fd);
+        return NULL;
+    }
+
+    unsigned char *base = ring->ring;
+    ring->fd = fd;
+    ring->entries = params.sq_entries;
+    ring->sq_head = (unsigned*) (base + params.sq_off.head);
+    ring->sq_tail = (unsigned*) (base + params.sq_off.tail);
+    ring->sq_mask = (unsigned*) (base + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*) (base + params.sq_off.array);
+    ring->sqe_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned*) (base + params.cq_off.head);
+    ring->cq_tail = (unsigned*) (base + params.cq_off.tail);
+    ring->cq_mask = (unsigned*) (base + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (base + params.cq_off.cqes);
+
+    return ring;
+}
+
+int uring_get_fd(uring_t *ring) {
+    return ring->fd;
+}
+
+struct io_uring_sqe *uring_get_sqe(uring_t *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->entries) {
+        // Submission queue is full, flush it to the kernel and try again
+        if (uring_submit_and_wait(ring, 0) < 0) {
+            return NULL;
+        }
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (ring->sqe_tail - head >= ring->entries) {
+            return NULL;
+        }
+    }
+    unsigned index = ring->sqe_tail & *ring->sq_mask;
+    ring->sq_array[index] = index;
+    ring->sqe_tail++;
+
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+int uring_submit_and_wait(uring_t *ring, int64_t timeout_ns) {
+    unsigned to_submit = ring->sqe_tail - *ring->sq_tail;
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+    // A zero timeout only submits; a negative one waits indefinitely
+    unsigned flags = 0, min_complete = 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg = {};
+    if (timeout_ns != 0) {
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        min_complete = 1;
+        if (timeout_ns > 0) {
+            ts = (struct __kernel_timespec){
+                .tv_sec = timeout_ns / 1000000000,
+                .tv_nsec = timeout_ns % 1000000000
+            };
+            arg.ts = (uint64_t) (uintptr_t) &ts;
+        }
+    } else if (to_submit == 0) {
+        return 0;
+    }
+
+    int result = _io_uring_enter(ring->fd, to_submit, min_complete, flags, &arg, sizeof(arg));
+    if (result < 0 && (errno == ETIME || errno == EINTR || errno == EBUSY)) {
+        return 0;
+    }
+    return result;
+}
+
+unsigned uring_reap(uring_t *ring, uring_completion_handler_t handler, void *arg) {
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    unsigned n = 0;
+    for (; head != tail; head++, n++) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        uint64_t user_data = cqe->user_data;
+        int32_t res = cqe->res;
+        // Release the slot before running the handler, which may submit
+        // more work
+        __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+        handler(user_data, res, arg);
+    }
+    return n;
+}
+
+void uring_destroy(uring_t *ring) {
+    if (ring == NULL) return;
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->ring, ring->ring_size);
+    close(ring->fd);
+    free(ring);
+}
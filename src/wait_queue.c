@@ -0,0 +1,172 @@
+#define _GNU_SOURCE
+#include "wait_queue.h"
+#include "async.h"
+#include "cancel.h"
+#include "logging.h"
+#include <errno.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <threads.h>
+#include <unistd.h>
+
+#define WAIT_QUEUE_SPINS_BEFORE_YIELD 64
+
+// Lives on the stack of whoever waits, which can't return before it has been
+// taken off the queue
+struct wait_queue_node {
+    ilist_node_t link;
+    wait_queue_t *q;
+    // NULL for a thread waiting outside of any coroutine
+    coroutine_t *co;
+    atomic_uint woken;
+    // Set under the lock by the waker that takes the node off the queue
+    int is_taken;
+    int is_interrupted;
+};
+
+static void _wait_queue_lock(wait_queue_t *q) {
+    unsigned spins = 0;
+    while (atomic_exchange_explicit(&q->lock, 1, memory_order_acquire)) {
+        while (atomic_load_explicit(&q->lock, memory_order_relaxed)) {
+            // The holder may have been preempted
+            if (++spins % WAIT_QUEUE_SPINS_BEFORE_YIELD == 0) {
+                thrd_yield();
+            } else {
+                __builtin_ia32_pause();
+            }
+        }
+    }
+}
+
+static void _wait_queue_unlock(wait_queue_t *q) {
+    atomic_store_explicit(&q->lock, 0, memory_order_release);
+}
+
+void wait_queue_init(wait_queue_t *q) {
+    atomic_init(&q->lock, 0);
+    atomic_init(&q->n_waiting, 0);
+    ilist_init(&q->waiters);
+}
+
+void wait_queue_prepare(wait_queue_t *q) {
+    _wait_queue_lock(q);
+    atomic_fetch_add_explicit(&q->n_waiting, 1, memory_order_relaxed);
+    // Pairs with the fence in wait_queue_has_waiters(): either the waker sees
+    // this waiter, or the condition checked next sees what the waker did
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void wait_queue_cancel(wait_queue_t *q) {
+    atomic_fetch_sub_explicit(&q->n_waiting, 1, memory_order_relaxed);
+    _wait_queue_unlock(q);
+}
+
+int wait_queue_has_waiters(wait_queue_t *q) {
+    atomic_thread_fence(memory_order_seq_cst);
+    return atomic_load_explicit(&q->n_waiting, memory_order_relaxed) > 0;
+}
+
+// Runs on the waiting coroutine's own context
+static void _wait_queue_interrupt(coroutine_t *co, void *arg) {
+    struct wait_queue_node *node = (struct wait_queue_node*) arg;
+    wait_queue_t *q = node->q;
+    _wait_queue_lock(q);
+    // Unless a waker has taken it off the queue already, and is waking it up
+    int is_queued = !node->is_taken;
+    if (is_queued) {
+        ilist_remove(&node->link);
+        atomic_fetch_sub_explicit(&q->n_waiting, 1, memory_order_relaxed);
+    }
+    _wait_queue_unlock(q);
+    if (!is_queued) return;
+    node->is_interrupted = 1;
+    coro_remove_waiting(co, AWAITABLE_WAIT_QUEUE(q));
+}
+
+int wait_queue_wait(wait_queue_t *q) {
+    async_context_t *ctx = async_context_get_current();
+    struct wait_queue_node node = {
+        .q = q,
+        .co = ctx != NULL ? async_context_get_current_coroutine(ctx) : NULL
+    };
+    atomic_init(&node.woken, 0);
+
+    if (node.co != NULL) {
+        if (async_is_cancelled()) {
+            wait_queue_cancel(q);
+            errno = ECANCELED;
+            return -1;
+        }
+        ilist_push_back(&q->waiters, &node.link);
+        if (coro_add_waiting(node.co, AWAITABLE_WAIT_QUEUE(q)) != 0) {
+            errorf("failed to add wait queue to waiting list of coroutine at %p\n", node.co);
+            abort();
+        }
+        coro_set_interrupt(node.co, _wait_queue_interrupt, &node);
+        _wait_queue_unlock(q);
+        // Parked until the waker removes the wait queue from this coroutine
+        async_yield();
+        coro_set_interrupt(node.co, NULL, NULL);
+        if (node.is_interrupted) {
+            errno = ECANCELED;
+            return -1;
+        }
+        return 0;
+    }
+
+    ilist_push_back(&q->waiters, &node.link);
+    _wait_queue_unlock(q);
+    while (!atomic_load_explicit(&node.woken, memory_order_acquire)) {
+        syscall(SYS_futex, &node.woken, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0);
+    }
+    return 0;
+}
+
+static void _wait_queue_wake_node(wait_queue_t *q, struct wait_queue_node *node) {
+    coroutine_t *co = node->co;
+    if (co == NULL) {
+        // The node may be gone as soon as woken is set, the futex call only
+        // uses its address
+        atomic_store_explicit(&node->woken, 1, memory_order_release);
+        syscall(SYS_futex, &node->woken, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+        return;
+    }
+    async_context_t *owner = coro_get_context(co);
+    if (owner != async_context_get_current()) {
+        if (async_post_wakeup(owner, co, AWAITABLE_WAIT_QUEUE(q)) != 0) {
+            errorf("failed to post wakeup for coroutine at %p\n", co);
+            abort();
+        }
+        return;
+    }
+    coro_remove_waiting(co, AWAITABLE_WAIT_QUEUE(q));
+}
+
+size_t wait_queue_wake_if(wait_queue_t *q, size_t n, int (*claim)(void *arg), void *arg) {
+    ilist_t woken;
+    ilist_init(&woken);
+    size_t n_woken = 0;
+    _wait_queue_lock(q);
+    while (n_woken < n && !ilist_is_empty(&q->waiters)) {
+        if (claim != NULL && !claim(arg)) break;
+        ilist_node_t *link = ilist_pop_front(&q->waiters);
+        ilist_entry(link, struct wait_queue_node, link)->is_taken = 1;
+        ilist_push_back(&woken, link);
+        n_woken++;
+    }
+    atomic_fetch_sub_explicit(&q->n_waiting, n_woken, memory_order_relaxed);
+    _wait_queue_unlock(q);
+
+    ilist_node_t *link;
+    while ((link = ilist_pop_front(&woken)) != NULL) {
+        _wait_queue_wake_node(q, ilist_entry(link, struct wait_queue_node, link));
+    }
+    return n_woken;
+}
+
+size_t wait_queue_wake(wait_queue_t *q, size_t n) {
+    if (n == 0 || !wait_queue_has_waiters(q)) return 0;
+    return wait_queue_wake_if(q, n, NULL, NULL);
+}
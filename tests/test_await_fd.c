@@ -0,0 +1,165 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "async.h"
+#include "future.h"
+#include "logging.h"
+
+#define TOTAL_BYTES (256 * 1024)
+
+int fds[2];
+
+void *reader(void *arg) {
+    (void) arg;
+    char buffer[4096];
+    size_t total = 0;
+    ssize_t n;
+    while ((n = read(fds[0], buffer, sizeof(buffer))) != 0) {
+        if (n < 0) {
+            async_await_fd(fds[0], POLLIN);
+            continue;
+        }
+        total += n;
+    }
+    printf("read %zu bytes\n", total);
+    return NULL;
+}
+
+void *writer(void *arg) {
+    (void) arg;
+    static char buffer[TOTAL_BYTES];
+    memset(buffer, 'x', sizeof(buffer));
+
+    // The pipe buffer is smaller than this, so the writer has to wait for
+    // the reader to make room
+    size_t written = 0;
+    int waits = 0;
+    while (written < sizeof(buffer)) {
+        ssize_t n = write(fds[1], buffer + written, sizeof(buffer) - written);
+        if (n < 0) {
+            async_await_fd(fds[1], POLLOUT);
+            waits++;
+            continue;
+        }
+        written += n;
+    }
+    printf("writer had to wait: %s\n", waits > 0 ? "yes" : "no");
+    async_forget_fd(fds[1]);
+    close(fds[1]);
+    return NULL;
+}
+
+void *late_writer(void *arg) {
+    (void) arg;
+    // Lets the reader park first
+    async_yield();
+    write(fds[1], "y", 1);
+    return NULL;
+}
+
+static int wait_result = 0;
+static int wait_errno = 0;
+static int is_wait_done = 0;
+
+void *waiter(void *arg) {
+    wait_result = async_await_fd(*(int*) arg, POLLIN);
+    wait_errno = errno;
+    is_wait_done = 1;
+    return NULL;
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    if (pipe(fds) != 0) return NULL;
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+    future_t *r = future_create_from_function(reader, NULL, FUT_OPT_EAGER);
+    future_t *w = future_create_from_function(writer, NULL, FUT_OPT_EAGER);
+    async_await_future(r);
+    async_await_future(w);
+    future_destroy(r);
+    future_destroy(w);
+
+    // Closed without async_forget_fd(), so the next pipe reuses the fd
+    // number of a descriptor that still looks registered
+    int old_fd = fds[0];
+    close(fds[0]);
+    if (pipe(fds) != 0) return NULL;
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    printf("fd reused: %s\n", fds[0] == old_fd ? "yes" : "no");
+    future_t *late = future_create_from_function(late_writer, NULL, FUT_OPT_EAGER);
+    char c = 0;
+    while (read(fds[0], &c, 1) < 0) {
+        async_await_fd(fds[0], POLLIN);
+    }
+    printf("read '%c' from the reused fd\n", c);
+    async_await_future(late);
+    future_destroy(late);
+
+    // Readiness that came in with nobody waiting is cached, and must not be
+    // handed to the next file that gets the same fd number
+    write(fds[1], "z", 1);
+    async_sleep(1000 * 1000);
+    old_fd = fds[0];
+    close(fds[0]);
+    close(fds[1]);
+    if (pipe(fds) != 0) return NULL;
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    printf("fd reused again: %s\n", fds[0] == old_fd ? "yes" : "no");
+    future_t *w2 = future_create_from_function(waiter, &fds[0], FUT_OPT_EAGER);
+    async_sleep(10 * 1000 * 1000);
+    printf("stale readiness: %s\n", is_wait_done ? "yes" : "no");
+    write(fds[1], "w", 1);
+    async_await_future(w2);
+    future_destroy(w2);
+    printf("woken by new data: %s\n", wait_result > 0 ? "yes" : "no");
+
+    // Forgetting an fd someone waits on fails their wait
+    is_wait_done = 0;
+    read(fds[0], &c, 1);
+    w2 = future_create_from_function(waiter, &fds[0], FUT_OPT_EAGER);
+    async_sleep(1000 * 1000);
+    async_forget_fd(fds[0]);
+    async_await_future(w2);
+    future_destroy(w2);
+    printf("forgotten: %d %s\n", wait_result, wait_errno == EBADF ? "EBADF" : "other");
+
+    close(fds[0]);
+    close(fds[1]);
+    return NULL;
+}
+
+int main() {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+    
+    if (async_context_run(ctx, entry, NULL) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    
+    async_context_destroy(ctx);
+
+    return 0;
+}
+
+/* TEST RESULT
+{
+    "stdout": [
+        "writer had to wait: yes",
+        "read 262144 bytes",
+        "fd reused: yes",
+        "read 'y' from the reused fd",
+        "fd reused again: yes",
+        "stale readiness: no",
+        "woken by new data: yes",
+        "forgotten: -1 EBADF"
+    ]
+}
+*/
@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include "async.h"
+#include "future.h"
+#include "logging.h"
+
+void *child(void *arg) {
+    printf("child %d\n", *(int*) arg);
+    async_yield();
+    return arg;
+}
+
+void dispatched(future_t *f, void *arg) {
+    future_resolve(f, arg, NULL);
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    future_t *a = future_create_from_function(child, &(int){1}, FUT_OPT_EAGER);
+    future_t *b = future_create_from_function(child, &(int){2}, 0);
+    future_t *c = async_dispatch(dispatched, &(int){3});
+
+    printf("a = %d\n", *(int*) async_await_future(a));
+    printf("b = %d\n", *(int*) async_await_future(b));
+    printf("c = %d\n", *(int*) async_await_future(c));
+
+    future_destroy(a);
+    future_destroy(b);
+    future_destroy(c);
+    return NULL;
+}
+
+int main() {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+    
+    if (async_context_run(ctx, entry, NULL) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    
+    async_context_destroy(ctx);
+
+    return 0;
+}
+
+/* TEST RESULT
+{
+    "stdout": [
+        "child 1",
+        "a = 1",
+        "child 2",
+        "b = 2",
+        "c = 3"
+    ]
+}
+*/
@@ -0,0 +1,269 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include "async.h"
+#include "cancel.h"
+#include "channel.h"
+#include "funcs.h"
+#include "future.h"
+#include "group.h"
+#include "logging.h"
+#include "sync.h"
+
+#define MS (1000 * 1000ull)
+
+void *slow(void *arg) {
+    async_sleep(200 * MS);
+    return arg;
+}
+
+void *fast(void *arg) {
+    return arg;
+}
+
+static int child_saw_cancel = 0;
+
+void *child(void *arg) {
+    (void) arg;
+    async_sleep(10000 * MS);
+    child_saw_cancel = async_is_cancelled();
+    return NULL;
+}
+
+void *parent(void *arg) {
+    (void) arg;
+    future_t *f = future_create_from_function(child, NULL, FUT_OPT_EAGER);
+    async_await_future(f);
+    future_destroy(f);
+    return NULL;
+}
+
+static int lazy_ran = 0;
+
+void *lazy(void *arg) {
+    (void) arg;
+    lazy_ran = 1;
+    return NULL;
+}
+
+static int abandoned_done = 0;
+
+void *abandoned(void *arg) {
+    (void) arg;
+    async_sleep(10000 * MS);
+    abandoned_done = 1;
+    return NULL;
+}
+
+static int fd_result = 0;
+static int fd_errno = 0;
+
+void *reader(void *arg) {
+    fd_result = async_await_fd(*(int*) arg, POLLIN);
+    fd_errno = errno;
+    return NULL;
+}
+
+static int chan_result = 0;
+static int chan_errno = 0;
+
+void *receiver(void *arg) {
+    int value;
+    chan_result = async_chan_recv((async_chan_t*) arg, &value);
+    chan_errno = errno;
+    return NULL;
+}
+
+static int lock_result = 0;
+static int lock_errno = 0;
+
+void *locker(void *arg) {
+    lock_result = async_mutex_lock((async_mutex_t*) arg);
+    lock_errno = errno;
+    return NULL;
+}
+
+int blocked_child(void *arg) {
+    int value;
+    return async_chan_recv((async_chan_t*) arg, &value);
+}
+
+static int join_result = 0;
+
+void *joiner(void *arg) {
+    async_group_t *g = async_group_create();
+    async_group_spawn(g, blocked_child, arg);
+    join_result = async_group_join(g);
+    async_group_destroy(g);
+    return NULL;
+}
+
+static int n_polls = 0;
+
+void spinning_job(future_t *f, void *arg) {
+    (void) arg;
+    async_cancel_token_t *token = future_get_cancel_token(f);
+    while (!async_cancel_token_is_cancelled(token)) {
+        n_polls++;
+        nanosleep(&(struct timespec){ .tv_nsec = 1000 * 1000 }, NULL);
+    }
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    // A timeout gives up on the future, which keeps running
+    future_t *f = future_create_from_function(slow, (void*) 42, FUT_OPT_EAGER);
+    void *result = async_await_future_timeout(f, 10 * MS);
+    printf("timed out: %s\n", result == NULL ? "yes" : "no");
+    printf("still pending: %s\n", future_get_state(f) == FUTURE_PENDING ? "yes" : "no");
+    result = async_await_future(f);
+    printf("finished later with %d\n", (int) (intptr_t) result);
+    future_destroy(f);
+
+    f = future_create_from_function(fast, (void*) 7, FUT_OPT_EAGER);
+    result = async_await_future_timeout(f, 1000 * MS);
+    printf("in time: %d\n", (int) (intptr_t) result);
+    future_destroy(f);
+
+    // Cancelling a future cancels what it started
+    uint64_t start = async_now();
+    f = future_create_from_function(parent, NULL, FUT_OPT_EAGER);
+    async_sleep(10 * MS);
+    printf("cancel pending: %d\n", future_cancel(f));
+    async_await_future(f);
+    printf("parent cancelled: %s\n", future_is_cancelled(f) ? "yes" : "no");
+    future_destroy(f);
+    // The child is woken up and returns on its own
+    async_sleep(10 * MS);
+    printf("child saw cancel: %s\n", child_saw_cancel ? "yes" : "no");
+    f = future_create_from_function(fast, NULL, FUT_OPT_EAGER);
+    async_await_future(f);
+    printf("cancel settled: %d\n", future_cancel(f));
+    future_destroy(f);
+
+    f = future_create_from_function(lazy, NULL, 0);
+    future_cancel(f);
+    printf("lazy rejected: %s\n", future_get_state(f) == FUTURE_REJECTED ? "yes" : "no");
+    future_destroy(f);
+    async_sleep(10 * MS);
+    printf("lazy ran: %s\n", lazy_ran ? "yes" : "no");
+
+    // Dropping a pending future is cancelling it
+    f = future_create_from_function(abandoned, NULL, FUT_OPT_EAGER);
+    async_sleep(10 * MS);
+    future_destroy(f);
+    async_sleep(10 * MS);
+    printf("abandoned returned: %s\n", abandoned_done ? "yes" : "no");
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        errorf("failed to create pipe\n");
+        return NULL;
+    }
+    f = future_create_from_function(reader, &fds[0], FUT_OPT_EAGER);
+    async_sleep(10 * MS);
+    future_cancel(f);
+    async_sleep(10 * MS);
+    printf("await_fd: %d %s\n", fd_result, fd_errno == ECANCELED ? "ECANCELED" : "other");
+    future_destroy(f);
+    async_forget_fd(fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+
+    // Waiting on a wait queue is a cancellation point too
+    async_chan_t *c = async_chan_create(1, sizeof(int));
+    f = future_create_from_function(receiver, c, FUT_OPT_EAGER);
+    async_sleep(10 * MS);
+    future_cancel(f);
+    async_sleep(10 * MS);
+    printf("chan_recv: %d %s\n", chan_result, chan_errno == ECANCELED ? "ECANCELED" : "other");
+    future_destroy(f);
+    // The cancelled receiver is off the queue, and takes nothing sent later
+    int value = 3;
+    async_chan_send(c, &value);
+    value = 0;
+    int received = async_chan_try_recv(c, &value);
+    printf("sent after cancel: %d %d\n", received, value);
+
+    async_mutex_t m;
+    async_mutex_init(&m);
+    async_mutex_lock(&m);
+    f = future_create_from_function(locker, &m, FUT_OPT_EAGER);
+    async_sleep(10 * MS);
+    future_cancel(f);
+    async_sleep(10 * MS);
+    printf("mutex_lock: %d %s\n", lock_result, lock_errno == ECANCELED ? "ECANCELED" : "other");
+    future_destroy(f);
+    async_mutex_unlock(&m);
+    printf("unlocked for others: %d\n", async_mutex_try_lock(&m));
+    async_mutex_unlock(&m);
+
+    // A group whose child blocks on a channel joins once its owner is cancelled
+    f = future_create_from_function(joiner, c, FUT_OPT_EAGER);
+    async_sleep(10 * MS);
+    future_cancel(f);
+    async_sleep(10 * MS);
+    printf("group join: %d\n", join_result);
+    future_destroy(f);
+    async_chan_destroy(c);
+
+    // The shell doesn't exec sleep, so only killing its group gets both
+    f = async_spawn_with_options("sleep 10", ASYNC_PROC_OPT_PROCESS_GROUP);
+    async_sleep(50 * MS);
+    future_cancel(f);
+    async_sleep(10 * MS);
+    future_destroy(f);
+
+    f = async_dispatch(spinning_job, NULL);
+    async_sleep(20 * MS);
+    future_cancel(f);
+    // Settled by the cancel already, the job notices on its next poll
+    async_await_future(f);
+    future_destroy(f);
+    printf("dispatch polled: %s\n", n_polls > 0 ? "yes" : "no");
+
+    printf("all quick: %s\n", async_now() - start < 1000 * MS ? "yes" : "no");
+    return NULL;
+}
+
+int main() {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+    if (async_context_run(ctx, entry, NULL) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    async_context_destroy(ctx);
+    return 0;
+}
+
+/* TEST RESULT
+{"stdout": [
+"timed out: yes",
+"still pending: yes",
+"finished later with 42",
+"in time: 7",
+"cancel pending: 0",
+"parent cancelled: yes",
+"child saw cancel: yes",
+"cancel settled: 1",
+"lazy rejected: yes",
+"lazy ran: no",
+"abandoned returned: yes",
+"await_fd: -1 ECANCELED",
+"chan_recv: -1 ECANCELED",
+"sent after cancel: 0 3",
+"mutex_lock: -1 ECANCELED",
+"unlocked for others: 0",
+"group join: -1",
+"dispatch polled: yes",
+"all quick: yes"
+]}
+*/
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "async.h"
+#include "channel.h"
+#include "coroutine.h"
+#include "future.h"
+#include "logging.h"
+
+#define N_ITEMS 1000
+#define N_THREAD_ITEMS 500
+
+struct stage {
+    async_chan_t *in;
+    async_chan_t *out;
+};
+
+void *produce(void *arg) {
+    async_chan_t *out = (async_chan_t*) arg;
+    for (int i = 1; i <= N_ITEMS; i++) {
+        if (async_chan_send(out, &i) != 0) break;
+    }
+    async_chan_close(out);
+    return NULL;
+}
+
+void *square(void *arg) {
+    struct stage *stage = (struct stage*) arg;
+    int value;
+    while (async_chan_recv(stage->in, &value) == 0) {
+        long squared = (long) value * value;
+        if (async_chan_send(stage->out, &squared) != 0) break;
+    }
+    async_chan_close(stage->out);
+    return NULL;
+}
+
+void *consume(void *arg) {
+    async_chan_t *in = (async_chan_t*) arg;
+    long sum = 0, value;
+    while (async_chan_recv(in, &value) == 0) {
+        sum += value;
+    }
+    return (void*) (intptr_t) sum;
+}
+
+void send_from_thread(future_t *f, void *arg) {
+    async_chan_t *c = (async_chan_t*) arg;
+    for (int i = 1; i <= N_THREAD_ITEMS; i++) {
+        async_chan_send(c, &i);
+    }
+    async_chan_close(c);
+    future_resolve(f, NULL, NULL);
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    // Small capacities so that every stage keeps filling up and draining
+    async_chan_t *numbers = async_chan_create(3, sizeof(int));
+    async_chan_t *squares = async_chan_create(4, sizeof(long));
+    printf("capacity = %zu\n", async_chan_get_capacity(numbers));
+
+    struct stage stage = { .in = numbers, .out = squares };
+    future_t *producer = future_create_from_function(produce, numbers, FUT_OPT_EAGER);
+    future_t *squarer = future_create_from_function(square, &stage, FUT_OPT_EAGER);
+    future_t *consumer = future_create_from_function(consume, squares, FUT_OPT_EAGER);
+    printf("pipeline sum = %ld\n", (long) (intptr_t) async_await_future(consumer));
+    async_await_future(producer);
+    async_await_future(squarer);
+    future_destroy(producer);
+    future_destroy(squarer);
+    future_destroy(consumer);
+    async_chan_destroy(numbers);
+    async_chan_destroy(squares);
+
+    async_chan_t *c = async_chan_create(2, sizeof(int));
+    int value = 7;
+    printf("try_recv empty = %d\n", async_chan_try_recv(c, &value));
+    int first = async_chan_try_send(c, &value);
+    int second = async_chan_try_send(c, &value);
+    printf("try_send = %d, %d, full = %d\n", first, second, async_chan_try_send(c, &value));
+    async_chan_close(c);
+    printf("send after close = %d\n", async_chan_send(c, &value));
+    int a = 0, b = 0;
+    first = async_chan_recv(c, &a);
+    second = async_chan_recv(c, &b);
+    printf("recv after close = %d, %d, %d\n", first, second, async_chan_try_recv(c, &value));
+    printf("drained = %d %d\n", a, b);
+    async_chan_destroy(c);
+
+    // A dispatch thread has no coroutine, so it sleeps when the channel is full
+    c = async_chan_create(8, sizeof(int));
+    future_t *sender = async_dispatch(send_from_thread, c);
+    long sum = 0;
+    while (async_chan_recv(c, &value) == 0) {
+        sum += value;
+    }
+    async_await_future(sender);
+    future_destroy(sender);
+    async_chan_destroy(c);
+    printf("thread sum = %ld\n", sum);
+    return NULL;
+}
+
+int main() {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+    if (async_context_run(ctx, entry, NULL) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    async_context_destroy(ctx);
+    return 0;
+}
+
+/* TEST RESULT
+{
+    "stdout": [
+        "capacity = 4",
+        "pipeline sum = 333833500",
+        "try_recv empty = 1",
+        "try_send = 0, 0, full = 1",
+        "send after close = -1",
+        "recv after close = 0, 0, -1",
+        "drained = 7 7",
+        "thread sum = 125250"
+    ]
+}
+*/
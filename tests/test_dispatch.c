@@ -0,0 +1,69 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <stdatomic.h>
+#include "async.h"
+#include "future.h"
+#include "logging.h"
+
+#define N_JOBS 32
+#define MAX_THREADS 2
+#define MAX_QUEUED 4
+
+static atomic_int running = 0;
+static atomic_int max_running = 0;
+
+void job(future_t *f, void *arg) {
+    int now = atomic_fetch_add(&running, 1) + 1;
+    int seen = atomic_load(&max_running);
+    while (now > seen && !atomic_compare_exchange_weak(&max_running, &seen, now));
+
+    nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+
+    atomic_fetch_sub(&running, 1);
+    future_resolve(f, arg, NULL);
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    future_t *jobs[N_JOBS];
+    for (uintptr_t i = 0; i < N_JOBS; i++) {
+        jobs[i] = async_dispatch(job, (void*) i);
+    }
+
+    uintptr_t sum = 0;
+    for (size_t i = 0; i < N_JOBS; i++) {
+        sum += (uintptr_t) async_await_future(jobs[i]);
+        future_destroy(jobs[i]);
+    }
+    printf("sum = %lu\n", (unsigned long) sum);
+    printf("at most %d threads: %s\n", MAX_THREADS, atomic_load(&max_running) <= MAX_THREADS ? "yes" : "no");
+    return NULL;
+}
+
+int main() {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+    if (async_context_set_dispatch_limits(ctx, MAX_THREADS, MAX_QUEUED) != 0) {
+        errorf("failed to set dispatch limits\n");
+        return 1;
+    }
+
+    if (async_context_run(ctx, entry, NULL) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+
+    async_context_destroy(ctx);
+    return 0;
+}
+
+/* TEST RESULT
+{
+    "stdout": "sum = 496\nat most 2 threads: yes"
+}
+*/
@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "async.h"
+#include "future.h"
+#include "coroutine.h"
+#include "logging.h"
+
+#define MS 1000000ull
+
+struct delayed {
+    future_t *future;
+    int value;
+    int delay_ms;
+    int reject;
+};
+
+void *settle_later(void *arg) {
+    struct delayed *d = arg;
+    async_sleep(d->delay_ms * MS);
+    if (d->reject) {
+        future_reject(d->future);
+    } else {
+        future_resolve(d->future, (void*) (intptr_t) d->value, NULL);
+    }
+    free(d);
+    return NULL;
+}
+
+future_t *delayed(int value, int delay_ms, int reject) {
+    future_t *f = future_create(0);
+    future_set_state(f, FUTURE_PENDING);
+    struct delayed *d = malloc(sizeof(struct delayed));
+    *d = (struct delayed){ .future = f, .value = value, .delay_ms = delay_ms, .reject = reject };
+    async_schedule_coroutine(async_context_get_current(), coro_create(settle_later, d, 0));
+    return f;
+}
+
+const char *state_name(future_t *f) {
+    return future_get_state(f) == FUTURE_RESOLVED ? "resolved" : "rejected";
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    future_t *all = future_all((future_t*[]){ delayed(1, 20, 0), delayed(2, 10, 0), delayed(3, 0, 0) }, 3, 1);
+    future_sized_array_t *members = async_await_future(all);
+    printf("all: %d %d %d\n",
+        (int) (intptr_t) future_borrow_return_value(members->future_arr[0]),
+        (int) (intptr_t) future_borrow_return_value(members->future_arr[1]),
+        (int) (intptr_t) future_borrow_return_value(members->future_arr[2]));
+
+    future_t *inputs[] = { delayed(1, 10, 1), delayed(2, 50, 0) };
+    future_destroy(all);
+    all = future_all_fail_fast(inputs, 2, 0);
+    async_await_future(all);
+    printf("all_fail_fast: %s, before the slow input: %s\n",
+        state_name(all), future_get_state(inputs[1]) == FUTURE_PENDING ? "yes" : "no");
+    future_destroy(all);
+
+    // A rejected input doesn't keep future_all() from waiting for the rest
+    all = future_all(inputs, 2, 0);
+    members = async_await_future(all);
+    printf("all with a rejection: %s, members %s %s\n",
+        state_name(all), state_name(members->future_arr[0]), state_name(members->future_arr[1]));
+    future_destroy(all);
+    future_destroy(inputs[0]);
+    future_destroy(inputs[1]);
+
+    future_t *any_inputs[] = { delayed(1, 0, 1), delayed(2, 10, 0), delayed(3, 20, 0) };
+    future_t *any = future_any(any_inputs, 3);
+    future_t *winner = async_await_future(any);
+    printf("any: %d\n", (int) (intptr_t) future_borrow_return_value(winner));
+
+    future_t *race_inputs[] = { delayed(1, 0, 1), delayed(2, 10, 0) };
+    future_t *race = future_race(race_inputs, 2);
+    async_await_future(race);
+    printf("race: %s\n", state_name(race));
+
+    future_destroy(any);
+    future_destroy(race);
+    // The inputs that lost still have to settle before they can go
+    for (size_t i = 0; i < 3; i++) {
+        async_await_future(any_inputs[i]);
+        future_destroy(any_inputs[i]);
+    }
+    for (size_t i = 0; i < 2; i++) {
+        async_await_future(race_inputs[i]);
+        future_destroy(race_inputs[i]);
+    }
+
+    future_t *none = future_any(NULL, 0);
+    async_await_future(none);
+    printf("any of nothing: %s\n", state_name(none));
+    future_destroy(none);
+    return NULL;
+}
+
+int main() {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+
+    if (async_context_run(ctx, entry, NULL) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+
+    async_context_destroy(ctx);
+
+    return 0;
+}
+
+/* TEST RESULT
+{
+    "stdout": [
+        "all: 1 2 3",
+        "all_fail_fast: rejected, before the slow input: yes",
+        "all with a rejection: resolved, members rejected resolved",
+        "any: 2",
+        "race: rejected",
+        "any of nothing: rejected"
+    ]
+}
+*/
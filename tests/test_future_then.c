@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "async.h"
+#include "cancel.h"
+#include "funcs.h"
+#include "future.h"
+#include "logging.h"
+
+#define MS (1000 * 1000ull)
+
+void *parse_status(void *value, void *arg) {
+    (void) arg;
+    async_spawn_result_t *result = (async_spawn_result_t*) value;
+    int *parsed = malloc(sizeof(int));
+    *parsed = atoi(result->stdout);
+    return parsed;
+}
+
+void *add_one(void *value, void *arg) {
+    (void) arg;
+    int *parsed = (int*) value;
+    return (void*) (intptr_t) (*parsed + 1);
+}
+
+static int n_mapped = 0;
+
+void *count(void *value, void *arg) {
+    (void) arg;
+    n_mapped++;
+    return value;
+}
+
+void recover(future_t *result, future_state_e state, void *value, void *arg) {
+    if (state == FUTURE_RESOLVED) {
+        future_resolve(result, value, NULL);
+    } else {
+        future_resolve(result, arg, NULL);
+    }
+}
+
+void answer(future_t *f, void *arg) {
+    (void) arg;
+    future_resolve(f, (void*) 42, NULL);
+}
+
+static int was_cancelled = 0;
+
+void *sleeper(void *arg) {
+    (void) arg;
+    async_sleep(10000 * MS);
+    was_cancelled = async_is_cancelled();
+    return NULL;
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    // A parsed child's output, without a coroutine for the parsing
+    future_t *parsed = future_map(async_spawn("echo 41"), parse_status, NULL, free);
+    future_t *f = future_map(parsed, add_one, NULL, NULL);
+    printf("mapped: %d\n", (int) (intptr_t) async_await_future(f));
+    future_destroy(f);
+
+    // A rejection skips a map, but a then sees it
+    f = future_map(future_map(async_spawn("exit 3"), count, NULL, NULL), count, NULL, NULL);
+    async_await_future(f);
+    printf("rejected: %s, mapped %d times\n", future_get_state(f) == FUTURE_REJECTED ? "yes" : "no", n_mapped);
+    future_destroy(f);
+    f = future_then(async_spawn("exit 3"), recover, "fallback");
+    printf("recovered: %s\n", (char*) async_await_future(f));
+    future_destroy(f);
+
+    // Runs straight away for a settled input
+    future_t *input = future_create(0);
+    future_set_state(input, FUTURE_PENDING);
+    future_resolve(input, (void*) 7, NULL);
+    f = future_map(input, count, NULL, NULL);
+    printf("settled input: %s\n", future_get_state(f) == FUTURE_RESOLVED ? "resolved" : "pending");
+    future_destroy(f);
+
+    // Or on the thread that settles it
+    f = future_map(async_dispatch(answer, NULL), count, NULL, NULL);
+    printf("dispatched: %d\n", (int) (intptr_t) async_await_future(f));
+    future_destroy(f);
+
+    n_mapped = 0;
+    f = future_map(future_create_from_function(sleeper, NULL, FUT_OPT_EAGER), count, NULL, NULL);
+    async_sleep(5 * MS);
+    future_destroy(f);
+    async_sleep(5 * MS);
+    printf("input cancelled: %s, mapped %d times\n", was_cancelled ? "yes" : "no", n_mapped);
+    return NULL;
+}
+
+int main() {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+    if (async_context_run(ctx, entry, NULL) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    async_context_destroy(ctx);
+    return 0;
+}
+
+/* TEST RESULT
+{"stdout": [
+"mapped: 42",
+"rejected: yes, mapped 0 times",
+"recovered: fallback",
+"settled input: resolved",
+"dispatched: 42",
+"input cancelled: yes, mapped 0 times"
+]}
+*/
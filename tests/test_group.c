@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "async.h"
+#include "cancel.h"
+#include "future.h"
+#include "group.h"
+#include "logging.h"
+
+#define MS (1000 * 1000ull)
+#define N_CHILDREN 200
+
+static int sum = 0;
+
+int adder(void *arg) {
+    int value = (int) (intptr_t) arg;
+    async_sleep((value % 5) * MS);
+    sum += value;
+    return 0;
+}
+
+static int n_cancelled = 0;
+static int n_finished = 0;
+
+int sleeper(void *arg) {
+    (void) arg;
+    async_sleep(10000 * MS);
+    if (async_is_cancelled()) {
+        n_cancelled++;
+    } else {
+        n_finished++;
+    }
+    return 0;
+}
+
+int failing(void *arg) {
+    (void) arg;
+    async_sleep(5 * MS);
+    return -1;
+}
+
+void *owner(void *arg) {
+    (void) arg;
+    async_group_t *g = async_group_create();
+    for (int i = 0; i < 10; i++) {
+        async_group_spawn(g, sleeper, NULL);
+    }
+    async_group_join(g);
+    async_group_destroy(g);
+    return NULL;
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    async_group_t *g = async_group_create();
+    for (int i = 0; i < N_CHILDREN; i++) {
+        async_group_spawn(g, adder, (void*) (intptr_t) i);
+    }
+    printf("join: %d\n", async_group_join(g));
+    printf("sum = %d\n", sum);
+    async_group_destroy(g);
+
+    // The first failure cancels every sibling
+    uint64_t start = async_now();
+    g = async_group_create();
+    for (int i = 0; i < 10; i++) {
+        async_group_spawn(g, sleeper, NULL);
+    }
+    async_group_spawn(g, failing, NULL);
+    printf("join after failure: %d\n", async_group_join(g));
+    printf("cancelled: %d, finished: %d\n", n_cancelled, n_finished);
+    printf("spawn after failure: %d\n", async_group_spawn(g, adder, NULL));
+    async_group_destroy(g);
+
+    // Cancelling the coroutine that owns a group cancels the group
+    n_cancelled = 0;
+    future_t *f = future_create_from_function(owner, NULL, FUT_OPT_EAGER);
+    async_sleep(5 * MS);
+    future_cancel(f);
+    async_sleep(5 * MS);
+    printf("owner cancelled: %d\n", n_cancelled);
+    future_destroy(f);
+
+    // Dropping a group without joining it cancels what still runs
+    n_cancelled = 0;
+    g = async_group_create();
+    for (int i = 0; i < 10; i++) {
+        async_group_spawn(g, sleeper, NULL);
+    }
+    async_sleep(5 * MS);
+    async_group_destroy(g);
+    printf("destroyed: %d\n", n_cancelled);
+
+    printf("all quick: %s\n", async_now() - start < 1000 * MS ? "yes" : "no");
+    return NULL;
+}
+
+int main() {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+    if (async_context_run(ctx, entry, NULL) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    async_context_destroy(ctx);
+    return 0;
+}
+
+/* TEST RESULT
+{"stdout": [
+"join: 0",
+"sum = 19900",
+"join after failure: -1",
+"cancelled: 10, finished: 0",
+"spawn after failure: -1",
+"owner cancelled: 10",
+"destroyed: 10",
+"all quick: yes"
+]}
+*/
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "heap.h"
+#include "logging.h"
+
+struct timer {
+    uint64_t deadline;
+    int id;
+};
+
+uint64_t timer_priority(void *element) {
+    return ((struct timer*) element)->deadline;
+}
+
+int main() {
+    heap h = heap_create(2, sizeof(struct timer), timer_priority);
+    if (h == NULL) {
+        errorf("failed to create heap\n");
+        return 1;
+    }
+
+    heap_handle_t handles[10];
+    for (int i = 0; i < 10; i++) {
+        // Deadlines 0, 70, 40, 10, 80, 50, 20, 90, 60, 30
+        struct timer t = { .deadline = (i * 7 % 10) * 10, .id = i };
+        if (heap_insert_with_handle(h, &t, &handles[i]) != 0) {
+            errorf("failed to insert into heap\n");
+            return 1;
+        }
+    }
+
+    // Cancel two timers and move two others to the front and the back
+    heap_remove(h, handles[2]);
+    heap_remove(h, handles[6]);
+    ((struct timer*) heap_get(h, handles[3]))->deadline = 5;
+    heap_update(h, handles[3]);
+    ((struct timer*) heap_get(h, handles[9]))->deadline = 100;
+    heap_update(h, handles[9]);
+    printf("size = %zu\n", heap_size(h));
+
+    // A freed slot is reused without disturbing the others
+    heap_insert(h, &(struct timer){ .deadline = 45, .id = 10 });
+
+    while (!heap_empty(h)) {
+        struct timer *t = heap_min(h);
+        printf("%d@%lu ", t->id, t->deadline);
+        heap_pop(h);
+    }
+    printf("\n");
+
+    heap_destroy(h);
+    return 0;
+}
+
+/* TEST RESULT
+{
+    "stdout": [
+        "size = 8",
+        "0@0 3@5 10@45 5@50 8@60 1@70 4@80 7@90 9@100 "
+    ]
+}
+*/
@@ -0,0 +1,155 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "async.h"
+#include "future.h"
+#include "io.h"
+#include "logging.h"
+
+intptr_t await_result(future_t *f) {
+    intptr_t result = (intptr_t) async_await_future(f);
+    future_destroy(f);
+    return result;
+}
+
+void test_file() {
+    char path[] = "/tmp/test_io_XXXXXX";
+    int fd = mkstemp(path);
+    unlink(path);
+
+    char buffer[16] = {};
+    printf("wrote %ld bytes\n", (long) await_result(async_write(fd, "hello file", 10, 0)));
+    printf("read %ld bytes: '%s'\n", (long) await_result(async_read(fd, buffer, sizeof(buffer) - 1, 0)), buffer);
+    close(fd);
+}
+
+void test_loopback() {
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        .sin_port = 0
+    };
+    socklen_t addrlen = sizeof(addr);
+    bind(listener, (struct sockaddr*) &addr, sizeof(addr));
+    listen(listener, 1);
+    getsockname(listener, (struct sockaddr*) &addr, &addrlen);
+
+    future_t *accepted = async_accept(listener, NULL, NULL);
+
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    connect(client, (struct sockaddr*) &addr, sizeof(addr));
+
+    int server = (int) await_result(accepted);
+    printf("accepted: %s\n", server >= 0 ? "yes" : "no");
+
+    char buffer[16] = {};
+    printf("sent %ld bytes\n", (long) await_result(async_write(client, "hello socket", 12, -1)));
+    printf("received %ld bytes: '%s'\n", (long) await_result(async_read(server, buffer, sizeof(buffer) - 1, -1)), buffer);
+
+    async_forget_fd(listener);
+    close(server);
+    close(client);
+    close(listener);
+}
+
+static int reader_done = 0;
+static intptr_t reader_result = 0;
+
+void *cancelled_reader(void *arg) {
+    int fd = *(int*) arg;
+    // The kernel is done with it by the time the await returns
+    char buffer[16];
+    reader_result = await_result(async_read(fd, buffer, sizeof(buffer), -1));
+    reader_done = 1;
+    return NULL;
+}
+
+void test_stop() {
+    int fds[2];
+    if (pipe(fds) != 0) return;
+
+    // Nothing is ever written, so the read only ends by being stopped
+    char buffer[16];
+    future_t *f = async_read(fds[0], buffer, sizeof(buffer), -1);
+    intptr_t result = (intptr_t) async_await_future_timeout(f, 10 * 1000 * 1000);
+    printf("timed out read: %s, %s\n", future_get_state(f) == FUTURE_RESOLVED ? "resolved" : "pending",
+        result == -ECANCELED ? "ECANCELED" : "other");
+    future_destroy(f);
+
+    f = future_create_from_function(cancelled_reader, &fds[0], FUT_OPT_EAGER);
+    async_yield();
+    future_cancel(f);
+    future_destroy(f);
+    // Its future is settled right away, the reader itself takes a while
+    while (!reader_done) {
+        async_sleep(1000 * 1000);
+    }
+    reader_done = 0;
+    printf("cancelled reader: %s\n", reader_result == -ECANCELED ? "ECANCELED" : "other");
+    // Written after the reader gave up, so still there to be read
+    write(fds[1], "x", 1);
+    printf("read after cancel: %ld\n", (long) await_result(async_read(fds[0], buffer, sizeof(buffer), -1)));
+
+    async_forget_fd(fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    test_file();
+    test_loopback();
+    test_stop();
+    return NULL;
+}
+
+int main() {
+    int options[] = {0, ASYNC_CTX_OPT_IO_URING};
+    for (size_t i = 0; i < 2; i++) {
+        async_context_t *ctx = async_context_create_with_options(options[i]);
+        if (ctx == NULL) {
+            errorf("failed to create async context\n");
+            return 1;
+        }
+        
+        if (async_context_run(ctx, entry, NULL) != 0) {
+            errorf("error in async context\n");
+            return 1;
+        }
+        
+        async_context_destroy(ctx);
+    }
+
+    return 0;
+}
+
+/* TEST RESULT
+{
+    "stdout": [
+        "wrote 10 bytes",
+        "read 10 bytes: 'hello file'",
+        "accepted: yes",
+        "sent 12 bytes",
+        "received 12 bytes: 'hello socket'",
+        "timed out read: resolved, ECANCELED",
+        "cancelled reader: ECANCELED",
+        "read after cancel: 1",
+        "wrote 10 bytes",
+        "read 10 bytes: 'hello file'",
+        "accepted: yes",
+        "sent 12 bytes",
+        "received 12 bytes: 'hello socket'",
+        "timed out read: resolved, ECANCELED",
+        "cancelled reader: ECANCELED",
+        "read after cancel: 1"
+    ]
+}
+*/
@@ -0,0 +1,113 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "async.h"
+#include "future.h"
+#include "logging.h"
+
+#define N_SPECULATIVE 1000
+
+static int n_runs = 0;
+
+void *work(void *arg) {
+    n_runs++;
+    return arg;
+}
+
+// The failures below are logged on purpose, and kept out of the output
+static int _silence_stderr() {
+    fflush(stderr);
+    int saved = dup(STDERR_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+    }
+    return saved;
+}
+
+static void _restore_stderr(int saved) {
+    if (saved < 0) return;
+    fflush(stderr);
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    future_t *futures[N_SPECULATIVE];
+    for (int i = 0; i < N_SPECULATIVE; i++) {
+        futures[i] = future_create_from_function(work, (void*) (intptr_t) i, 0);
+    }
+    async_yield();
+    printf("runs before start: %d\n", n_runs);
+
+    // Started explicitly, awaited, and through a combinator
+    future_start(futures[1]);
+    async_yield();
+    printf("runs after start: %d\n", n_runs);
+    printf("awaited: %d\n", (int) (intptr_t) async_await_future(futures[2]));
+    future_t *all = future_all((future_t*[]){ futures[3], futures[4] }, 2, 0);
+    async_await_future(all);
+    future_destroy(all);
+    printf("runs after all: %d\n", n_runs);
+
+    // The rest are dropped without ever getting a coroutine
+    for (int i = 0; i < N_SPECULATIVE; i++) {
+        future_destroy(futures[i]);
+    }
+    async_yield();
+    printf("runs after drop: %d\n", n_runs);
+
+    // A stack that can't be mapped rejects the future instead of leaving it
+    // pending forever
+    int saved_stderr = _silence_stderr();
+    future_t *f = future_create_from_function_with_stack_size(work, (void*) 1, 0, SIZE_MAX / 2);
+    printf("start: %d\n", future_start(f));
+    printf("rejected: %s\n", future_get_state(f) == FUTURE_REJECTED ? "yes" : "no");
+    printf("awaited: %p\n", async_await_future(f));
+    future_destroy(f);
+    f = future_create_from_function_with_stack_size(work, (void*) 1, 0, SIZE_MAX / 2);
+    printf("awaited unstarted: %p\n", async_await_future(f));
+    future_destroy(f);
+    f = future_create_from_function_with_stack_size(work, (void*) 1, FUT_OPT_EAGER, SIZE_MAX / 2);
+    printf("eager rejected: %s\n", future_get_state(f) == FUTURE_REJECTED ? "yes" : "no");
+    future_destroy(f);
+    // Too large to round up to a size class, which fails the same way
+    f = future_create_from_function_with_stack_size(work, (void*) 1, 0, SIZE_MAX);
+    printf("oversized start: %d\n", future_start(f));
+    future_destroy(f);
+    _restore_stderr(saved_stderr);
+    return NULL;
+}
+
+int main() {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+    if (async_context_run(ctx, entry, NULL) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    async_context_destroy(ctx);
+    return 0;
+}
+
+/* TEST RESULT
+{"stdout": [
+"runs before start: 0",
+"runs after start: 1",
+"awaited: 2",
+"runs after all: 4",
+"runs after drop: 4",
+"start: -1",
+"rejected: yes",
+"awaited: (nil)",
+"awaited unstarted: (nil)",
+"eager rejected: yes",
+"oversized start: -1"
+]}
+*/
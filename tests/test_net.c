@@ -0,0 +1,130 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include "async.h"
+#include "future.h"
+#include "net.h"
+#include "logging.h"
+
+void *echo_server(void *arg) {
+    int listener = *(int*) arg;
+    int fd = async_tcp_accept(listener, NULL, NULL);
+    char buffer[64];
+    ssize_t n;
+    while ((n = async_recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        if (async_send(fd, buffer, n, 0) != n) break;
+    }
+    async_close(fd);
+    return NULL;
+}
+
+static int accept_errno = 0;
+
+void *cancelled_accept(void *arg) {
+    int listener = *(int*) arg;
+    if (async_tcp_accept(listener, NULL, NULL) < 0) {
+        accept_errno = errno;
+    }
+    return NULL;
+}
+
+// Reads exactly size bytes, however the stream splits them up
+ssize_t recv_all(int fd, char *buffer, size_t size) {
+    size_t total = 0;
+    while (total < size) {
+        ssize_t n = async_recv(fd, buffer + total, size - total, 0);
+        if (n <= 0) return -1;
+        total += n;
+    }
+    return total;
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    int listener = async_tcp_listen("127.0.0.1", 0, 16);
+    struct sockaddr_in addr;
+    getsockname(listener, (struct sockaddr*) &addr, &(socklen_t){sizeof(addr)});
+    future_t *server = future_create_from_function(echo_server, &listener, FUT_OPT_EAGER);
+
+    int fd = async_tcp_connect("127.0.0.1", ntohs(addr.sin_port));
+    printf("connected: %s\n", fd >= 0 ? "yes" : "no");
+
+    char buffer[64] = {};
+    printf("sent %zd bytes\n", async_send(fd, "hello", 5, 0));
+    recv_all(fd, buffer, 5);
+    printf("echoed '%s'\n", buffer);
+
+    struct iovec out[] = { { "scatter ", 8 }, { "gather", 6 } };
+    printf("wrote %zd bytes\n", async_writev(fd, out, 2));
+    char first[9] = {}, second[7] = {};
+    struct iovec in[] = { { first, 8 }, { second, 6 } };
+    // The echo is sent back in one piece, so it arrives in one on loopback
+    printf("readv got %zd bytes\n", async_readv(fd, in, 2));
+    printf("read '%s' and '%s'\n", first, second);
+
+    char path[] = "/tmp/test_net_XXXXXX";
+    int file = mkstemp(path);
+    unlink(path);
+    write(file, "from a file", 11);
+    off_t offset = 0;
+    printf("sendfile sent %zd bytes\n", async_sendfile(fd, file, &offset, 11));
+    memset(buffer, 0, sizeof(buffer));
+    recv_all(fd, buffer, 11);
+    printf("echoed '%s'\n", buffer);
+    close(file);
+
+    async_close(fd);
+    async_await_future(server);
+    future_destroy(server);
+
+    // Nobody connects, so only cancelling it ends the accept
+    future_t *accepting = future_create_from_function(cancelled_accept, &listener, FUT_OPT_EAGER);
+    async_yield();
+    future_cancel(accepting);
+    async_yield();
+    printf("cancelled accept: %s\n", accept_errno == ECANCELED ? "ECANCELED" : strerror(accept_errno));
+    future_destroy(accepting);
+
+    async_close(listener);
+    int refused = async_tcp_connect("127.0.0.1", ntohs(addr.sin_port));
+    printf("connect after close refused: %s\n", refused < 0 && errno == ECONNREFUSED ? "yes" : "no");
+    return NULL;
+}
+
+int main() {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+
+    if (async_context_run(ctx, entry, NULL) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+
+    async_context_destroy(ctx);
+
+    return 0;
+}
+
+/* TEST RESULT
+{
+    "stdout": [
+        "connected: yes",
+        "sent 5 bytes",
+        "echoed 'hello'",
+        "wrote 14 bytes",
+        "readv got 14 bytes",
+        "read 'scatter ' and 'gather'",
+        "sendfile sent 11 bytes",
+        "echoed 'from a file'",
+        "cancelled accept: ECANCELED",
+        "connect after close refused: yes"
+    ]
+}
+*/
@@ -0,0 +1,121 @@
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include "async.h"
+#include "funcs.h"
+#include "future.h"
+#include "logging.h"
+
+// Much more than a pipe holds, so the writer has to wait for the child
+#define N_BYTES (1024 * 1024)
+#define CHUNK 4096
+
+void *feed(void *arg) {
+    async_process_t *p = arg;
+    char chunk[CHUNK];
+    memset(chunk, 'a', sizeof(chunk));
+    size_t total = 0;
+    while (total < N_BYTES) {
+        if (async_process_write_stdin(p, chunk, sizeof(chunk)) != sizeof(chunk)) {
+            errorf("failed to write to child\n");
+            break;
+        }
+        total += sizeof(chunk);
+    }
+    async_process_close_stdin(p);
+    return NULL;
+}
+
+void *drain_stderr(void *arg) {
+    async_process_t *p = arg;
+    static char err[64];
+    ssize_t n = async_process_read_stderr(p, err, sizeof(err) - 1);
+    err[n > 0 ? n : 0] = '\0';
+    // Read on until the child closes it
+    char rest[64];
+    while (async_process_read_stderr(p, rest, sizeof(rest)) > 0);
+    return err;
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    async_process_t *p = async_process_start("echo started >&2; tr a-z A-Z",
+        ASYNC_PROC_OPT_STDIN | ASYNC_PROC_OPT_STDOUT | ASYNC_PROC_OPT_STDERR);
+    if (p == NULL) {
+        errorf("failed to start child\n");
+        return NULL;
+    }
+    future_t *writer = future_create_from_function(feed, p, FUT_OPT_EAGER);
+    future_t *err = future_create_from_function(drain_stderr, p, FUT_OPT_EAGER);
+
+    size_t total = 0, upper = 0, chunks = 0;
+    char buffer[CHUNK];
+    ssize_t n;
+    while ((n = async_process_read_stdout(p, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            upper += buffer[i] == 'A';
+        }
+        total += n;
+        chunks++;
+    }
+    async_await_future(writer);
+    printf("stderr: %s", (char*) async_await_future(err));
+    printf("read %zu bytes, %zu uppercase\n", total, upper);
+    printf("arrived in pieces: %s\n", chunks > 1 ? "yes" : "no");
+    int status = async_process_wait(p);
+    printf("exit code: %d\n", WEXITSTATUS(status));
+    future_destroy(writer);
+    future_destroy(err);
+    async_process_destroy(p);
+
+    // A child that never reads its stdin fails the write instead of killing us
+    p = async_process_start("exit 0", ASYNC_PROC_OPT_STDIN);
+    async_process_wait(p);
+    char byte = 0;
+    printf("write to exited child: %zd\n", async_process_write_stdin(p, &byte, 1));
+    async_process_destroy(p);
+
+    // Children still die of SIGPIPE, even though we ignore it
+    p = async_process_start("kill -PIPE $$; echo survived", ASYNC_PROC_OPT_STDOUT);
+    status = async_process_wait(p);
+    printf("child killed by SIGPIPE: %s\n", WIFSIGNALED(status) && WTERMSIG(status) == SIGPIPE ? "yes" : "no");
+    async_process_destroy(p);
+    return NULL;
+}
+
+int main() {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+
+    if (async_context_run(ctx, entry, NULL) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+
+    async_context_destroy(ctx);
+
+    // Without a coroutine to suspend, destroying waits for the child
+    async_process_t *p = async_process_start("exit 0", ASYNC_PROC_OPT_STDOUT);
+    async_process_destroy(p);
+    printf("destroyed outside of a coroutine\n");
+
+    return 0;
+}
+
+/* TEST RESULT
+{
+    "stdout": [
+        "stderr: started",
+        "read 1048576 bytes, 1048576 uppercase",
+        "arrived in pieces: yes",
+        "exit code: 0",
+        "write to exited child: -1",
+        "child killed by SIGPIPE: yes",
+        "destroyed outside of a coroutine"
+    ]
+}
+*/
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "async.h"
+#include "future.h"
+#include "runtime.h"
+#include "logging.h"
+
+#define N_TASKS 200
+
+void *leaf(void *arg) {
+    async_yield();
+    return arg;
+}
+
+void *task(void *arg) {
+    uintptr_t i = (uintptr_t) arg;
+    // Awaiting a future that may be stolen by another worker
+    future_t *f = future_create_from_function(leaf, (void*) (i * 2), FUT_OPT_EAGER);
+    uintptr_t doubled = (uintptr_t) async_await_future(f);
+    future_destroy(f);
+    if (i % 50 == 0) {
+        async_sleep(1000000);
+    }
+    return (void*) (doubled + 1);
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    future_t *tasks[N_TASKS];
+    for (uintptr_t i = 0; i < N_TASKS; i++) {
+        tasks[i] = future_create_from_function(task, (void*) i, FUT_OPT_EAGER);
+    }
+    uintptr_t sum = 0;
+    for (size_t i = 0; i < N_TASKS; i++) {
+        sum += (uintptr_t) async_await_future(tasks[i]);
+        future_destroy(tasks[i]);
+    }
+    printf("sum = %lu\n", (unsigned long) sum);
+    return NULL;
+}
+
+int main() {
+    async_runtime_t *runtime = async_runtime_create(4, 0);
+    if (runtime == NULL) {
+        errorf("failed to create runtime\n");
+        return 1;
+    }
+
+    if (async_runtime_run(runtime, entry, NULL) != 0) {
+        errorf("error in runtime\n");
+        return 1;
+    }
+
+    async_runtime_destroy(runtime);
+    return 0;
+}
+
+/* TEST RESULT
+{
+    "stdout": "sum = 40000"
+}
+*/
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "async.h"
+#include "future.h"
+#include "logging.h"
+
+#define MS 1000000ULL
+
+void *sleeper(void *arg) {
+    uint64_t ms = (uintptr_t) arg;
+    uint64_t start = async_now();
+    async_sleep(ms * MS);
+    uint64_t elapsed = async_now() - start;
+    printf("slept %lu ms%s\n", (unsigned long) ms, elapsed >= ms * MS ? "" : " (woke up early)");
+    return NULL;
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    future_t *sleepers[] = {
+        future_create_from_function(sleeper, (void*) 30, FUT_OPT_EAGER),
+        future_create_from_function(sleeper, (void*) 10, FUT_OPT_EAGER),
+        future_create_from_function(sleeper, (void*) 20, FUT_OPT_EAGER)
+    };
+
+    future_t *timer = async_timer(5 * MS);
+    async_await_future(timer);
+    printf("timer fired\n");
+    future_destroy(timer);
+
+    async_sleep_until(async_now());
+    printf("sleep until now returned\n");
+
+    for (size_t i = 0; i < 3; i++) {
+        async_await_future(sleepers[i]);
+        future_destroy(sleepers[i]);
+    }
+    return NULL;
+}
+
+int main() {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+    
+    if (async_context_run(ctx, entry, NULL) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    
+    async_context_destroy(ctx);
+
+    return 0;
+}
+
+/* TEST RESULT
+{
+    "stdout": [
+        "timer fired",
+        "sleep until now returned",
+        "slept 10 ms",
+        "slept 20 ms",
+        "slept 30 ms"
+    ]
+}
+*/
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include "async.h"
+#include "funcs.h"
+#include "future.h"
+#include "logging.h"
+
+#define N_CHILDREN 32
+
+void *entry(void *arg) {
+    (void) arg;
+    future_t *hello = async_spawn("echo hello; echo world");
+    future_t *failing = async_spawn("echo ignored; exit 3");
+
+    async_spawn_result_t *result = async_await_future(hello);
+    printf("stdout: %s", result->stdout);
+    printf("status: %d\n", result->status);
+    async_await_future(failing);
+    printf("failing child rejected: %s\n", future_get_state(failing) == FUTURE_REJECTED ? "yes" : "no");
+    future_destroy(hello);
+    future_destroy(failing);
+
+    // Each child is only a pipe and a pidfd on this loop, all of them run at
+    // the same time
+    future_t *children[N_CHILDREN];
+    char command[64];
+    for (int i = 0; i < N_CHILDREN; i++) {
+        snprintf(command, sizeof(command), "sleep 0.1; echo %d", i);
+        children[i] = async_spawn(command);
+    }
+    uint64_t start = async_now();
+    int sum = 0;
+    for (int i = 0; i < N_CHILDREN; i++) {
+        async_spawn_result_t *child = async_await_future(children[i]);
+        if (child != NULL) {
+            int value = 0;
+            sscanf(child->stdout, "%d", &value);
+            sum += value;
+        }
+        future_destroy(children[i]);
+    }
+    printf("sum = %d\n", sum);
+    printf("children overlapped: %s\n", async_now() - start < 1000000000ull ? "yes" : "no");
+    return NULL;
+}
+
+int main() {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+
+    if (async_context_run(ctx, entry, NULL) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+
+    async_context_destroy(ctx);
+
+    return 0;
+}
+
+/* TEST RESULT
+{
+    "stdout": [
+        "stdout: hello",
+        "world",
+        "status: 0",
+        "failing child rejected: yes",
+        "sum = 496",
+        "children overlapped: yes"
+    ]
+}
+*/
@@ -0,0 +1,70 @@
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "async.h"
+#include "future.h"
+#include "logging.h"
+
+#define GUARD_HIT_STATUS 42
+
+static void on_segv(int) {
+    _exit(GUARD_HIT_STATUS);
+}
+
+static size_t recurse(size_t depth) {
+    volatile char frame[512];
+    frame[0] = (char) depth;
+    if (depth == SIZE_MAX) return 0;
+    return recurse(depth + 1) + frame[0];
+}
+
+void *overflowing(void *arg) {
+    (void) arg;
+    recurse(0);
+    return NULL;
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    future_t *f = future_create_from_function(overflowing, NULL, 0);
+    async_await_future(f);
+    future_destroy(f);
+    return NULL;
+}
+
+int main() {
+    pid_t pid = fork();
+    if (pid < 0) {
+        errorf("failed to fork\n");
+        return 1;
+    }
+    if (pid == 0) {
+        // The handler needs its own stack, the coroutine's is exhausted
+        static char altstack[64 * 1024];
+        sigaltstack(&(stack_t){.ss_sp = altstack, .ss_size = sizeof(altstack)}, NULL);
+        sigaction(SIGSEGV, &(struct sigaction){.sa_handler = on_segv, .sa_flags = SA_ONSTACK}, NULL);
+
+        async_context_t *ctx = async_context_create();
+        if (ctx == NULL) {
+            _exit(1);
+        }
+        async_context_run(ctx, entry, NULL);
+        _exit(0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    int hit_guard = WIFEXITED(status) && WEXITSTATUS(status) == GUARD_HIT_STATUS;
+    printf("stack overflow hit the guard page: %s\n", hit_guard ? "yes" : "no");
+    return 0;
+}
+
+/* TEST RESULT
+{
+    "stdout": "stack overflow hit the guard page: yes"
+}
+*/
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "async.h"
+#include "future.h"
+#include "sync.h"
+#include "logging.h"
+
+#define N_WORKERS 8
+#define N_ROUNDS 100
+#define N_CALLS 20
+#define MAX_CALLS 3
+#define N_THREAD_ROUNDS 10000
+
+static async_mutex_t mutex;
+static async_sem_t sem;
+static async_cond_t cond;
+static async_waitgroup_t wg;
+
+static int counter = 0;
+static int is_inside = 0;
+static int n_overlaps = 0;
+static int order[N_WORKERS];
+static int n_ordered = 0;
+
+void *locker(void *arg) {
+    int id = (int) (intptr_t) arg;
+    async_mutex_lock(&mutex);
+    order[n_ordered++] = id;
+    async_mutex_unlock(&mutex);
+
+    for (int i = 0; i < N_ROUNDS; i++) {
+        async_mutex_lock(&mutex);
+        if (is_inside) n_overlaps++;
+        is_inside = 1;
+        int value = counter;
+        // Give everyone else a chance to barge in
+        async_yield();
+        counter = value + 1;
+        is_inside = 0;
+        async_mutex_unlock(&mutex);
+    }
+    return NULL;
+}
+
+static int n_calling = 0;
+static int max_calling = 0;
+
+void *backend_call(void *arg) {
+    (void) arg;
+    async_sem_acquire(&sem);
+    if (++n_calling > max_calling) max_calling = n_calling;
+    async_sleep(1000 * 1000);
+    n_calling--;
+    async_sem_release(&sem);
+    async_waitgroup_done(&wg);
+    return NULL;
+}
+
+static int is_ready = 0;
+static int n_woken = 0;
+
+void *cond_waiter(void *arg) {
+    (void) arg;
+    async_mutex_lock(&mutex);
+    while (!is_ready) {
+        async_cond_wait(&cond, &mutex);
+    }
+    n_woken++;
+    async_mutex_unlock(&mutex);
+    async_waitgroup_done(&wg);
+    return NULL;
+}
+
+// Runs on a dispatch thread, which sleeps instead of parking
+void thread_locker(future_t *f, void *arg) {
+    (void) arg;
+    for (int i = 0; i < N_THREAD_ROUNDS; i++) {
+        async_mutex_lock(&mutex);
+        counter++;
+        async_mutex_unlock(&mutex);
+    }
+    async_waitgroup_done(&wg);
+    future_resolve(f, NULL, NULL);
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    async_mutex_init(&mutex);
+    async_sem_init(&sem, MAX_CALLS);
+    async_cond_init(&cond);
+    async_waitgroup_init(&wg);
+
+    // Held while the workers start, so they queue up in creation order
+    async_mutex_lock(&mutex);
+    future_t *workers[N_WORKERS];
+    for (intptr_t i = 0; i < N_WORKERS; i++) {
+        workers[i] = future_create_from_function(locker, (void*) i, FUT_OPT_EAGER);
+    }
+    async_yield();
+    printf("try_lock while held = %d\n", async_mutex_try_lock(&mutex));
+    async_mutex_unlock(&mutex);
+    for (size_t i = 0; i < N_WORKERS; i++) {
+        async_await_future(workers[i]);
+        future_destroy(workers[i]);
+    }
+    printf("counter = %d, overlaps = %d\n", counter, n_overlaps);
+    printf("order =");
+    for (int i = 0; i < n_ordered; i++) printf(" %d", order[i]);
+    printf("\n");
+
+    future_t *calls[N_CALLS];
+    async_waitgroup_add(&wg, N_CALLS);
+    for (size_t i = 0; i < N_CALLS; i++) {
+        calls[i] = future_create_from_function(backend_call, NULL, FUT_OPT_EAGER);
+    }
+    async_waitgroup_wait(&wg);
+    for (size_t i = 0; i < N_CALLS; i++) {
+        async_await_future(calls[i]);
+        future_destroy(calls[i]);
+    }
+    printf("at most %d concurrent calls: %d, count = %zu\n", MAX_CALLS, max_calling, async_sem_get_count(&sem));
+
+    future_t *waiters[4];
+    async_waitgroup_add(&wg, 4);
+    for (size_t i = 0; i < 4; i++) {
+        waiters[i] = future_create_from_function(cond_waiter, NULL, FUT_OPT_EAGER);
+    }
+    async_yield();
+    async_mutex_lock(&mutex);
+    is_ready = 1;
+    async_cond_broadcast(&cond);
+    async_mutex_unlock(&mutex);
+    async_waitgroup_wait(&wg);
+    for (size_t i = 0; i < 4; i++) {
+        async_await_future(waiters[i]);
+        future_destroy(waiters[i]);
+    }
+    printf("woken by broadcast = %d\n", n_woken);
+
+    counter = 0;
+    async_waitgroup_add(&wg, 1);
+    future_t *thread = async_dispatch(thread_locker, NULL);
+    for (int i = 0; i < N_THREAD_ROUNDS; i++) {
+        async_mutex_lock(&mutex);
+        counter++;
+        async_mutex_unlock(&mutex);
+        if (i % 100 == 0) async_yield();
+    }
+    async_waitgroup_wait(&wg);
+    async_await_future(thread);
+    future_destroy(thread);
+    printf("counter with a thread = %d\n", counter);
+    return NULL;
+}
+
+int main() {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+    if (async_context_run(ctx, entry, NULL) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    async_context_destroy(ctx);
+    return 0;
+}
+
+/* TEST RESULT
+{
+    "stdout": [
+        "try_lock while held = 1",
+        "counter = 800, overlaps = 0",
+        "order = 0 1 2 3 4 5 6 7",
+        "at most 3 concurrent calls: 3, count = 3",
+        "woken by broadcast = 4",
+        "counter with a thread = 20000"
+    ]
+}
+*/
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "async.h"
+#include "future.h"
+#include "logging.h"
+
+#define N_CALLS 10000
+
+static int is_done = 0;
+static size_t n_yields = 0;
+
+void *background(void *arg) {
+    (void) arg;
+    while (!is_done) {
+        n_yields++;
+        async_yield();
+    }
+    return NULL;
+}
+
+void *leaf(void *arg) {
+    return arg;
+}
+
+void *depth(void *arg) {
+    uintptr_t n = (uintptr_t) arg;
+    if (n == 0) return (void*) 0;
+    future_t *f = future_create_from_function(depth, (void*) (n - 1), 0);
+    uintptr_t below = (uintptr_t) async_await_future(f);
+    future_destroy(f);
+    return (void*) (below + 1);
+}
+
+void *yielding(void *arg) {
+    // Runs on its own after yielding, like any other coroutine
+    async_yield();
+    return arg;
+}
+
+void *entry(void *arg) {
+    (void) arg;
+    future_t *busy = future_create_from_function(background, NULL, FUT_OPT_EAGER);
+    async_yield();
+
+    // An awaited new future runs right away, and comes straight back once
+    // it is done, so the busy coroutine doesn't get a turn in between
+    size_t before = n_yields;
+    for (int i = 0; i < N_CALLS; i++) {
+        future_t *f = future_create_from_function(leaf, (void*) (intptr_t) i, 0);
+        if ((intptr_t) async_await_future(f) != i) {
+            printf("wrong result for call %d\n", i);
+        }
+        future_destroy(f);
+    }
+    printf("yields during calls: %zu\n", n_yields - before);
+
+    future_t *f = future_create_from_function(depth, (void*) 100, 0);
+    printf("depth: %d\n", (int) (intptr_t) async_await_future(f));
+    future_destroy(f);
+
+    before = n_yields;
+    f = future_create_from_function(yielding, (void*) 7, 0);
+    printf("yielding: %d\n", (int) (intptr_t) async_await_future(f));
+    printf("busy ran meanwhile: %s\n", n_yields > before ? "yes" : "no");
+    future_destroy(f);
+
+    // Started elsewhere already, so awaited the usual way
+    f = future_create_from_function(leaf, (void*) 3, FUT_OPT_EAGER);
+    printf("eager: %d\n", (int) (intptr_t) async_await_future_timeout(f, 1000 * 1000 * 1000));
+    future_destroy(f);
+
+    is_done = 1;
+    async_await_future(busy);
+    future_destroy(busy);
+    return NULL;
+}
+
+int main() {
+    async_context_t *ctx = async_context_create();
+    if (ctx == NULL) {
+        errorf("failed to create async context\n");
+        return 1;
+    }
+    if (async_context_run(ctx, entry, NULL) != 0) {
+        errorf("error in async context\n");
+        return 1;
+    }
+    async_context_destroy(ctx);
+    return 0;
+}
+
+/* TEST RESULT
+{"stdout": [
+"yields during calls: 0",
+"depth: 100",
+"yielding: 7",
+"busy ran meanwhile: yes",
+"eager: 3"
+]}
+*/